@@ -1,3 +1,19 @@
+if [ "$1" = "--reliable" ]; then
+  # Retransmits lost packets on NACK (register with "rtx", see discovery.sh).
+  # RTP on 5000, our RTCP on 5002, server RTCP/NACKs come back on 5003.
+  gst-launch-1.0 -v rtpbin name=rtpbin rtp-profile=avpf \
+    v4l2src device=/dev/video0 ! \
+    video/x-raw,width=1920,height=1080,framerate=30/1 ! \
+    videoconvert ! \
+    v4l2h264enc bitrate=10000000 ! video/x-h264,profile=high ! \
+    h264parse ! rtph264pay config-interval=1 pt=96 mtu=1400 ! \
+    rtprtxsend payload-type-map="application/x-rtp-pt-map,96=(uint)97" max-size-time=500 ! rtpbin.send_rtp_sink_0 \
+    rtpbin.send_rtp_src_0 ! udpsink host=239.0.0.1 port=5000 auto-multicast=true \
+    rtpbin.send_rtcp_src_0 ! udpsink host=239.0.0.1 port=5002 auto-multicast=true sync=false async=false \
+    udpsrc port=5003 ! rtpbin.recv_rtcp_sink_0
+  exit
+fi
+
 gst-launch-1.0 -v v4l2src device=/dev/video0 ! \
   video/x-raw,width=1920,height=1080,framerate=30/1 ! \
   videoconvert ! \
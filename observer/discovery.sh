@@ -1,2 +1,9 @@
 # Replace <server_ip> with your Server's IP
 echo -n "REGISTER <NAME> 5000" | nc -u -w 1 <SERVER_IP> 5001
+
+# If the camera runs 'connection.sh --reliable', register it with "rtx" so the
+# server adds a jitter buffer and requests retransmissions of lost packets:
+# echo -n "REGISTER <NAME> 5000 rtx" | nc -u -w 1 <SERVER_IP> 5001
+
+# To take the camera (and its rtsp://<SERVER_IP>:8554/live/<NAME> mount) offline:
+# echo -n "UNREGISTER <NAME>" | nc -u -w 1 <SERVER_IP> 5001
@@ -0,0 +1,26 @@
+# Emulates a lossy Wi-Fi link on the camera's interface to check the reliable
+# ingest: run it on the camera, then compare "lost" and "rtx_recovered" in
+# http://<SERVER_IP>:8080/api/stats with and without "rtx" at registration.
+#
+# Usage: sudo ./simulate_loss.sh <iface> [loss%] [delay_ms] [--test-source]
+# --test-source sends a test pattern (reliable mode) instead of the camera.
+IFACE=${1:?usage: $0 <iface> [loss%] [delay_ms] [--test-source]}
+LOSS=${2:-2}
+DELAY=${3:-20}
+
+tc qdisc add dev "$IFACE" root netem loss "$LOSS"% delay "$DELAY"ms 10ms || exit 1
+trap 'tc qdisc del dev "$IFACE" root' EXIT
+echo "netem on $IFACE: ${LOSS}% loss, ${DELAY}ms +/- 10ms delay (Ctrl+C to remove)"
+
+if [ "$4" = "--test-source" ]; then
+  gst-launch-1.0 rtpbin name=rtpbin rtp-profile=avpf \
+    videotestsrc is-live=true ! video/x-raw,width=1280,height=720,framerate=30/1 ! \
+    x264enc tune=zerolatency bitrate=4000 key-int-max=30 ! h264parse ! \
+    rtph264pay config-interval=1 pt=96 mtu=1400 ! \
+    rtprtxsend payload-type-map="application/x-rtp-pt-map,96=(uint)97" max-size-time=500 ! rtpbin.send_rtp_sink_0 \
+    rtpbin.send_rtp_src_0 ! udpsink host=239.0.0.1 port=5000 auto-multicast=true \
+    rtpbin.send_rtcp_src_0 ! udpsink host=239.0.0.1 port=5002 auto-multicast=true sync=false async=false \
+    udpsrc port=5003 ! rtpbin.recv_rtcp_sink_0
+else
+  read -r -p "Press Enter to stop... " _
+fi
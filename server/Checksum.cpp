@@ -0,0 +1,473 @@
+#include "Checksum.hpp"
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+#include <iomanip>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <nmmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+#include "Logger.hpp"
+
+namespace {
+
+struct Header {
+    char magic[8];
+    uint32_t header_size;
+    uint32_t chunk_size;
+    uint32_t closed;
+    uint32_t reserved;
+    uint64_t size;
+};
+static_assert(sizeof(Header) <= ChecksumWriter::HEADER_SIZE, "checksum header too large");
+static_assert(sizeof(ChecksumEntry) == 8, "checksum entry layout");
+
+// Chunk data held by all writers, and the most it has been
+std::atomic<uint64_t> held_bytes{0};
+std::atomic<uint64_t> held_peak{0};
+
+void hold(int64_t bytes) {
+    uint64_t now = held_bytes += bytes;
+    uint64_t peak = held_peak;
+    while (now > peak && !held_peak.compare_exchange_weak(peak, now)) {
+    }
+}
+
+// Slicing-by-8 tables for the reflected Castagnoli polynomial
+struct Crc32cTables {
+    uint32_t t[8][256];
+    Crc32cTables() {
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k) c = (c >> 1) ^ (0x82F63B78u & (0u - (c & 1)));
+            t[0][i] = c;
+        }
+        for (uint32_t i = 0; i < 256; ++i) {
+            for (int s = 1; s < 8; ++s) t[s][i] = (t[s - 1][i] >> 8) ^ t[0][t[s - 1][i] & 0xff];
+        }
+    }
+};
+
+uint32_t crc32c_table(uint32_t crc, const unsigned char* p, size_t n) {
+    static const Crc32cTables tables;
+    const auto& t = tables.t;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    while (n >= 8) {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        v ^= crc;
+        crc = t[7][v & 0xff] ^ t[6][(v >> 8) & 0xff] ^ t[5][(v >> 16) & 0xff] ^ t[4][(v >> 24) & 0xff] ^
+              t[3][(v >> 32) & 0xff] ^ t[2][(v >> 40) & 0xff] ^ t[1][(v >> 48) & 0xff] ^ t[0][v >> 56];
+        p += 8;
+        n -= 8;
+    }
+#endif
+    while (n--) crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xff];
+    return crc;
+}
+
+#if defined(__GNUC__) && defined(__x86_64__)
+// 8 bytes per instruction; picked at run time, so the build needs no -msse4.2
+__attribute__((target("sse4.2"))) uint32_t crc32c_sse42(uint32_t crc, const unsigned char* p, size_t n) {
+    uint64_t c = crc;
+    while (n >= 8) {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        c = _mm_crc32_u64(c, v);
+        p += 8;
+        n -= 8;
+    }
+    while (n--) c = _mm_crc32_u8(static_cast<uint32_t>(c), *p++);
+    return static_cast<uint32_t>(c);
+}
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+uint32_t crc32c_armv8(uint32_t crc, const unsigned char* p, size_t n) {
+    while (n >= 8) {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        crc = __crc32cd(crc, v);
+        p += 8;
+        n -= 8;
+    }
+    while (n--) crc = __crc32cb(crc, *p++);
+    return crc;
+}
+#endif
+
+struct Crc32cImplementation {
+    uint32_t (*update)(uint32_t, const unsigned char*, size_t);
+    const char* name;
+};
+
+const Crc32cImplementation& implementation() {
+    static const Crc32cImplementation picked = []() -> Crc32cImplementation {
+#if defined(__GNUC__) && defined(__x86_64__)
+        if (__builtin_cpu_supports("sse4.2")) return {crc32c_sse42, "sse4.2"};
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+        return {crc32c_armv8, "armv8"};
+#endif
+        return {crc32c_table, "table"};
+    }();
+    return picked;
+}
+
+// Per sink state of ChecksumWriter::attach()
+struct SinkSummer {
+    GstElement* sink; // Not owned: the probe goes away with the sink's pad
+    ChecksumWriter writer;
+    bool opened = false; // Tried for the current file
+    uint64_t position = 0;
+};
+
+} // namespace
+
+uint32_t crc32c(uint32_t crc, const void* data, size_t length) {
+    return ~implementation().update(~crc, static_cast<const unsigned char*>(data), length);
+}
+
+const char* crc32c_implementation() {
+    return implementation().name;
+}
+
+ChecksumWriter::~ChecksumWriter() {
+    close();
+}
+
+bool ChecksumWriter::open(const std::string& video_file) {
+    close();
+    std::string path = path_for(video_file);
+    file = fopen(path.c_str(), "wb");
+    if (!file) {
+        Logger::error("[Checksum] Could not create " + path);
+        return false;
+    }
+
+    char block[HEADER_SIZE] = {0};
+    Header header = {};
+    memcpy(header.magic, MAGIC, 8);
+    header.header_size = HEADER_SIZE;
+    header.chunk_size = CHUNK_SIZE;
+    memcpy(block, &header, sizeof(header));
+    if (fwrite(block, 1, HEADER_SIZE, file) != HEADER_SIZE || fflush(file) != 0) {
+        Logger::error("[Checksum] Could not write " + path);
+        fclose(file);
+        file = nullptr;
+        return false;
+    }
+    video = video_file;
+    release_pending();
+    lost.clear();
+    next_summed = 1;
+    end = 0;
+    cluster_start = 0;
+    patching = false;
+    summed_bytes = 0;
+    sum_ns = 0;
+    return true;
+}
+
+void ChecksumWriter::write(uint64_t offset, const void* data, size_t length) {
+    if (!file) return;
+    const char* p = static_cast<const char*>(data);
+    while (length > 0) {
+        uint64_t number = offset / CHUNK_SIZE;
+        size_t at = offset % CHUNK_SIZE;
+        size_t n = std::min<size_t>(length, CHUNK_SIZE - at);
+        if (number != 0 && number < next_summed) {
+            // Rewritten before the current cluster: the sum no longer holds
+            if (lost.insert(number).second) put_entry(number, {0, 0});
+        } else {
+            std::vector<char>& chunk = pending[number];
+            if (chunk.empty()) {
+                chunk.resize(CHUNK_SIZE);
+                hold(CHUNK_SIZE);
+            }
+            memcpy(chunk.data() + at, p, n);
+        }
+        offset += n;
+        p += n;
+        length -= n;
+        end = std::max(end, offset);
+    }
+
+    uint64_t summable = std::max(cluster_start, end > WINDOW ? end - WINDOW : 0);
+    while ((next_summed + 1) * CHUNK_SIZE <= summable) {
+        sum(next_summed, CHUNK_SIZE);
+        next_summed++;
+    }
+}
+
+void ChecksumWriter::seek(uint64_t offset) {
+    if (offset < end) {
+        patching = true;
+    } else if (patching && offset == end) {
+        // Back at the end: the clusters before are final
+        patching = false;
+        cluster_start = offset;
+    }
+}
+
+void ChecksumWriter::sum(uint64_t number, size_t length) {
+    static const std::vector<char> zeros(CHUNK_SIZE); // Never written (sparse)
+    auto it = pending.find(number);
+    const char* data = it != pending.end() ? it->second.data() : zeros.data();
+
+    auto started = std::chrono::steady_clock::now();
+    uint32_t crc = crc32c(0, data, length);
+    sum_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - started).count();
+    summed_bytes += length;
+
+    put_entry(number, {crc, CHUNK_VALID});
+    fflush(file);
+    if (it != pending.end()) {
+        pending.erase(it);
+        hold(-static_cast<int64_t>(CHUNK_SIZE));
+    }
+}
+
+void ChecksumWriter::release_pending() {
+    hold(-static_cast<int64_t>(pending.size() * CHUNK_SIZE));
+    pending.clear();
+}
+
+uint64_t ChecksumWriter::pending_bytes() {
+    return held_bytes;
+}
+
+uint64_t ChecksumWriter::peak_pending_bytes() {
+    return held_peak;
+}
+
+void ChecksumWriter::put_entry(uint64_t number, const ChecksumEntry& entry) {
+    fseek(file, static_cast<long>(HEADER_SIZE + number * sizeof(ChecksumEntry)), SEEK_SET);
+    fwrite(&entry, sizeof(entry), 1, file);
+}
+
+void ChecksumWriter::close() {
+    if (!file) return;
+    uint64_t chunks = (end + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    for (uint64_t number = 0; number < chunks; ++number) {
+        if (number != 0 && number < next_summed) continue;
+        sum(number, static_cast<size_t>(std::min<uint64_t>(CHUNK_SIZE, end - number * CHUNK_SIZE)));
+    }
+    release_pending();
+
+    Header header = {};
+    memcpy(header.magic, MAGIC, 8);
+    header.header_size = HEADER_SIZE;
+    header.chunk_size = CHUNK_SIZE;
+    header.closed = 1;
+    header.size = end;
+    fseek(file, 0, SEEK_SET);
+    fwrite(&header, sizeof(header), 1, file);
+    fflush(file);
+#ifndef _WIN32
+    fsync(fileno(file));
+#endif
+    fclose(file);
+    file = nullptr;
+
+    // What the sums cost the writer, for comparison with its throughput
+    std::stringstream ss;
+    ss << "[Checksum] " << video << ": " << chunks << " chunks, " << std::fixed << std::setprecision(1)
+       << sum_ns / 1e6 << " ms in crc32c (" << crc32c_implementation() << ", "
+       << (sum_ns ? summed_bytes / (sum_ns / 1e9) / (1024 * 1024 * 1024) : 0.0) << " GB/s)";
+    if (!lost.empty()) ss << ", " << lost.size() << " chunk(s) rewritten late and left unchecked";
+    Logger::info(ss.str());
+}
+
+void ChecksumWriter::attach(GstElement* sink) {
+    GstPad* pad = gst_element_get_static_pad(sink, "sink");
+    if (!pad) return;
+    SinkSummer* summer = new SinkSummer{sink};
+    gst_pad_add_probe(pad, static_cast<GstPadProbeType>(GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM),
+                      sink_probe, summer, [](gpointer data) { delete static_cast<SinkSummer*>(data); });
+    gst_object_unref(pad);
+}
+
+GstPadProbeReturn ChecksumWriter::sink_probe(GstPad*, GstPadProbeInfo* info, gpointer user_data) {
+    SinkSummer* summer = static_cast<SinkSummer*>(user_data);
+
+    if (GST_PAD_PROBE_INFO_TYPE(info) & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM) {
+        GstEvent* event = GST_PAD_PROBE_INFO_EVENT(info);
+        if (GST_EVENT_TYPE(event) == GST_EVENT_SEGMENT) {
+            const GstSegment* segment;
+            gst_event_parse_segment(event, &segment);
+            if (segment->format == GST_FORMAT_BYTES) {
+                summer->position = segment->start;
+                summer->writer.seek(segment->start);
+            }
+        } else if (GST_EVENT_TYPE(event) == GST_EVENT_EOS) {
+            summer->writer.close();
+            summer->opened = false;
+        }
+        return GST_PAD_PROBE_OK;
+    }
+
+    GstBuffer* buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    if (!summer->opened) {
+        summer->opened = true;
+        summer->position = 0;
+        gchar* location = nullptr;
+        g_object_get(summer->sink, "location", &location, nullptr);
+        if (location) summer->writer.open(location);
+        g_free(location);
+    }
+
+    GstMapInfo map;
+    if (summer->writer.is_open() && gst_buffer_map(buffer, &map, GST_MAP_READ)) {
+        summer->writer.write(summer->position, map.data, map.size);
+        gst_buffer_unmap(buffer, &map);
+    }
+    summer->position += gst_buffer_get_size(buffer);
+    return GST_PAD_PROBE_OK;
+}
+
+const char* ChecksumResult::status_name(Status status) {
+    switch (status) {
+    case OK: return "ok";
+    case CORRUPT: return "corrupt";
+    case TRUNCATED: return "truncated";
+    case UNFINISHED: return "unfinished";
+    case NO_CHECKSUM: return "no_checksum";
+    default: return "unreadable";
+    }
+}
+
+ChecksumResult verify_checksum(const std::string& video_file) {
+    ChecksumResult result = {video_file, ChecksumResult::NO_CHECKSUM, 0, 0, 0, 0, 0};
+    FILE* sums = fopen(ChecksumWriter::path_for(video_file).c_str(), "rb");
+    if (!sums) return result;
+
+    Header header = {};
+    std::vector<ChecksumEntry> entries;
+    bool valid = fread(&header, sizeof(header), 1, sums) == 1 &&
+                 memcmp(header.magic, ChecksumWriter::MAGIC, 8) == 0 && header.header_size >= sizeof(Header) &&
+                 header.chunk_size > 0 && header.chunk_size <= 64 * 1024 * 1024 &&
+                 fseek(sums, header.header_size, SEEK_SET) == 0;
+    ChecksumEntry entry;
+    while (valid && fread(&entry, sizeof(entry), 1, sums) == 1) entries.push_back(entry); // Torn last entry left out
+    fclose(sums);
+    uint64_t expected_chunks = (header.size + header.chunk_size - 1) / std::max<uint32_t>(header.chunk_size, 1);
+    if (!valid || (header.closed && entries.size() < expected_chunks)) {
+        result.status = ChecksumResult::UNREADABLE;
+        return result;
+    }
+    if (header.closed) entries.resize(expected_chunks);
+
+    FILE* in = fopen(video_file.c_str(), "rb");
+    struct stat st;
+    if (!in || stat(video_file.c_str(), &st) != 0) {
+        if (in) fclose(in);
+        result.status = ChecksumResult::UNREADABLE;
+        return result;
+    }
+    result.size = st.st_size;
+    result.chunks = entries.size();
+#ifdef __linux__
+    posix_fadvise(fileno(in), 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+    std::vector<char> buffer(header.chunk_size);
+    bool truncated = false;
+    for (uint64_t number = 0; number < entries.size(); ++number) {
+        uint64_t offset = number * header.chunk_size;
+        size_t want = header.closed ? static_cast<size_t>(std::min<uint64_t>(header.chunk_size, header.size - offset))
+                                    : header.chunk_size;
+        size_t got = fread(buffer.data(), 1, want, in);
+        bool checked = entries[number].flags & ChecksumWriter::CHUNK_VALID;
+        if (got < want && (header.closed || checked)) {
+            truncated = true;
+            result.bad_chunks += entries.size() - number;
+            if (!result.first_bad_offset) result.first_bad_offset = offset + got;
+            break;
+        }
+        if (!checked) {
+            result.unchecked_chunks++;
+            continue;
+        }
+        if (crc32c(0, buffer.data(), got) != entries[number].crc) {
+            if (!result.bad_chunks) result.first_bad_offset = offset;
+            result.bad_chunks++;
+        }
+#ifdef __linux__
+        // Verifying years of footage should not push everything else out of the page cache
+        if ((number + 1) % 64 == 0) posix_fadvise(fileno(in), 0, offset + got, POSIX_FADV_DONTNEED);
+#endif
+    }
+    fclose(in);
+
+    if (truncated) result.status = ChecksumResult::TRUNCATED;
+    else if (result.bad_chunks) result.status = ChecksumResult::CORRUPT;
+    else if (!header.closed) result.status = ChecksumResult::UNFINISHED;
+    else if (result.size != header.size) {
+        // Data after the recording's end
+        result.status = ChecksumResult::CORRUPT;
+        result.first_bad_offset = header.size;
+    } else {
+        result.status = ChecksumResult::OK;
+    }
+    return result;
+}
+
+void verify_checksums(const std::vector<std::string>& files, unsigned threads,
+                      const std::function<void(const ChecksumResult&)>& on_result, const std::atomic<bool>* abort) {
+    if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+    threads = static_cast<unsigned>(std::min<size_t>(threads, files.size()));
+    std::atomic<size_t> next{0};
+    std::vector<std::thread> workers;
+    for (unsigned t = 0; t < threads; ++t) {
+        workers.emplace_back([&]() {
+            for (size_t i = next++; i < files.size() && !(abort && *abort); i = next++) on_result(verify_checksum(files[i]));
+        });
+    }
+    for (auto& worker : workers) worker.join();
+}
+
+ChecksumScan::~ChecksumScan() {
+    quit = true;
+    if (thread.joinable()) thread.join();
+}
+
+bool ChecksumScan::start(const std::vector<std::string>& files) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (current.running) return false;
+    if (thread.joinable()) thread.join(); // Finished already
+    current = {};
+    current.running = true;
+    current.files = files.size();
+    started = std::chrono::steady_clock::now();
+    thread = std::thread([this, files]() {
+        verify_checksums(files, 0, [this](const ChecksumResult& result) {
+            std::lock_guard<std::mutex> lock(mutex);
+            current.checked++;
+            current.bytes += result.size;
+            if (result.status == ChecksumResult::OK) current.ok++;
+            else if (result.status == ChecksumResult::NO_CHECKSUM) current.unsummed++;
+            else current.failures.push_back(result);
+        }, &quit);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        current.running = false;
+        current.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+        std::stringstream ss;
+        ss << "[Checksum] Verified " << current.checked << " recordings (" << current.bytes / (1024 * 1024)
+           << " MB) in " << std::fixed << std::setprecision(1) << current.seconds << " s: " << current.ok << " ok, "
+           << current.failures.size() << " failed, " << current.unsummed << " without sums";
+        Logger::info(ss.str());
+    });
+    return true;
+}
+
+ChecksumScan::Status ChecksumScan::status() {
+    std::lock_guard<std::mutex> lock(mutex);
+    Status copy = current;
+    if (copy.running) copy.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    return copy;
+}
@@ -0,0 +1,137 @@
+#pragma once
+#include <gst/gst.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+
+// CRC32C (Castagnoli) with the CPU's CRC instructions where it has them
+// (SSE4.2 on x86-64, the CRC extension on ARMv8), slicing-by-8 otherwise
+uint32_t crc32c(uint32_t crc, const void* data, size_t length);
+const char* crc32c_implementation(); // "sse4.2", "armv8" or "table"
+
+// Integrity sums kept next to every recording (<recording>.crc), so a
+// truncated or bit-rotted file can be told apart from a good one. File
+// layout (host byte order):
+//   Header (HEADER_SIZE bytes): "MKVCRC01" | uint32 header size | uint32 chunk
+//     size | uint32 closed (0 while being written) | uint32 0 | uint64
+//     recording size | zeros
+//   One entry per chunk of the recording: uint32 CRC32C | uint32 flags
+// Entries are written as the recording grows. Muxers seek back to patch
+// sizes (matroskamux: each cluster's, once it is complete), so a chunk's sum
+// is only taken once it lies before the current cluster: where the muxer
+// returned to after its last patch. A cluster is one GOP, and can be tens of
+// MB long (65 s max-cluster-duration at 10 Mbit/s); WINDOW only caps that for
+// muxers that never come back. The first chunk (header, rewritten on close)
+// and the size come last.
+struct ChecksumEntry {
+    uint32_t crc;
+    uint32_t flags;
+};
+
+class ChecksumWriter {
+public:
+    static constexpr char MAGIC[9] = "MKVCRC01";
+    static constexpr size_t HEADER_SIZE = 64;
+    static constexpr uint32_t CHUNK_SIZE = 1024 * 1024;
+    static constexpr uint64_t WINDOW = 128ULL * CHUNK_SIZE; // Longest a chunk is held
+    static constexpr uint32_t CHUNK_VALID = 1; // Not set: rewritten after its sum was taken
+
+    ~ChecksumWriter();
+
+    bool open(const std::string& video_file);
+    // Data as it goes into the recording at offset (appends and rewrites)
+    void write(uint64_t offset, const void* data, size_t length);
+    // The muxer moved the write position (byte segment)
+    void seek(uint64_t offset);
+    void close(); // Sums what is left, writes the size, fsyncs
+    bool is_open() const { return file != nullptr; }
+
+    static std::string path_for(const std::string& video_file) { return video_file + ".crc"; }
+
+    // Sums everything written through a file sink, like SeekIndexWriter::attach
+    // (follows byte segments; a new sidecar per file, from "location")
+    static void attach(GstElement* sink);
+
+    // Chunk data held for summing by all writers in the process, now and at
+    // most (the current cluster, up to WINDOW, per recording)
+    static uint64_t pending_bytes();
+    static uint64_t peak_pending_bytes();
+
+private:
+    FILE* file = nullptr;
+    std::string video;
+    std::map<uint64_t, std::vector<char>> pending; // Chunk data by number, sum not taken yet
+    uint64_t next_summed = 1;          // Chunks below (but 0) are summed
+    uint64_t end = 0;                  // Recording size so far
+    uint64_t cluster_start = 0;        // Where the muxer came back to after its last patch
+    bool patching = false;             // Seeked back, not at the end again yet
+    uint64_t summed_bytes = 0;
+    uint64_t sum_ns = 0;               // Time spent in crc32c()
+    std::set<uint64_t> lost;           // Rewritten after being summed
+
+    void sum(uint64_t number, size_t length);
+    void put_entry(uint64_t number, const ChecksumEntry& entry);
+    void release_pending();
+
+    static GstPadProbeReturn sink_probe(GstPad* pad, GstPadProbeInfo* info, gpointer user_data);
+};
+
+struct ChecksumResult {
+    enum Status { OK, CORRUPT, TRUNCATED, UNFINISHED, NO_CHECKSUM, UNREADABLE };
+
+    std::string path;
+    Status status;
+    uint64_t size;             // Of the recording on disk
+    uint64_t chunks;
+    uint64_t bad_chunks;
+    uint64_t unchecked_chunks; // No valid sum (see CHUNK_VALID)
+    uint64_t first_bad_offset;
+
+    static const char* status_name(Status status);
+};
+
+// Re-reads a recording and compares it with its sidecar. UNFINISHED: the
+// recording was never closed (crash); the chunks summed so far are checked.
+ChecksumResult verify_checksum(const std::string& video_file);
+
+// Verifies many recordings with one thread per core (or threads), calling
+// on_result from the worker threads as each one finishes. Stops early once
+// *abort is set.
+void verify_checksums(const std::vector<std::string>& files, unsigned threads,
+                      const std::function<void(const ChecksumResult&)>& on_result,
+                      const std::atomic<bool>* abort = nullptr);
+
+// Background run of verify_checksums() with progress for the API
+class ChecksumScan {
+public:
+    struct Status {
+        bool running;
+        size_t files;
+        size_t checked;
+        size_t ok;
+        size_t unsummed;  // Recordings without a sidecar
+        uint64_t bytes;
+        double seconds;
+        std::vector<ChecksumResult> failures;
+    };
+
+    ~ChecksumScan();
+
+    bool start(const std::vector<std::string>& files); // false if one is running
+    Status status();
+
+private:
+    std::mutex mutex;
+    std::atomic<bool> quit{false};
+    Status current = {};
+    std::chrono::steady_clock::time_point started;
+    std::thread thread;
+};
@@ -0,0 +1,49 @@
+#include "ContextThread.hpp"
+#include "Logger.hpp"
+
+ContextThread::ContextThread(const std::string& name) : name(name) {
+    context = g_main_context_new();
+    loop = g_main_loop_new(context, FALSE);
+    thread = std::thread([this]() {
+        g_main_context_push_thread_default(context);
+        g_main_loop_run(loop);
+        g_main_context_pop_thread_default(context);
+    });
+    Logger::info("[ContextThread] Started " + this->name);
+}
+
+ContextThread::~ContextThread() {
+    g_main_loop_quit(loop);
+    if (thread.joinable()) thread.join();
+    g_main_loop_unref(loop);
+    g_main_context_unref(context);
+}
+
+GSource* ContextThread::attach(GSource* source, GSourceFunc func, gpointer user_data) {
+    g_source_set_callback(source, func, user_data, nullptr);
+    g_source_attach(source, context);
+    return source;
+}
+
+GSource* ContextThread::add_bus_watch(GstElement* pipeline, GstBusFunc func, gpointer user_data) {
+    GstBus* bus = gst_element_get_bus(pipeline);
+    GSource* source = gst_bus_create_watch(bus);
+    gst_object_unref(bus);
+    return attach(source, (GSourceFunc)func, user_data);
+}
+
+GSource* ContextThread::add_timeout(guint interval_ms, GSourceFunc func, gpointer user_data) {
+    return attach(g_timeout_source_new(interval_ms), func, user_data);
+}
+
+void ContextThread::add_idle(GSourceFunc func, gpointer user_data) {
+    GSource* source = attach(g_idle_source_new(), func, user_data);
+    g_source_unref(source);
+}
+
+void ContextThread::remove(GSource*& source) {
+    if (!source) return;
+    g_source_destroy(source);
+    g_source_unref(source);
+    source = nullptr;
+}
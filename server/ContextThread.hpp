@@ -0,0 +1,32 @@
+#pragma once
+#include <gst/gst.h>
+#include <string>
+#include <thread>
+
+// A GMainContext with its own thread. Bus watches, timeouts and idle work of
+// one camera are attached here instead of the default main loop, so a slow
+// callback only ever delays its own camera.
+//
+// Sources are returned with a reference held; release them with remove(),
+// which is safe from any thread and on sources that already returned FALSE.
+class ContextThread {
+public:
+    explicit ContextThread(const std::string& name);
+    ~ContextThread(); // Quits the loop and joins the thread
+
+    GMainContext* get_context() const { return context; }
+
+    GSource* add_bus_watch(GstElement* pipeline, GstBusFunc func, gpointer user_data);
+    GSource* add_timeout(guint interval_ms, GSourceFunc func, gpointer user_data);
+    void add_idle(GSourceFunc func, gpointer user_data); // Fire and forget
+
+    static void remove(GSource*& source);
+
+private:
+    std::string name;
+    GMainContext* context;
+    GMainLoop* loop;
+    std::thread thread;
+
+    GSource* attach(GSource* source, GSourceFunc func, gpointer user_data);
+};
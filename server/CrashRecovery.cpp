@@ -0,0 +1,283 @@
+#include "CrashRecovery.hpp"
+#include <filesystem>
+#include <algorithm>
+#include <sstream>
+#include <iomanip>
+#include <cstdio>
+#include <sys/stat.h>
+#include "Checksum.hpp"
+#include "Logger.hpp"
+#include "SeekIndex.hpp"
+#include "Transcoder.hpp"
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr uint64_t EBML_ID = 0x1A45DFA3;
+constexpr uint64_t SEGMENT_ID = 0x18538067;
+
+// EBML variable-length integer at pos: element IDs keep their length marker,
+// sizes do not. unknown: a size with all bits set (matroskamux writes the
+// segment's like that and patches it on EOS).
+bool read_vint(const unsigned char* data, size_t length, size_t& pos, bool is_id, uint64_t& value, bool& unknown) {
+    if (pos >= length || data[pos] == 0) return false;
+    int width = 1;
+    while (!(data[pos] & (0x80 >> (width - 1)))) width++;
+    if (pos + width > length) return false;
+    value = is_id ? data[pos] : data[pos] & (0xFF >> width);
+    for (int i = 1; i < width; ++i) value = (value << 8) | data[pos + i];
+    unknown = !is_id && value == (1ULL << (7 * width)) - 1;
+    pos += width;
+    return true;
+}
+
+double index_end(const std::unique_ptr<SeekIndex>& index) {
+    return index && index->size() > 0 ? (*index)[index->size() - 1].pts / 1e9 : 0;
+}
+
+} // namespace
+
+CrashRecovery::CrashRecovery(VideoStorage& storage, RetentionEngine& retention)
+    : storage(storage), retention(retention) {}
+
+CrashRecovery::~CrashRecovery() {
+    stop();
+}
+
+void CrashRecovery::start(unsigned workers) {
+    if (thread.joinable()) return;
+    // Leave the other half to the live pipelines
+    if (workers == 0) workers = std::max(1u, std::thread::hardware_concurrency() / 2);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stats = {};
+        stats.running = true;
+        stats.workers = workers;
+    }
+    thread = std::thread(&CrashRecovery::run, this, workers, std::time(nullptr));
+}
+
+void CrashRecovery::stop() {
+    quit = true;
+    if (thread.joinable()) thread.join();
+}
+
+CrashRecovery::Stats CrashRecovery::get_stats() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return stats;
+}
+
+CrashRecovery::State CrashRecovery::check(const std::string& path) {
+    unsigned char head[256];
+    FILE* file = fopen(path.c_str(), "rb");
+    if (!file) return NOT_MKV;
+    size_t length = fread(head, 1, sizeof(head), file);
+    fclose(file);
+
+    size_t pos = 0;
+    uint64_t id, size;
+    bool unknown;
+    if (!read_vint(head, length, pos, true, id, unknown) || id != EBML_ID ||
+        !read_vint(head, length, pos, false, size, unknown) || unknown || pos + size > length) {
+        return NOT_MKV;
+    }
+    pos += size;
+    if (!read_vint(head, length, pos, true, id, unknown) || id != SEGMENT_ID ||
+        !read_vint(head, length, pos, false, size, unknown)) {
+        return NOT_MKV;
+    }
+    return unknown ? UNFINALIZED : FINALIZED;
+}
+
+void CrashRecovery::run(unsigned workers, time_t started) {
+    auto began = std::chrono::steady_clock::now();
+    // Outputs of repairs a previous run did not finish
+    for (const auto& output : storage.list_repair_outputs()) {
+        std::error_code ec;
+        fs::remove(output, ec);
+        fs::remove(SeekIndexWriter::path_for(output), ec);
+        fs::remove(ChecksumWriter::path_for(output), ec);
+        Logger::info("[Recovery] Removed the unfinished repair " + output);
+    }
+
+    // Older than this process: nothing among them is being recorded
+    std::vector<std::string> files;
+    for (const auto& file : storage.list_videos()) {
+        struct stat st;
+        if (stat(file.c_str(), &st) == 0 && st.st_mtime < started) files.push_back(file);
+    }
+
+    // The repair pipelines' streaming threads, at the lowest priority
+    task_pool = Transcoder::new_idle_pool();
+    std::atomic<size_t> next{0};
+    std::vector<std::thread> pool;
+    for (unsigned w = 0; w < std::min<size_t>(workers, files.size()); ++w) {
+        pool.emplace_back([&]() {
+#ifndef _WIN32
+            // This thread only (Linux): it reads the headers and waits on the
+            // repairs, whose streaming threads come from the idle pool
+            setpriority(PRIO_PROCESS, 0, 19);
+#endif
+            for (size_t i = next++; i < files.size() && !quit; i = next++) {
+                State state = check(files[i]);
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    stats.scanned++;
+                    if (state == UNFINALIZED) stats.unfinalized++;
+                }
+                if (state != UNFINALIZED) continue;
+
+                auto repair_started = std::chrono::steady_clock::now();
+                bool repaired = repair(files[i]);
+                double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - repair_started).count();
+                std::lock_guard<std::mutex> lock(mutex);
+                if (repaired) {
+                    stats.repaired++;
+                    stats.repair_seconds += seconds;
+                } else if (!quit) {
+                    stats.failed++;
+                }
+            }
+        });
+    }
+    for (auto& worker : pool) worker.join();
+    gst_object_unref(task_pool);
+    task_pool = nullptr;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    stats.running = false;
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - began).count();
+    if (quit) return;
+    std::stringstream ss;
+    ss << "[Recovery] Checked " << stats.scanned << " recordings in " << std::fixed << std::setprecision(1)
+       << stats.seconds << " s with " << workers << " worker(s): " << stats.unfinalized << " unfinalized, "
+       << stats.repaired << " repaired";
+    if (stats.repaired) ss << " (" << std::setprecision(2) << stats.repair_seconds / stats.repaired << " s each)";
+    if (stats.failed) ss << ", " << stats.failed << " left as they were";
+    Logger::info(ss.str());
+}
+
+// Remuxes into <file>.recover: matroskademux reads the clusters that made it
+// to disk, matroskamux writes them out again and gets its EOS this time
+bool CrashRecovery::repair(const std::string& file) {
+    if (!retention.hold(file)) {
+        Logger::error("[Recovery] " + file + " is in use, left for the next start");
+        return false;
+    }
+
+    // Not .mkv, so neither the catalog nor retention pick it up meanwhile
+    std::string output = file + ".recover";
+    std::string pipeline_str =
+        "filesrc name=src ! matroskademux name=demux ! h264parse name=parse ! matroskamux ! filesink name=sink";
+    GError* error = nullptr;
+    GstElement* pipeline = gst_parse_launch(pipeline_str.c_str(), &error);
+    if (error) {
+        Logger::error(std::string("[Recovery] Pipeline error: ") + error->message);
+        g_error_free(error);
+        if (pipeline) gst_object_unref(pipeline);
+        retention.release(file);
+        return false;
+    }
+
+    GstElement* element = gst_bin_get_by_name(GST_BIN(pipeline), "src");
+    g_object_set(element, "location", file.c_str(), nullptr);
+    gst_object_unref(element);
+    element = gst_bin_get_by_name(GST_BIN(pipeline), "sink");
+    g_object_set(element, "location", output.c_str(), nullptr);
+    // Session details from the storage layout: <camera>/<day>/<YYYY-MM-DD_HH-MM-SS_>doctor.mkv
+    fs::path path(file);
+    std::string stem = path.stem().string();
+    fs::path folder = path.parent_path();
+    if (VideoStorage::is_day_folder(folder.filename().string())) folder = folder.parent_path();
+    SeekIndexInfo info = {stem.size() > 20 ? stem.substr(20) : stem, folder.filename().string()};
+    SeekIndexWriter::attach(element, [info]() { return info; });
+    ChecksumWriter::attach(element);
+    gst_object_unref(element);
+    GstElement* demux = gst_bin_get_by_name(GST_BIN(pipeline), "demux");
+    GstElement* parse = gst_bin_get_by_name(GST_BIN(pipeline), "parse");
+
+    Transcoder::use_idle_pool(pipeline, task_pool);
+    GstBus* bus = gst_element_get_bus(pipeline);
+    gst_element_set_state(pipeline, GST_STATE_PLAYING);
+    GstMessage* msg = nullptr;
+    bool cut_off = false;
+    while (!quit) {
+        msg = gst_bus_timed_pop_filtered(bus, GST_SECOND, (GstMessageType)(GST_MESSAGE_EOS | GST_MESSAGE_ERROR));
+        if (!msg) continue;
+        if (GST_MESSAGE_TYPE(msg) == GST_MESSAGE_ERROR && GST_MESSAGE_SRC(msg) == GST_OBJECT(demux) && !cut_off) {
+            // The torn (or preallocated, zero-filled) end of the file: keep
+            // what was read before it and let the muxer finish
+            cut_off = true;
+            gst_message_unref(msg);
+            msg = nullptr;
+            GstPad* pad = gst_element_get_static_pad(parse, "sink");
+            gst_pad_send_event(pad, gst_event_new_eos());
+            gst_object_unref(pad);
+            continue;
+        }
+        break;
+    }
+
+    bool ok = msg && GST_MESSAGE_TYPE(msg) == GST_MESSAGE_EOS;
+    if (msg && GST_MESSAGE_TYPE(msg) == GST_MESSAGE_ERROR) {
+        GError* err = nullptr;
+        gst_message_parse_error(msg, &err, nullptr);
+        Logger::error("[Recovery] " + file + ": " + err->message);
+        g_error_free(err);
+    }
+    if (msg) gst_message_unref(msg);
+    gst_object_unref(bus);
+    gst_object_unref(demux);
+    gst_object_unref(parse);
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+    gst_object_unref(pipeline);
+
+    // Everything the old index (written while recording) knew about is there?
+    std::error_code ec;
+    if (ok) {
+        std::unique_ptr<SeekIndex> after = storage.open_index(output);
+        double lost = index_end(storage.open_index(file)) - index_end(after);
+        if (!after || after->size() == 0) {
+            Logger::error("[Recovery] " + file + ": no readable video, left as it was");
+            ok = false;
+        } else if (lost > MAX_LOSS_SEC) {
+            Logger::error("[Recovery] " + file + ": repaired copy ends " + std::to_string(static_cast<int>(lost)) +
+                          " s early, left as it was");
+            ok = false;
+        }
+    }
+    if (ok) {
+        // Sidecars first: until the recording itself is replaced it still reads
+        // as unfinalized, so a crash in between only means another repair
+        const std::pair<std::string, std::string> renames[] = {
+            {SeekIndexWriter::path_for(output), SeekIndexWriter::path_for(file)},
+            {ChecksumWriter::path_for(output), ChecksumWriter::path_for(file)},
+            {output, file}};
+        size_t done = 0;
+        for (; done < 3; ++done) {
+            fs::rename(renames[done].first, renames[done].second, ec);
+            if (ec) break;
+        }
+        if (ec) {
+            Logger::error("[Recovery] Could not replace " + file + ": " + ec.message());
+            // Those already moved describe the copy, not the file left in place
+            std::error_code ignored;
+            for (size_t i = 0; i < done; ++i) fs::remove(renames[i].second, ignored);
+            ok = false;
+        }
+    }
+    fs::remove(output, ec);
+    fs::remove(SeekIndexWriter::path_for(output), ec);
+    fs::remove(ChecksumWriter::path_for(output), ec);
+    retention.release(file);
+    if (!ok) return false;
+
+    storage.get_catalog().update(file);
+    Logger::info("[Recovery] Repaired " + file + (cut_off ? " (torn end dropped)" : ""));
+    return true;
+}
@@ -0,0 +1,59 @@
+#pragma once
+#include <gst/gst.h>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <ctime>
+#include <cstdint>
+#include "VideoStorage.hpp"
+#include "RetentionEngine.hpp"
+
+// Repairs recordings a crash, a power cut or "quit" left unfinalized: without
+// an EOS matroskamux never writes cues, duration and the segment size, so
+// such files are slow or impossible to seek. At startup every recording older
+// than the process is checked by a pool of low priority workers (a few bytes
+// each); broken ones are remuxed with a new seek index and checksums, and the
+// result replaces the original unless it lost footage. Runs beside the live
+// work, so new sessions are not held up.
+class CrashRecovery {
+public:
+    static constexpr double MAX_LOSS_SEC = 2.0; // Output may end this much before the old index
+
+    enum State { FINALIZED, UNFINALIZED, NOT_MKV };
+
+    struct Stats {
+        bool running;
+        size_t scanned;      // Recordings checked
+        size_t unfinalized;  // Found broken
+        size_t repaired;
+        size_t failed;       // Left as they were
+        unsigned workers;
+        double seconds;      // Whole run: scan and repairs
+        double repair_seconds; // Sum over the repaired files
+    };
+
+    CrashRecovery(VideoStorage& storage, RetentionEngine& retention);
+    ~CrashRecovery();
+
+    void start(unsigned workers = 0); // 0: half the cores
+    void stop(); // Aborts running repairs; also done by the destructor
+    Stats get_stats();
+
+    // Reads the EBML header: a segment size still "unknown" was never finalized
+    static State check(const std::string& path);
+
+private:
+    VideoStorage& storage;
+    RetentionEngine& retention;
+    Stats stats = {};
+    std::mutex mutex;
+    std::atomic<bool> quit{false};
+    std::thread thread;
+    GstTaskPool* task_pool = nullptr; // Idle pool of the repair pipelines, while running
+
+    void run(unsigned workers, time_t started);
+    bool repair(const std::string& path);
+};
@@ -0,0 +1,407 @@
+#include "HlsPackager.hpp"
+#include <sstream>
+#include <iomanip>
+#include <cmath>
+#include <algorithm>
+#include "Logger.hpp"
+
+namespace {
+
+// Minimal ISO-BMFF writer: big-endian fields and size-patched boxes
+class BoxWriter {
+public:
+    std::string data;
+
+    void u8(uint8_t v) { data.push_back(char(v)); }
+    void u16(uint16_t v) { u8(v >> 8); u8(v & 0xff); }
+    void u32(uint32_t v) { u16(v >> 16); u16(v & 0xffff); }
+    void u64(uint64_t v) { u32(uint32_t(v >> 32)); u32(uint32_t(v)); }
+    void zeros(size_t n) { data.append(n, '\0'); }
+    void bytes(const void* p, size_t n) { data.append(static_cast<const char*>(p), n); }
+    void fourcc(const char* cc) { bytes(cc, 4); }
+
+    size_t begin(const char* type) {
+        size_t start = data.size();
+        u32(0);
+        fourcc(type);
+        return start;
+    }
+    size_t begin_full(const char* type, uint8_t version, uint32_t flags) {
+        size_t start = begin(type);
+        u32((uint32_t(version) << 24) | (flags & 0xffffff));
+        return start;
+    }
+    void end(size_t start) { patch32(start, uint32_t(data.size() - start)); }
+
+    void patch32(size_t pos, uint32_t v) {
+        data[pos] = char(v >> 24);
+        data[pos + 1] = char(v >> 16);
+        data[pos + 2] = char(v >> 8);
+        data[pos + 3] = char(v);
+    }
+
+    void matrix() {
+        const uint32_t unity[9] = {0x00010000, 0, 0, 0, 0x00010000, 0, 0, 0, 0x40000000};
+        for (uint32_t v : unity) u32(v);
+    }
+};
+
+// Without the 128-bit intermediate t * TIMESCALE wraps after ~57 h of running time
+uint64_t to_timescale(GstClockTime t) {
+    return gst_util_uint64_scale(t, HlsPackager::TIMESCALE, GST_SECOND);
+}
+
+// ftyp + moov for a single H264 track (fragmented, so no sample tables)
+std::string build_init_segment(int width, int height, const std::string& avcc) {
+    BoxWriter w;
+    size_t ftyp = w.begin("ftyp");
+    w.fourcc("iso6");
+    w.u32(0);
+    w.fourcc("iso6");
+    w.fourcc("cmfc");
+    w.fourcc("avc1");
+    w.fourcc("mp41");
+    w.end(ftyp);
+
+    size_t moov = w.begin("moov");
+    size_t mvhd = w.begin_full("mvhd", 0, 0);
+    w.u32(0); w.u32(0);             // creation / modification time
+    w.u32(1000); w.u32(0);          // timescale, duration
+    w.u32(0x00010000); w.u16(0x0100); w.zeros(10);
+    w.matrix();
+    w.zeros(24);                    // pre_defined
+    w.u32(2);                       // next_track_ID
+    w.end(mvhd);
+
+    size_t trak = w.begin("trak");
+    size_t tkhd = w.begin_full("tkhd", 0, 0x000007);
+    w.u32(0); w.u32(0);
+    w.u32(1); w.u32(0); w.u32(0);   // track_ID, reserved, duration
+    w.zeros(8);
+    w.u16(0); w.u16(0); w.u16(0); w.u16(0);
+    w.matrix();
+    w.u32(uint32_t(width) << 16); w.u32(uint32_t(height) << 16);
+    w.end(tkhd);
+
+    size_t mdia = w.begin("mdia");
+    size_t mdhd = w.begin_full("mdhd", 0, 0);
+    w.u32(0); w.u32(0);
+    w.u32(HlsPackager::TIMESCALE); w.u32(0);
+    w.u16(0x55c4); w.u16(0);        // 'und'
+    w.end(mdhd);
+
+    size_t hdlr = w.begin_full("hdlr", 0, 0);
+    w.u32(0); w.fourcc("vide"); w.zeros(12);
+    w.bytes("VideoHandler", 13);
+    w.end(hdlr);
+
+    size_t minf = w.begin("minf");
+    size_t vmhd = w.begin_full("vmhd", 0, 1);
+    w.zeros(8);
+    w.end(vmhd);
+
+    size_t dinf = w.begin("dinf");
+    size_t dref = w.begin_full("dref", 0, 0);
+    w.u32(1);
+    size_t url = w.begin_full("url ", 0, 1);
+    w.end(url);
+    w.end(dref);
+    w.end(dinf);
+
+    size_t stbl = w.begin("stbl");
+    size_t stsd = w.begin_full("stsd", 0, 0);
+    w.u32(1);
+    size_t avc1 = w.begin("avc1");
+    w.zeros(6); w.u16(1);           // reserved, data_reference_index
+    w.zeros(16);
+    w.u16(uint16_t(width)); w.u16(uint16_t(height));
+    w.u32(0x00480000); w.u32(0x00480000);
+    w.u32(0); w.u16(1);             // reserved, frame_count
+    w.zeros(32);                    // compressorname
+    w.u16(0x0018); w.u16(0xffff);
+    size_t avcC = w.begin("avcC");
+    w.bytes(avcc.data(), avcc.size());
+    w.end(avcC);
+    w.end(avc1);
+    w.end(stsd);
+    for (const char* table : {"stts", "stsc", "stco"}) {
+        size_t box = w.begin_full(table, 0, 0);
+        w.u32(0);
+        w.end(box);
+    }
+    size_t stsz = w.begin_full("stsz", 0, 0);
+    w.u32(0); w.u32(0);
+    w.end(stsz);
+    w.end(stbl);
+    w.end(minf);
+    w.end(mdia);
+    w.end(trak);
+
+    size_t mvex = w.begin("mvex");
+    size_t trex = w.begin_full("trex", 0, 0);
+    w.u32(1); w.u32(1); w.u32(0); w.u32(0); w.u32(0);
+    w.end(trex);
+    w.end(mvex);
+    w.end(moov);
+    return w.data;
+}
+
+} // namespace
+
+HlsPackager::HlsPackager(const std::string& camera_id) : camera_id(camera_id) {
+    touch();
+}
+
+HlsPackager::~HlsPackager() {
+    for (auto& sample : part_samples) gst_buffer_unref(sample.buffer);
+    if (have_pending) gst_buffer_unref(pending.buffer);
+}
+
+void HlsPackager::touch() {
+    last_access_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+std::chrono::steady_clock::time_point HlsPackager::last_access() {
+    return std::chrono::steady_clock::time_point(std::chrono::nanoseconds(last_access_ns.load()));
+}
+
+void HlsPackager::on_caps(GstCaps* caps) {
+    const GstStructure* st = gst_caps_get_structure(caps, 0);
+    int width = 0, height = 0;
+    gst_structure_get_int(st, "width", &width);
+    gst_structure_get_int(st, "height", &height);
+
+    const GValue* value = gst_structure_get_value(st, "codec_data");
+    if (!value) return;
+    GstBuffer* codec_data = gst_value_get_buffer(value);
+    GstMapInfo map;
+    if (!codec_data || !gst_buffer_map(codec_data, &map, GST_MAP_READ)) return;
+    std::string avcc(reinterpret_cast<const char*>(map.data), map.size);
+    gst_buffer_unmap(codec_data, &map);
+
+    std::string init = build_init_segment(width, height, avcc);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (init == init_segment) return;
+        init_segment = init;
+    }
+    // New stream parameters: previous fragments no longer match the init segment
+    reset_stream();
+    Logger::info("[HLS] " + camera_id + ": " + std::to_string(width) + "x" + std::to_string(height));
+}
+
+void HlsPackager::reset_stream() {
+    for (auto& sample : part_samples) gst_buffer_unref(sample.buffer);
+    part_samples.clear();
+    if (have_pending) gst_buffer_unref(pending.buffer);
+    have_pending = false;
+    part_duration = segment_duration = 0;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    segments.clear();
+    cond.notify_all();
+}
+
+// A sample's duration is only known once the next one arrives, so the last
+// access unit is held back in 'pending' for one frame.
+void HlsPackager::on_buffer(GstBuffer* buffer) {
+    GstClockTime ts = GST_BUFFER_DTS_OR_PTS(buffer);
+    if (!GST_CLOCK_TIME_IS_VALID(ts)) return;
+
+    bool keyframe = !GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT);
+    if (!have_pending && !keyframe) return; // Segments must start on a keyframe
+
+    Sample sample;
+    sample.buffer = gst_buffer_ref(buffer);
+    sample.dts = to_timescale(ts);
+    sample.cts = GST_CLOCK_TIME_IS_VALID(GST_BUFFER_PTS(buffer))
+                     ? int32_t(int64_t(to_timescale(GST_BUFFER_PTS(buffer))) - int64_t(sample.dts)) : 0;
+    sample.duration = 0;
+    sample.keyframe = keyframe;
+
+    if (have_pending) {
+        uint32_t duration = sample.dts > pending.dts ? uint32_t(sample.dts - pending.dts) : TIMESCALE / 30;
+        pending.duration = duration;
+
+        // Parts may not exceed PART_TARGET
+        if (!part_samples.empty() && part_duration + duration > PART_TARGET) close_part(false);
+        part_samples.push_back(pending);
+        part_duration += duration;
+        segment_duration += duration;
+
+        // The next keyframe past the target starts a new segment
+        if (keyframe && segment_duration >= SEGMENT_TARGET) close_part(true);
+    }
+
+    pending = sample;
+    have_pending = true;
+}
+
+std::string HlsPackager::build_fragment(const std::vector<Sample>& samples) {
+    BoxWriter w;
+    size_t moof = w.begin("moof");
+    size_t mfhd = w.begin_full("mfhd", 0, 0);
+    w.u32(fragment_seq++);
+    w.end(mfhd);
+
+    size_t traf = w.begin("traf");
+    size_t tfhd = w.begin_full("tfhd", 0, 0x020000); // default-base-is-moof
+    w.u32(1);
+    w.end(tfhd);
+    size_t tfdt = w.begin_full("tfdt", 1, 0);
+    w.u64(samples.front().dts);
+    w.end(tfdt);
+
+    // data-offset, duration, size, flags and composition offset per sample
+    size_t trun = w.begin_full("trun", 1, 0x000f01);
+    w.u32(uint32_t(samples.size()));
+    size_t data_offset = w.data.size();
+    w.u32(0);
+    for (const auto& sample : samples) {
+        w.u32(sample.duration);
+        w.u32(uint32_t(gst_buffer_get_size(sample.buffer)));
+        w.u32(sample.keyframe ? 0x02000000 : 0x01010000);
+        w.u32(uint32_t(sample.cts));
+    }
+    w.end(trun);
+    w.end(traf);
+    w.end(moof);
+    w.patch32(data_offset, uint32_t(w.data.size() + 8));
+
+    size_t mdat = w.begin("mdat");
+    for (const auto& sample : samples) {
+        GstMapInfo map;
+        if (gst_buffer_map(sample.buffer, &map, GST_MAP_READ)) {
+            w.bytes(map.data, map.size);
+            gst_buffer_unmap(sample.buffer, &map);
+        }
+    }
+    w.end(mdat);
+    return w.data;
+}
+
+void HlsPackager::close_part(bool end_segment) {
+    if (part_samples.empty()) return;
+
+    auto part = std::make_shared<Part>();
+    part->data = build_fragment(part_samples);
+    part->duration = uint32_t(part_duration);
+    part->independent = part_samples.front().keyframe;
+    for (auto& sample : part_samples) gst_buffer_unref(sample.buffer);
+    part_samples.clear();
+    part_duration = 0;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (segments.empty() || segments.back().complete) {
+        segments.push_back({});
+        segments.back().msn = next_msn++;
+    }
+    Segment& segment = segments.back();
+    segment.parts.push_back(part);
+    segment.duration += part->duration;
+
+    if (end_segment) {
+        segment.complete = true;
+        max_segment_duration = std::max(max_segment_duration, segment.duration);
+        segment_duration = 0;
+        while (segments.size() > MAX_SEGMENTS + 1) segments.pop_front();
+    }
+    cond.notify_all();
+}
+
+const HlsPackager::Segment* HlsPackager::find_segment(uint64_t msn) {
+    for (const auto& segment : segments) {
+        if (segment.msn == msn) return &segment;
+    }
+    return nullptr;
+}
+
+// Called with mutex held
+bool HlsPackager::is_available(long msn, long part) {
+    if (segments.empty()) return false;
+    if (uint64_t(msn) < segments.front().msn) return true;
+    const Segment* segment = find_segment(uint64_t(msn));
+    if (!segment) return false;
+    if (part < 0) return segment->complete;
+    return segment->complete || segment->parts.size() > size_t(part);
+}
+
+std::chrono::milliseconds HlsPackager::block_timeout() {
+    return std::chrono::milliseconds(3 * max_segment_duration * 1000 / TIMESCALE);
+}
+
+// Called with mutex held
+std::string HlsPackager::render_playlist() {
+    std::stringstream m3u8;
+    m3u8 << std::fixed << std::setprecision(3);
+    m3u8 << "#EXTM3U\n#EXT-X-VERSION:6\n";
+    m3u8 << "#EXT-X-TARGETDURATION:" << (max_segment_duration + TIMESCALE - 1) / TIMESCALE << "\n";
+    m3u8 << "#EXT-X-SERVER-CONTROL:CAN-BLOCK-RELOAD=YES,PART-HOLD-BACK="
+         << 3.0 * PART_TARGET / TIMESCALE << "\n";
+    m3u8 << "#EXT-X-PART-INF:PART-TARGET=" << double(PART_TARGET) / TIMESCALE << "\n";
+    m3u8 << "#EXT-X-MEDIA-SEQUENCE:" << segments.front().msn << "\n";
+    m3u8 << "#EXT-X-MAP:URI=\"init.mp4\"\n";
+
+    // Parts are only advertised close to the live edge
+    uint64_t last_msn = segments.back().msn;
+    for (const auto& segment : segments) {
+        if (segment.msn + 2 >= last_msn) {
+            for (size_t i = 0; i < segment.parts.size(); ++i) {
+                const auto& part = segment.parts[i];
+                m3u8 << "#EXT-X-PART:DURATION=" << double(part->duration) / TIMESCALE
+                     << ",URI=\"part_" << segment.msn << "_" << i << ".m4s\""
+                     << (part->independent ? ",INDEPENDENT=YES" : "") << "\n";
+            }
+        }
+        if (segment.complete) {
+            m3u8 << "#EXTINF:" << double(segment.duration) / TIMESCALE << ",\n"
+                 << "seg_" << segment.msn << ".m4s\n";
+        }
+    }
+
+    const Segment& live = segments.back();
+    uint64_t hint_msn = live.complete ? next_msn : live.msn;
+    size_t hint_part = live.complete ? 0 : live.parts.size();
+    m3u8 << "#EXT-X-PRELOAD-HINT:TYPE=PART,URI=\"part_" << hint_msn << "_" << hint_part << ".m4s\"\n";
+    return m3u8.str();
+}
+
+bool HlsPackager::get_playlist(std::string& out, long msn, long part) {
+    touch();
+    std::unique_lock<std::mutex> lock(mutex);
+    if (msn >= 0) cond.wait_for(lock, block_timeout(), [&] { return is_available(msn, part); });
+    if (init_segment.empty() || segments.empty()) return false;
+    out = render_playlist();
+    return true;
+}
+
+bool HlsPackager::get_init(std::string& out) {
+    touch();
+    std::lock_guard<std::mutex> lock(mutex);
+    if (init_segment.empty()) return false;
+    out = init_segment;
+    return true;
+}
+
+bool HlsPackager::get_segment(uint64_t msn, std::string& out) {
+    touch();
+    std::lock_guard<std::mutex> lock(mutex);
+    const Segment* segment = find_segment(msn);
+    if (!segment || !segment->complete) return false;
+
+    out.clear();
+    for (const auto& part : segment->parts) out += part->data;
+    return true;
+}
+
+bool HlsPackager::get_part(uint64_t msn, size_t part, std::string& out) {
+    touch();
+    std::unique_lock<std::mutex> lock(mutex);
+    cond.wait_for(lock, block_timeout(), [&] { return is_available(long(msn), long(part)); });
+
+    const Segment* segment = find_segment(msn);
+    if (!segment || segment->parts.size() <= part) return false;
+    out = segment->parts[part]->data;
+    return true;
+}
@@ -0,0 +1,91 @@
+#pragma once
+#include <gst/gst.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include "IngestPipeline.hpp"
+
+// Low-latency HLS packager for one camera.
+// Listens on the camera's IngestPipeline and wraps the already parsed H264
+// access units into CMAF fragments (moof+mdat) without re-encoding. Every
+// fragment is an LL-HLS partial segment; a segment is the run of parts from
+// one keyframe to the next keyframe past SEGMENT_TARGET. The last few
+// segments are kept in memory and served by the built-in web server, shared
+// by all viewers of the camera.
+class HlsPackager : public IngestListener {
+public:
+    static constexpr uint32_t TIMESCALE = 90000;
+    static constexpr uint32_t PART_TARGET = TIMESCALE / 5; // 200 ms
+    static constexpr uint32_t SEGMENT_TARGET = TIMESCALE;  // 1 s, extended to the next keyframe
+    static constexpr size_t MAX_SEGMENTS = 6;
+
+    HlsPackager(const std::string& camera_id);
+    ~HlsPackager() override;
+
+    void on_caps(GstCaps* caps) override;
+    void on_buffer(GstBuffer* buffer) override;
+
+    // Playlist; msn >= 0 blocks until segment msn (and part, if >= 0) exists,
+    // as requested by _HLS_msn/_HLS_part. Returns false if nothing is ready yet.
+    bool get_playlist(std::string& out, long msn = -1, long part = -1);
+    bool get_init(std::string& out);
+    bool get_segment(uint64_t msn, std::string& out);
+    // Blocks briefly for the part announced in the preload hint
+    bool get_part(uint64_t msn, size_t part, std::string& out);
+
+    std::chrono::steady_clock::time_point last_access();
+
+private:
+    struct Sample {
+        GstBuffer* buffer;
+        uint64_t dts;      // TIMESCALE units
+        int32_t cts;       // pts - dts
+        uint32_t duration;
+        bool keyframe;
+    };
+    struct Part {
+        std::string data; // moof + mdat
+        uint32_t duration;
+        bool independent;
+    };
+    struct Segment {
+        uint64_t msn;
+        std::vector<std::shared_ptr<const Part>> parts;
+        uint64_t duration = 0;
+        bool complete = false;
+    };
+
+    std::string camera_id;
+
+    // Shared with the HTTP threads
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::string init_segment;
+    std::deque<Segment> segments; // Oldest first; back() may be in progress
+    uint64_t next_msn = 0;
+    uint64_t max_segment_duration = SEGMENT_TARGET;
+    std::atomic<int64_t> last_access_ns;
+
+    // Streaming thread only
+    std::vector<Sample> part_samples;
+    uint64_t part_duration = 0;
+    uint64_t segment_duration = 0;
+    Sample pending = {};
+    bool have_pending = false;
+    uint32_t fragment_seq = 1;
+
+    void touch();
+    void reset_stream();
+    void close_part(bool end_segment);
+    std::string build_fragment(const std::vector<Sample>& samples);
+    std::string render_playlist();
+    bool is_available(long msn, long part);
+    const Segment* find_segment(uint64_t msn);
+    std::chrono::milliseconds block_timeout();
+};
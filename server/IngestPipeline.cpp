@@ -0,0 +1,443 @@
+#include "IngestPipeline.hpp"
+#include <algorithm>
+#include <cmath>
+#include "Logger.hpp"
+
+IngestPipeline::IngestPipeline(int port, GstClockTime max_preroll_time, size_t max_preroll_bytes,
+                               const IngestOptions& options)
+    : port(port), options(options), max_preroll_time(max_preroll_time), max_preroll_bytes(max_preroll_bytes) {}
+
+IngestPipeline::~IngestPipeline() {
+    stop();
+    clear_preroll();
+    if (caps) gst_caps_unref(caps);
+}
+
+bool IngestPipeline::start(ContextThread* worker) {
+    if (pipeline) return true;
+
+    // Parse to AVC/AU so the output can go straight into matroskamux and
+    // rtph264pay without a second h264parse per consumer. The queue puts
+    // depayloading, parsing and the fan-out on a thread of their own, so the
+    // RTP tap in front of it (health, raw captures) never waits for them; if
+    // they fall a second behind, the live side drops packets, not the tap.
+    std::string output =
+        "queue name=rtp_queue max-size-buffers=0 max-size-bytes=0 max-size-time=1000000000 leaky=downstream ! "
+        "rtph264depay ! h264parse ! video/x-h264, stream-format=avc, alignment=au ! "
+        "appsink name=sink sync=false";
+    std::string rtp_src =
+        "udpsrc port=" + std::to_string(port) + " multicast-group=239.0.0.1 auto-multicast=true buffer-size=10000000 do-timestamp=true ";
+
+    std::string pipeline_str;
+    if (!options.reliable) {
+        pipeline_str = rtp_src + "! application/x-rtp, encoding-name=H264, payload=96 ! " + output;
+    } else {
+        // Reliable: RTP on port, sender RTCP on port+2, our RTCP (RR + NACK) back
+        // to the sender on port+3. port+1 is skipped, 5001 is the discovery port.
+        // No payload in the caps: RTX packets arrive with pt 97.
+        pipeline_str =
+            "rtpbin name=rtpbin rtp-profile=avpf do-retransmission=true latency=" + std::to_string(options.latency_ms) + " " +
+            rtp_src + "caps=\"application/x-rtp, media=video, clock-rate=90000, encoding-name=H264\" ! rtpbin.recv_rtp_sink_0 "
+            "udpsrc port=" + std::to_string(port + 2) + " multicast-group=239.0.0.1 auto-multicast=true ! rtpbin.recv_rtcp_sink_0 "
+            "rtpbin.send_rtcp_src_0 ! udpsink host=" + options.sender_ip + " port=" + std::to_string(port + 3) + " sync=false async=false "
+            "rtpbin. ! " + output;
+    }
+
+    GError* error = nullptr;
+    pipeline = gst_parse_launch(pipeline_str.c_str(), &error);
+    if (error) {
+        Logger::error(std::string("[Ingest] Pipeline error: ") + error->message);
+        g_error_free(error);
+        if (pipeline) gst_object_unref(pipeline);
+        pipeline = nullptr;
+        return false;
+    }
+
+    if (options.reliable) {
+        GstElement* rtpbin = gst_bin_get_by_name(GST_BIN(pipeline), "rtpbin");
+        g_signal_connect(rtpbin, "request-aux-receiver", G_CALLBACK(request_aux_receiver), this);
+        g_signal_connect(rtpbin, "new-jitterbuffer", G_CALLBACK(new_jitterbuffer), this);
+        gst_object_unref(rtpbin);
+    }
+
+    GstElement* sink = gst_bin_get_by_name(GST_BIN(pipeline), "sink");
+    GstAppSinkCallbacks callbacks = {};
+    callbacks.new_sample = on_new_sample;
+    gst_app_sink_set_callbacks(GST_APP_SINK(sink), &callbacks, this, nullptr);
+    gst_object_unref(sink);
+
+    // RTP-level health (loss, jitter, bitrate) and the RTP listeners are
+    // taken before the queue, on the receive thread
+    reset_health();
+    GstElement* rtp_queue = gst_bin_get_by_name(GST_BIN(pipeline), "rtp_queue");
+    GstPad* pad = gst_element_get_static_pad(rtp_queue, "sink");
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, rtp_probe, this, nullptr);
+    gst_object_unref(pad);
+    gst_object_unref(rtp_queue);
+
+    bus_watch = worker->add_bus_watch(pipeline, bus_callback, this);
+
+    gst_element_set_state(pipeline, GST_STATE_PLAYING);
+    Logger::info("[Ingest] Receiving camera on port " + std::to_string(port) +
+                 (options.reliable ? " (reliable, " + std::to_string(options.latency_ms) + " ms jitter buffer)" : ""));
+    return true;
+}
+
+// rtprtxreceive in front of the jitter buffer turns RTX (pt 97) back into H264 (pt 96)
+GstElement* IngestPipeline::request_aux_receiver(GstElement*, guint session, gpointer) {
+    GstElement* bin = gst_bin_new(nullptr);
+    GstElement* rtx = gst_element_factory_make("rtprtxreceive", nullptr);
+    GstStructure* pt_map = gst_structure_new("application/x-rtp-pt-map", "96", G_TYPE_UINT, 97, nullptr);
+    g_object_set(rtx, "payload-type-map", pt_map, nullptr);
+    gst_structure_free(pt_map);
+    gst_bin_add(GST_BIN(bin), rtx);
+
+    std::string sink_name = "sink_" + std::to_string(session);
+    std::string src_name = "src_" + std::to_string(session);
+    GstPad* pad = gst_element_get_static_pad(rtx, "sink");
+    gst_element_add_pad(bin, gst_ghost_pad_new(sink_name.c_str(), pad));
+    gst_object_unref(pad);
+    pad = gst_element_get_static_pad(rtx, "src");
+    gst_element_add_pad(bin, gst_ghost_pad_new(src_name.c_str(), pad));
+    gst_object_unref(pad);
+    return bin;
+}
+
+void IngestPipeline::new_jitterbuffer(GstElement*, GstElement* jitterbuffer, guint, guint, gpointer user_data) {
+    IngestPipeline* self = static_cast<IngestPipeline*>(user_data);
+    std::lock_guard<std::mutex> lock(self->consumer_mutex);
+    if (self->jitterbuffer) gst_object_unref(self->jitterbuffer);
+    self->jitterbuffer = GST_ELEMENT(gst_object_ref(jitterbuffer));
+}
+
+void IngestPipeline::stop() {
+    if (!pipeline) return;
+
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+    ContextThread::remove(bus_watch);
+    gst_object_unref(pipeline);
+    pipeline = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(consumer_mutex);
+        if (jitterbuffer) gst_object_unref(jitterbuffer);
+        jitterbuffer = nullptr;
+    }
+    Logger::info("[Ingest] Stopped port " + std::to_string(port));
+}
+
+void IngestPipeline::add_consumer(GstElement* appsrc, bool use_preroll) {
+    std::lock_guard<std::mutex> lock(consumer_mutex);
+    gst_object_ref(appsrc);
+    if (caps) gst_app_src_set_caps(GST_APP_SRC(appsrc), caps);
+    consumers.push_back({GST_APP_SRC(appsrc), true, GST_CLOCK_TIME_NONE});
+
+    if (use_preroll && caps) {
+        Consumer& consumer = consumers.back();
+        for (GstBuffer* buffer : preroll) push_to(consumer, buffer);
+    }
+}
+
+void IngestPipeline::remove_consumer(GstElement* appsrc) {
+    std::lock_guard<std::mutex> lock(consumer_mutex);
+    auto it = std::find_if(consumers.begin(), consumers.end(),
+                           [appsrc](const Consumer& c) { return c.src == GST_APP_SRC(appsrc); });
+    if (it == consumers.end()) return;
+    gst_object_unref(it->src);
+    consumers.erase(it);
+}
+
+void IngestPipeline::add_listener(IngestListener* listener, bool use_preroll) {
+    std::lock_guard<std::mutex> lock(consumer_mutex);
+    listeners.push_back(listener);
+    if (!caps) return;
+
+    listener->on_caps(caps);
+    if (use_preroll) {
+        for (GstBuffer* buffer : preroll) listener->on_buffer(buffer);
+    }
+}
+
+void IngestPipeline::remove_listener(IngestListener* listener) {
+    std::lock_guard<std::mutex> lock(consumer_mutex);
+    listeners.erase(std::remove(listeners.begin(), listeners.end(), listener), listeners.end());
+}
+
+void IngestPipeline::add_rtp_listener(RtpListener* listener) {
+    std::lock_guard<std::mutex> lock(rtp_mutex);
+    rtp_listeners.push_back(listener);
+}
+
+void IngestPipeline::remove_rtp_listener(RtpListener* listener) {
+    std::lock_guard<std::mutex> lock(rtp_mutex);
+    rtp_listeners.erase(std::remove(rtp_listeners.begin(), rtp_listeners.end(), listener), rtp_listeners.end());
+}
+
+size_t IngestPipeline::consumer_count() {
+    size_t rtp_count;
+    {
+        std::lock_guard<std::mutex> lock(rtp_mutex);
+        rtp_count = rtp_listeners.size();
+    }
+    std::lock_guard<std::mutex> lock(consumer_mutex);
+    return consumers.size() + listeners.size() + rtp_count;
+}
+
+size_t IngestPipeline::preroll_bytes() {
+    std::lock_guard<std::mutex> lock(consumer_mutex);
+    return preroll_size;
+}
+
+void IngestPipeline::reset_health() {
+    health.packets = 0;
+    health.lost = 0;
+    health.reordered = 0;
+    health.frames = 0;
+    health.keyframes = 0;
+    health.bitrate_bps = 0;
+    health.fps_milli = 0;
+    health.jitter_us = 0;
+    health.keyframe_interval_us = 0;
+    health.probe_ns = 0;
+    started_at = std::chrono::steady_clock::now();
+
+    have_rtp = false;
+    bad_seq = NO_BAD_SEQ;
+    jitter = 0;
+    last_arrival = rate_window_start = fps_window_start = last_keyframe_ts = GST_CLOCK_TIME_NONE;
+    rate_window_bytes = fps_window_frames = 0;
+}
+
+StreamHealth IngestPipeline::get_health() {
+    auto relaxed = std::memory_order_relaxed;
+    StreamHealth h;
+    h.packets = health.packets.load(relaxed);
+    h.lost = health.lost.load(relaxed);
+    h.reordered = health.reordered.load(relaxed);
+    h.frames = health.frames.load(relaxed);
+    h.keyframes = health.keyframes.load(relaxed);
+    h.bitrate_kbps = health.bitrate_bps.load(relaxed) / 1000.0;
+    h.fps = health.fps_milli.load(relaxed) / 1000.0;
+    h.jitter_ms = health.jitter_us.load(relaxed) / 1000.0;
+    h.keyframe_interval_ms = health.keyframe_interval_us.load(relaxed) / 1000.0;
+
+    auto wall_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - started_at).count();
+    h.probe_cpu_percent = wall_ns > 0 ? 100.0 * health.probe_ns.load(relaxed) / wall_ns : 0;
+
+    h.reliable = options.reliable;
+    h.rtx_requests = h.rtx_recovered = h.late = 0;
+    GstElement* jb = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(consumer_mutex);
+        if (jitterbuffer) jb = GST_ELEMENT(gst_object_ref(jitterbuffer));
+    }
+    if (jb) {
+        GstStructure* stats = nullptr;
+        g_object_get(jb, "stats", &stats, nullptr);
+        if (stats) {
+            guint64 value = 0;
+            if (gst_structure_get_uint64(stats, "rtx-count", &value)) h.rtx_requests = value;
+            if (gst_structure_get_uint64(stats, "rtx-success-count", &value)) h.rtx_recovered = value;
+            if (gst_structure_get_uint64(stats, "num-late", &value)) h.late = value;
+            gst_structure_free(stats);
+        }
+        gst_object_unref(jb);
+    }
+    return h;
+}
+
+// Streaming thread. Reads the RTP header only (no map of the payload).
+void IngestPipeline::account_rtp(GstBuffer* buffer) {
+    guint8 header[8];
+    gsize size = gst_buffer_get_size(buffer);
+    if (size < 12 || gst_buffer_extract(buffer, 0, header, sizeof(header)) != sizeof(header)) return;
+
+    uint16_t seq = (header[2] << 8) | header[3];
+    uint32_t rtp_ts = (uint32_t(header[4]) << 24) | (header[5] << 16) | (header[6] << 8) | header[7];
+    GstClockTime arrival = GST_BUFFER_PTS(buffer);
+    auto relaxed = std::memory_order_relaxed;
+
+    health.packets.fetch_add(1, relaxed);
+    if (have_rtp) {
+        uint16_t delta = seq - last_seq;
+        if (delta == 0 || delta > NO_BAD_SEQ - MAX_MISORDER) {
+            health.reordered.fetch_add(1, relaxed);
+            return;
+        }
+        bool resync = false;
+        if (delta >= MAX_DROPOUT) {
+            if (seq != bad_seq) {
+                bad_seq = uint16_t(seq + 1);
+                return;
+            }
+            // Two in a row from the new base: no loss, no jitter across the jump
+            resync = true;
+            last_arrival = GST_CLOCK_TIME_NONE;
+            Logger::info("[Ingest] Port " + std::to_string(port) + ": RTP sequence jumped to " + std::to_string(seq) +
+                         ", resynced");
+        }
+        bad_seq = NO_BAD_SEQ;
+        if (!resync && delta > 1) health.lost.fetch_add(delta - 1, relaxed);
+
+        // RFC 3550 A.8: J += (|D| - J) / 16, with D in RTP clock units
+        if (GST_CLOCK_TIME_IS_VALID(arrival) && GST_CLOCK_TIME_IS_VALID(last_arrival)) {
+            double arrival_delta = (double(arrival) - double(last_arrival)) * 90000.0 / GST_SECOND;
+            double d = arrival_delta - double(int32_t(rtp_ts - last_rtp_ts));
+            jitter += (std::abs(d) - jitter) / 16.0;
+            health.jitter_us.store(uint64_t(jitter * 1000000.0 / 90000.0), relaxed);
+        }
+    }
+    have_rtp = true;
+    last_seq = seq;
+    last_rtp_ts = rtp_ts;
+    last_arrival = arrival;
+
+    if (!GST_CLOCK_TIME_IS_VALID(arrival)) return;
+    if (!GST_CLOCK_TIME_IS_VALID(rate_window_start)) rate_window_start = arrival;
+    rate_window_bytes += size;
+    if (arrival - rate_window_start >= GST_SECOND) {
+        health.bitrate_bps.store(rate_window_bytes * 8 * GST_SECOND / (arrival - rate_window_start), relaxed);
+        rate_window_start = arrival;
+        rate_window_bytes = 0;
+    }
+}
+
+// Streaming thread, once per parsed access unit
+void IngestPipeline::account_frame(GstBuffer* buffer) {
+    GstClockTime ts = GST_BUFFER_DTS_OR_PTS(buffer);
+    auto relaxed = std::memory_order_relaxed;
+
+    health.frames.fetch_add(1, relaxed);
+    if (!GST_CLOCK_TIME_IS_VALID(ts)) return;
+
+    if (!GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT)) {
+        health.keyframes.fetch_add(1, relaxed);
+        if (GST_CLOCK_TIME_IS_VALID(last_keyframe_ts) && ts > last_keyframe_ts)
+            health.keyframe_interval_us.store((ts - last_keyframe_ts) / GST_USECOND, relaxed);
+        last_keyframe_ts = ts;
+    }
+
+    if (!GST_CLOCK_TIME_IS_VALID(fps_window_start)) fps_window_start = ts;
+    fps_window_frames++;
+    if (ts > fps_window_start && ts - fps_window_start >= GST_SECOND) {
+        health.fps_milli.store(fps_window_frames * 1000 * GST_SECOND / (ts - fps_window_start), relaxed);
+        fps_window_start = ts;
+        fps_window_frames = 0;
+    }
+}
+
+GstPadProbeReturn IngestPipeline::rtp_probe(GstPad*, GstPadProbeInfo* info, gpointer user_data) {
+    IngestPipeline* self = static_cast<IngestPipeline*>(user_data);
+    GstBuffer* buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    auto begin = std::chrono::steady_clock::now();
+    self->account_rtp(buffer);
+    auto spent = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin);
+    self->health.probe_ns.fetch_add(spent.count(), std::memory_order_relaxed);
+
+    std::lock_guard<std::mutex> lock(self->rtp_mutex);
+    for (RtpListener* listener : self->rtp_listeners) listener->on_rtp(buffer);
+    return GST_PAD_PROBE_OK;
+}
+
+// Called with consumer_mutex held
+void IngestPipeline::clear_preroll() {
+    for (GstBuffer* buffer : preroll) gst_buffer_unref(buffer);
+    preroll.clear();
+    preroll_size = 0;
+}
+
+// Called with consumer_mutex held. Keeps the current GOP only; if it outgrows
+// the limits the buffer is dropped until the next keyframe.
+void IngestPipeline::store_preroll(GstBuffer* buffer) {
+    if (max_preroll_time == 0) return;
+
+    bool keyframe = !GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT);
+    if (keyframe) {
+        clear_preroll();
+        preroll_overflow = false;
+    } else if (preroll.empty()) {
+        return;
+    }
+
+    GstClockTime first = GST_BUFFER_DTS_OR_PTS(preroll.empty() ? buffer : preroll.front());
+    GstClockTime last = GST_BUFFER_DTS_OR_PTS(buffer);
+    bool too_long = GST_CLOCK_TIME_IS_VALID(first) && GST_CLOCK_TIME_IS_VALID(last) &&
+                    last > first && last - first > max_preroll_time;
+    size_t size = gst_buffer_get_size(buffer);
+
+    if (too_long || preroll_size + size > max_preroll_bytes) {
+        if (!preroll_overflow) {
+            Logger::error("[Ingest] Port " + std::to_string(port) + ": GOP exceeds pre-roll limits (" +
+                          std::to_string(preroll_size / 1024) + " KB), waiting for next keyframe");
+            preroll_overflow = true;
+        }
+        clear_preroll();
+        return;
+    }
+
+    preroll.push_back(gst_buffer_ref(buffer));
+    preroll_size += size;
+}
+
+// Called with consumer_mutex held
+void IngestPipeline::push_to(Consumer& consumer, GstBuffer* buffer) {
+    if (consumer.waiting_keyframe) {
+        if (GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT)) return;
+        consumer.waiting_keyframe = false;
+    }
+
+    GstClockTime ts = GST_BUFFER_DTS_OR_PTS(buffer);
+    if (!GST_CLOCK_TIME_IS_VALID(consumer.first_ts)) consumer.first_ts = ts;
+
+    // Shallow copy: only the metadata is duplicated, the memory is shared
+    GstBuffer* out = gst_buffer_copy(buffer);
+    if (GST_CLOCK_TIME_IS_VALID(consumer.first_ts)) {
+        GstClockTime pts = GST_BUFFER_PTS(buffer);
+        GstClockTime dts = GST_BUFFER_DTS(buffer);
+        if (GST_CLOCK_TIME_IS_VALID(pts))
+            GST_BUFFER_PTS(out) = pts > consumer.first_ts ? pts - consumer.first_ts : 0;
+        if (GST_CLOCK_TIME_IS_VALID(dts))
+            GST_BUFFER_DTS(out) = dts > consumer.first_ts ? dts - consumer.first_ts : 0;
+    }
+
+    // Takes ownership of 'out'
+    gst_app_src_push_buffer(consumer.src, out);
+}
+
+GstFlowReturn IngestPipeline::on_new_sample(GstAppSink* sink, gpointer user_data) {
+    IngestPipeline* self = static_cast<IngestPipeline*>(user_data);
+    GstSample* sample = gst_app_sink_pull_sample(sink);
+    if (!sample) return GST_FLOW_EOS;
+
+    GstBuffer* buffer = gst_sample_get_buffer(sample);
+    GstCaps* sample_caps = gst_sample_get_caps(sample);
+
+    auto begin = std::chrono::steady_clock::now();
+    self->account_frame(buffer);
+    auto spent = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin);
+    self->health.probe_ns.fetch_add(spent.count(), std::memory_order_relaxed);
+
+    std::lock_guard<std::mutex> lock(self->consumer_mutex);
+    if (sample_caps && (!self->caps || !gst_caps_is_equal(self->caps, sample_caps))) {
+        gst_caps_replace(&self->caps, sample_caps);
+        for (auto& consumer : self->consumers) gst_app_src_set_caps(consumer.src, self->caps);
+        for (auto* listener : self->listeners) listener->on_caps(self->caps);
+    }
+    for (auto& consumer : self->consumers) self->push_to(consumer, buffer);
+    for (auto* listener : self->listeners) listener->on_buffer(buffer);
+    self->store_preroll(buffer);
+
+    gst_sample_unref(sample);
+    return GST_FLOW_OK;
+}
+
+gboolean IngestPipeline::bus_callback(GstBus*, GstMessage* msg, gpointer user_data) {
+    IngestPipeline* self = static_cast<IngestPipeline*>(user_data);
+    if (GST_MESSAGE_TYPE(msg) == GST_MESSAGE_ERROR) {
+        GError* err = nullptr;
+        gst_message_parse_error(msg, &err, nullptr);
+        Logger::error("[Ingest] Port " + std::to_string(self->port) + ": " + err->message);
+        g_error_free(err);
+    }
+    return TRUE;
+}
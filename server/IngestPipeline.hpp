@@ -0,0 +1,175 @@
+#pragma once
+#include <gst/gst.h>
+#include <gst/app/gstappsrc.h>
+#include <gst/app/gstappsink.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include "ContextThread.hpp"
+
+// Snapshot of an ingest's health, see IngestPipeline::get_health()
+struct StreamHealth {
+    uint64_t packets;
+    uint64_t lost;        // RTP sequence gaps
+    uint64_t reordered;   // Late or duplicated RTP packets
+    uint64_t frames;
+    uint64_t keyframes;
+    double bitrate_kbps;  // Over the last full second
+    double fps;           // Over the last full second
+    double jitter_ms;     // RFC 3550 inter-arrival jitter
+    double keyframe_interval_ms;
+    double probe_cpu_percent; // Time spent in the health probes vs. wall time
+
+    // Reliable ingest only (rtpjitterbuffer stats)
+    bool reliable;
+    uint64_t rtx_requests;   // Retransmissions asked for
+    uint64_t rtx_recovered;  // Retransmissions that arrived in time
+    uint64_t late;           // Packets that arrived after their deadline
+};
+
+// Optional reliable receive path: rtpbin with a jitter buffer and RTCP NACK
+// based retransmission (RTX, pt 97). Needs the sender started with
+// 'observer/connection.sh --reliable'.
+struct IngestOptions {
+    bool reliable = false;
+    std::string sender_ip;  // Where RTCP feedback (NACKs) is sent
+    guint latency_ms = 200; // Jitter buffer depth; bounds the added latency
+};
+
+// In-process consumer of an ingest (e.g. the HLS packager). Both calls run on
+// the ingest's streaming thread with its consumer lock held: keep them short
+// and take a ref on the buffer if it is kept.
+class IngestListener {
+public:
+    virtual ~IngestListener() = default;
+    virtual void on_caps(GstCaps* caps) = 0;
+    virtual void on_buffer(GstBuffer* buffer) = 0;
+};
+
+// Receives the camera's RTP packets as they are received (after the jitter
+// buffer in reliable mode), ahead of the queue in front of the depayloader.
+// Called on the receive thread with the ingest's RTP listener lock held: a
+// slow listener holds up every packet of the camera.
+class RtpListener {
+public:
+    virtual ~RtpListener() = default;
+    virtual void on_rtp(GstBuffer* buffer) = 0;
+};
+
+// One receive chain per camera:
+//   udpsrc ! queue ! rtph264depay ! h264parse ! appsink
+// Every consumer (RTSP mount, recorder, ...) registers an appsrc and gets the
+// same parsed access units pushed into it. Buffers are refcounted, so the
+// payload is never copied no matter how many consumers are attached.
+//
+// The access units since the last keyframe are kept in a bounded pre-roll
+// buffer so a recorder can start on that keyframe instead of waiting for the
+// next one.
+class IngestPipeline {
+public:
+    static constexpr GstClockTime DEFAULT_PREROLL_TIME = 4 * GST_SECOND;
+    static constexpr size_t DEFAULT_PREROLL_BYTES = 16 * 1024 * 1024;
+
+    IngestPipeline(int port, GstClockTime max_preroll_time = DEFAULT_PREROLL_TIME,
+                   size_t max_preroll_bytes = DEFAULT_PREROLL_BYTES,
+                   const IngestOptions& options = IngestOptions());
+    ~IngestPipeline();
+
+    // The bus is watched on the camera's worker thread
+    bool start(ContextThread* worker);
+    void stop();
+
+    // Attach/detach a consumer appsrc. With use_preroll the consumer first gets
+    // the buffered GOP (starting on the last keyframe), otherwise it starts on
+    // the next keyframe.
+    void add_consumer(GstElement* appsrc, bool use_preroll = false);
+    void remove_consumer(GstElement* appsrc);
+    void add_listener(IngestListener* listener, bool use_preroll = false);
+    void remove_listener(IngestListener* listener);
+    // After remove_rtp_listener() returns the listener is no longer called
+    void add_rtp_listener(RtpListener* listener);
+    void remove_rtp_listener(RtpListener* listener);
+    size_t consumer_count(); // appsrcs and listeners of both kinds
+
+    // Memory currently held by the pre-roll buffer
+    size_t preroll_bytes();
+
+    // Safe to call from any thread; only the jitter buffer lookup takes a lock
+    StreamHealth get_health();
+
+    int get_port() const { return port; }
+
+private:
+    struct Consumer {
+        GstAppSrc* src;
+        bool waiting_keyframe;
+        GstClockTime first_ts; // Rebases timestamps so each consumer starts at 0
+    };
+
+    int port;
+    IngestOptions options;
+    GstElement* pipeline = nullptr;
+    GSource* bus_watch = nullptr;
+    GstElement* jitterbuffer = nullptr; // Reliable mode, guarded by consumer_mutex
+    GstCaps* caps = nullptr;
+    std::vector<Consumer> consumers;
+    std::vector<IngestListener*> listeners;
+    std::mutex consumer_mutex;
+    std::vector<RtpListener*> rtp_listeners;
+    std::mutex rtp_mutex; // Separate so RTP writers never wait on the AU fan-out
+
+    // Pre-roll: always empty or starting on a keyframe (guarded by consumer_mutex)
+    GstClockTime max_preroll_time;
+    size_t max_preroll_bytes;
+    std::deque<GstBuffer*> preroll;
+    size_t preroll_size = 0;
+    bool preroll_overflow = false;
+
+    // Health counters: written by the streaming thread only, read lock-free
+    struct HealthCounters {
+        std::atomic<uint64_t> packets{0}, lost{0}, reordered{0};
+        std::atomic<uint64_t> frames{0}, keyframes{0};
+        std::atomic<uint64_t> bitrate_bps{0}, fps_milli{0};
+        std::atomic<uint64_t> jitter_us{0}, keyframe_interval_us{0};
+        std::atomic<uint64_t> probe_ns{0};
+    } health;
+    std::chrono::steady_clock::time_point started_at;
+
+    // Sequence checks of RFC 3550 A.1: a gap below MAX_DROPOUT is loss, a
+    // step back within MAX_MISORDER a late packet; any other jump becomes the
+    // new base once the packet after it follows (a restarted sender)
+    static constexpr uint16_t MAX_DROPOUT = 3000;
+    static constexpr uint16_t MAX_MISORDER = 100;
+    static constexpr uint32_t NO_BAD_SEQ = 0x10000;
+
+    // Streaming thread state behind the counters
+    bool have_rtp = false;
+    uint16_t last_seq = 0;
+    uint32_t bad_seq = NO_BAD_SEQ; // Expected next after a jump
+    uint32_t last_rtp_ts = 0;
+    GstClockTime last_arrival = GST_CLOCK_TIME_NONE;
+    double jitter = 0; // In 90 kHz RTP clock units
+    GstClockTime rate_window_start = GST_CLOCK_TIME_NONE;
+    uint64_t rate_window_bytes = 0;
+    GstClockTime fps_window_start = GST_CLOCK_TIME_NONE;
+    uint64_t fps_window_frames = 0;
+    GstClockTime last_keyframe_ts = GST_CLOCK_TIME_NONE;
+
+    void reset_health();
+    void account_rtp(GstBuffer* buffer);
+    void account_frame(GstBuffer* buffer);
+
+    void push_to(Consumer& consumer, GstBuffer* buffer);
+    void store_preroll(GstBuffer* buffer);
+    void clear_preroll();
+
+    static GstFlowReturn on_new_sample(GstAppSink* sink, gpointer user_data);
+    static GstElement* request_aux_receiver(GstElement* rtpbin, guint session, gpointer user_data);
+    static void new_jitterbuffer(GstElement* rtpbin, GstElement* jitterbuffer, guint session, guint ssrc, gpointer user_data);
+    static GstPadProbeReturn rtp_probe(GstPad* pad, GstPadProbeInfo* info, gpointer user_data);
+    static gboolean bus_callback(GstBus* bus, GstMessage* msg, gpointer user_data);
+};
@@ -0,0 +1,647 @@
+#include "RecordSink.hpp"
+
+#ifdef __linux__
+#include <gst/base/gstbasesink.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+#include <string>
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+#include "Logger.hpp"
+
+static constexpr size_t PAGE = 4096;
+static constexpr guint64 LARGE_FOLIO = 2 * 1024 * 1024; // Largest page cache folio (x86-64 PMD)
+static constexpr guint MAX_SLOTS = 64;
+static constexpr GstClockTime STALL_THRESHOLD = 50 * GST_MSECOND; // Sync mode: slower writes count as stalls
+static constexpr gint64 REPORT_INTERVAL_US = G_USEC_PER_SEC;
+
+// One write batch. With io_uring several are in flight; a slot is reused once
+// its write and the linked writeback have both completed.
+struct Slot {
+    char* data; // Page aligned, batch_size bytes
+    guint64 offset;
+    size_t len;
+    int pending; // Outstanding CQEs
+};
+
+enum { OP_WRITE, OP_SYNC_RANGE, OP_FSYNC }; // io_uring user_data: slot << 2 | op
+
+struct RecordSink {
+    GstBaseSink parent;
+
+    // Properties
+    gchar* location;
+    guint64 preallocate;
+    guint batch_size;
+    guint sync_interval;
+    gboolean io_uring;
+    guint max_inflight;
+
+    // Open file (streaming thread only)
+    int fd;
+    Slot slots[MAX_SLOTS];
+    guint slot_count;      // 1 with plain writes
+    guint current;         // Slot being filled
+    guint64 position;      // Where the next buffer goes (moved by byte segments)
+    guint64 file_size;
+    guint64 allocated;     // End of the preallocated range
+    guint64 pending_start; // Plain writes: last batch, writeback started, still cached
+    guint64 pending_end;
+    guint64 keep_from;     // Start of the muxer's current cluster: stays cached until patched
+    guint64 dropped_to;    // Nothing of the file cached below this (a large folio boundary)
+    gint64 last_sync;      // Monotonic, microseconds
+    bool failed;
+    int error;             // errno of the failed write
+
+    // Async writes
+    bool uring_active;
+#ifdef HAVE_LIBURING
+    struct io_uring ring;
+#endif
+    guint inflight;        // Batches
+    guint fsyncs_inflight;
+
+    // Reported in "recordsink-stats" element messages
+    guint max_depth;
+    guint64 stall_ns;      // Time the streaming thread was held up by the disk
+    guint64 stalls;
+    gint64 last_report;
+};
+
+struct RecordSinkClass {
+    GstBaseSinkClass parent_class;
+};
+
+enum { PROP_0, PROP_LOCATION, PROP_PREALLOCATE, PROP_BATCH_SIZE, PROP_SYNC_INTERVAL, PROP_IO_URING, PROP_MAX_INFLIGHT };
+
+#define RECORD_SINK(obj) (reinterpret_cast<RecordSink*>(obj))
+
+G_DEFINE_TYPE(RecordSink, record_sink, GST_TYPE_BASE_SINK)
+
+static GstStaticPadTemplate sink_template = GST_STATIC_PAD_TEMPLATE("sink", GST_PAD_SINK, GST_PAD_ALWAYS, GST_STATIC_CAPS_ANY);
+
+static void record_sink_init(RecordSink* self) {
+    self->location = nullptr;
+    self->preallocate = 64 * 1024 * 1024;
+    self->batch_size = 1024 * 1024;
+    self->sync_interval = 5;
+    self->io_uring = FALSE;
+    self->max_inflight = 8;
+    self->fd = -1;
+    self->slot_count = 0;
+    self->uring_active = false;
+    gst_base_sink_set_sync(GST_BASE_SINK(self), FALSE);
+}
+
+static void record_sink_finalize(GObject* object) {
+    g_free(RECORD_SINK(object)->location);
+    G_OBJECT_CLASS(record_sink_parent_class)->finalize(object);
+}
+
+static void record_sink_set_property(GObject* object, guint id, const GValue* value, GParamSpec* pspec) {
+    RecordSink* self = RECORD_SINK(object);
+    switch (id) {
+    case PROP_LOCATION:
+        g_free(self->location);
+        self->location = g_value_dup_string(value);
+        break;
+    case PROP_PREALLOCATE:
+        self->preallocate = g_value_get_uint64(value);
+        break;
+    case PROP_BATCH_SIZE:
+        // Whole pages so appends stay aligned
+        self->batch_size = std::max<guint>(PAGE, g_value_get_uint(value) / PAGE * PAGE);
+        break;
+    case PROP_SYNC_INTERVAL:
+        self->sync_interval = g_value_get_uint(value);
+        break;
+    case PROP_IO_URING:
+        self->io_uring = g_value_get_boolean(value);
+        break;
+    case PROP_MAX_INFLIGHT:
+        self->max_inflight = std::min(MAX_SLOTS, std::max(1u, g_value_get_uint(value)));
+        break;
+    default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID(object, id, pspec);
+    }
+}
+
+static void record_sink_get_property(GObject* object, guint id, GValue* value, GParamSpec* pspec) {
+    RecordSink* self = RECORD_SINK(object);
+    switch (id) {
+    case PROP_LOCATION: g_value_set_string(value, self->location); break;
+    case PROP_PREALLOCATE: g_value_set_uint64(value, self->preallocate); break;
+    case PROP_BATCH_SIZE: g_value_set_uint(value, self->batch_size); break;
+    case PROP_SYNC_INTERVAL: g_value_set_uint(value, self->sync_interval); break;
+    case PROP_IO_URING: g_value_set_boolean(value, self->io_uring); break;
+    case PROP_MAX_INFLIGHT: g_value_set_uint(value, self->max_inflight); break;
+    default: G_OBJECT_WARN_INVALID_PROPERTY_ID(object, id, pspec);
+    }
+}
+
+// Grows the preallocation ahead of the data; KEEP_SIZE so the file size only
+// ever covers real data and a crash leaves no zero tail
+static void ensure_allocated(RecordSink* self, guint64 end) {
+    while (self->preallocate > 0 && end > self->allocated) {
+        if (fallocate(self->fd, FALLOC_FL_KEEP_SIZE, self->allocated, self->preallocate) != 0) {
+            Logger::error(std::string("[RecordSink] fallocate failed, continuing without: ") + strerror(errno));
+            self->preallocate = 0;
+            return;
+        }
+        self->allocated += self->preallocate;
+    }
+}
+
+// Everything before this offset has been written back
+static guint64 written_back(RecordSink* self) {
+    guint64 end = self->slots[self->current].offset;
+    if (self->pending_end > self->pending_start) end = std::min(end, self->pending_start);
+#ifdef HAVE_LIBURING
+    for (guint i = 0; self->uring_active && i < self->slot_count; ++i) {
+        if (self->slots[i].pending > 0) end = std::min(end, self->slots[i].offset);
+    }
+#endif
+    return end;
+}
+
+// Drops what was written back from the page cache, except the current
+// cluster: matroskamux comes back to patch its size, and a dropped page would
+// have to be read back in first. The kernel only drops large folios that lie
+// wholly in the range, so drops end on their boundary; the wait covers patched
+// pages whose writeback was only started.
+static void drop_cached(RecordSink* self) {
+    guint64 end = std::min(written_back(self), self->keep_from) / LARGE_FOLIO * LARGE_FOLIO;
+    if (end <= self->dropped_to) return;
+    guint64 start = self->dropped_to;
+    sync_file_range(self->fd, start, end - start,
+                    SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+    posix_fadvise(self->fd, start, end - start, POSIX_FADV_DONTNEED);
+    self->dropped_to = end;
+}
+
+static bool sync_due(RecordSink* self) {
+    gint64 now = g_get_monotonic_time();
+    if (self->sync_interval == 0 || now - self->last_sync < (gint64)self->sync_interval * G_USEC_PER_SEC) return false;
+    self->last_sync = now;
+    return true;
+}
+
+static void add_stall(RecordSink* self, gint64 started_us) {
+    self->stall_ns += (g_get_monotonic_time() - started_us) * 1000;
+    self->stalls++;
+}
+
+static bool write_batch_sync(RecordSink* self) {
+    Slot& slot = self->slots[self->current];
+    gint64 started = g_get_monotonic_time();
+
+    ensure_allocated(self, slot.offset + slot.len);
+    size_t done = 0;
+    while (done < slot.len) {
+        ssize_t n = pwrite(self->fd, slot.data + done, slot.len - done, slot.offset + done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            self->error = n < 0 ? errno : EIO;
+            return false;
+        }
+        done += n;
+    }
+
+    guint64 start = slot.offset;
+    guint64 end = start + slot.len;
+    self->file_size = std::max(self->file_size, end);
+    slot.offset = end;
+    slot.len = 0;
+
+    // Start writeback of this batch now; the previous one has had a whole
+    // batch worth of time to reach the disk, so wait for it and drop it
+    sync_file_range(self->fd, start, end - start, SYNC_FILE_RANGE_WRITE);
+    if (self->pending_end > self->pending_start) {
+        sync_file_range(self->fd, self->pending_start, self->pending_end - self->pending_start,
+                        SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+    }
+    self->pending_start = start;
+    self->pending_end = end;
+    drop_cached(self);
+
+    if (sync_due(self)) fdatasync(self->fd);
+
+    if ((GstClockTime)(g_get_monotonic_time() - started) * 1000 >= STALL_THRESHOLD) add_stall(self, started);
+    return true;
+}
+
+#ifdef HAVE_LIBURING
+static void handle_completion(RecordSink* self, guint64 data, int res) {
+    int op = data & 3;
+    if (op == OP_FSYNC) {
+        self->fsyncs_inflight--;
+        if (res < 0 && !self->failed) {
+            self->failed = true;
+            self->error = -res;
+        }
+        return;
+    }
+
+    Slot& slot = self->slots[data >> 2];
+    if (op == OP_WRITE && res != (int)slot.len && !self->failed) {
+        // Short writes on a regular file only happen when the disk is full
+        self->failed = true;
+        self->error = res < 0 ? -res : ENOSPC;
+    }
+    if (--slot.pending == 0) self->inflight--;
+    // On disk now: clean pages drop right away
+    if (op == OP_SYNC_RANGE) drop_cached(self);
+}
+
+// False if the ring itself failed; nothing more will complete then
+static bool reap(RecordSink* self, bool wait) {
+    struct io_uring_cqe* cqe;
+    int ret = wait ? io_uring_wait_cqe(&self->ring, &cqe) : io_uring_peek_cqe(&self->ring, &cqe);
+    while (ret == 0) {
+        guint64 data = cqe->user_data;
+        int res = cqe->res;
+        io_uring_cqe_seen(&self->ring, cqe);
+        handle_completion(self, data, res);
+        ret = io_uring_peek_cqe(&self->ring, &cqe);
+    }
+    if (wait && ret < 0 && ret != -EAGAIN && ret != -EINTR) {
+        if (!self->failed) {
+            self->failed = true;
+            self->error = -ret;
+        }
+        return false;
+    }
+    return true;
+}
+
+// Waits for every write (before a seek, at EOS and on close). Also after a
+// failure: the kernel may still be reading the batch buffers.
+static void drain(RecordSink* self) {
+    while (self->uring_active && (self->inflight > 0 || self->fsyncs_inflight > 0) && reap(self, true)) {}
+}
+
+// Queues the batch (write, then a linked sync_file_range so the pages can be
+// dropped on completion) and moves on to the next free slot. The streaming
+// thread only waits when all max-inflight batches are still in flight.
+static bool submit_batch(RecordSink* self) {
+    guint index = self->current;
+    Slot& slot = self->slots[index];
+    ensure_allocated(self, slot.offset + slot.len);
+
+    struct io_uring_sqe* sqe = io_uring_get_sqe(&self->ring);
+    io_uring_prep_write(sqe, self->fd, slot.data, slot.len, slot.offset);
+    sqe->flags |= IOSQE_IO_LINK;
+    sqe->user_data = (guint64)index << 2 | OP_WRITE;
+    sqe = io_uring_get_sqe(&self->ring);
+    io_uring_prep_sync_file_range(sqe, self->fd, slot.len, slot.offset,
+                                  SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+    sqe->user_data = (guint64)index << 2 | OP_SYNC_RANGE;
+    slot.pending = 2;
+    self->inflight++;
+    self->max_depth = std::max(self->max_depth, self->inflight);
+
+    if (sync_due(self)) {
+        // Drained: the ring runs SQEs in any order, and a sync that started
+        // before the earlier writes finished would not cover them. Later
+        // batches queue behind it in the ring, not in render.
+        sqe = io_uring_get_sqe(&self->ring);
+        io_uring_prep_fsync(sqe, self->fd, IORING_FSYNC_DATASYNC);
+        sqe->flags |= IOSQE_IO_DRAIN;
+        sqe->user_data = OP_FSYNC;
+        self->fsyncs_inflight++;
+    }
+    io_uring_submit(&self->ring);
+
+    guint64 end = slot.offset + slot.len;
+    self->file_size = std::max(self->file_size, end);
+    guint next = (index + 1) % self->slot_count;
+    reap(self, false);
+    if (self->slots[next].pending > 0) {
+        gint64 started = g_get_monotonic_time();
+        while (self->slots[next].pending > 0 && reap(self, true)) {}
+        add_stall(self, started);
+    }
+    self->slots[next].offset = end;
+    self->slots[next].len = 0;
+    self->current = next;
+    return !self->failed;
+}
+#else
+static void drain(RecordSink*) {}
+static bool submit_batch(RecordSink*) { return false; }
+#endif
+
+static bool write_batch(RecordSink* self) {
+    if (self->failed) return false;
+    if (self->slots[self->current].len == 0) return true;
+    if (self->uring_active) return submit_batch(self);
+    if (!write_batch_sync(self)) self->failed = true;
+    return !self->failed;
+}
+
+// A rewrite behind the streaming end (matroskamux patching a cluster size or
+// its header): into the batch being filled where it lands there, otherwise
+// straight to the file. The batch keeps filling and the rest of the io_uring
+// queue stays in flight; only a batch still writing the same bytes is waited for.
+static bool write_patch(RecordSink* self, guint64 offset, const guint8* data, size_t len) {
+    Slot& current = self->slots[self->current];
+    if (offset + len > current.offset) {
+        size_t skip = offset < current.offset ? current.offset - offset : 0;
+        memcpy(current.data + (offset + skip - current.offset), data + skip, len - skip);
+        len = skip;
+    }
+    if (len == 0) return true;
+
+#ifdef HAVE_LIBURING
+    for (guint i = 0; self->uring_active && i < self->slot_count; ++i) {
+        Slot& slot = self->slots[i];
+        if (slot.pending == 0 || offset >= slot.offset + slot.len || offset + len <= slot.offset) continue;
+        gint64 started = g_get_monotonic_time();
+        while (slot.pending > 0 && reap(self, true)) {}
+        add_stall(self, started);
+    }
+#endif
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = pwrite(self->fd, data + done, len - done, offset + done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            self->error = n < 0 ? errno : EIO;
+            self->failed = true;
+            return false;
+        }
+        done += n;
+    }
+    // Clean by the time the cluster's pages are dropped
+    sync_file_range(self->fd, offset, len, SYNC_FILE_RANGE_WRITE);
+    return true;
+}
+
+static void post_stats(RecordSink* self, bool force) {
+    gint64 now = g_get_monotonic_time();
+    if (!force && now - self->last_report < REPORT_INTERVAL_US) return;
+    self->last_report = now;
+    GstStructure* st = gst_structure_new("recordsink-stats",
+        "io-uring", G_TYPE_BOOLEAN, self->uring_active,
+        "queue-depth", G_TYPE_UINT, self->inflight,
+        "max-queue-depth", G_TYPE_UINT, self->max_depth,
+        "stall-time", G_TYPE_UINT64, self->stall_ns,
+        "stalls", G_TYPE_UINT64, self->stalls,
+        "write-error", G_TYPE_STRING, self->failed ? strerror(self->error) : "", nullptr);
+    gst_element_post_message(GST_ELEMENT(self), gst_message_new_element(GST_OBJECT(self), st));
+}
+
+static void free_slots(RecordSink* self) {
+    for (guint i = 0; i < self->slot_count; ++i) free(self->slots[i].data);
+    self->slot_count = 0;
+}
+
+static gboolean record_sink_start(GstBaseSink* sink) {
+    RecordSink* self = RECORD_SINK(sink);
+    if (!self->location) {
+        GST_ELEMENT_ERROR(self, RESOURCE, NOT_FOUND, ("No file name specified for writing."), (nullptr));
+        return FALSE;
+    }
+    self->fd = open(self->location, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (self->fd < 0) {
+        GST_ELEMENT_ERROR(self, RESOURCE, OPEN_WRITE, ("Could not open file \"%s\" for writing.", self->location),
+                          ("%s", strerror(errno)));
+        return FALSE;
+    }
+
+    self->uring_active = false;
+#ifdef HAVE_LIBURING
+    if (self->io_uring) {
+        // Room for every slot's write + sync_file_range and a pending fdatasync
+        int ret = io_uring_queue_init(self->max_inflight * 2 + 2, &self->ring, 0);
+        if (ret == 0) self->uring_active = true;
+        else Logger::error(std::string("[RecordSink] io_uring unavailable, using plain writes: ") + strerror(-ret));
+    }
+#else
+    if (self->io_uring) Logger::error("[RecordSink] Built without liburing, using plain writes");
+#endif
+
+    guint wanted = self->uring_active ? self->max_inflight : 1;
+    for (self->slot_count = 0; self->slot_count < wanted; ++self->slot_count) {
+        void* data = nullptr;
+        if (posix_memalign(&data, PAGE, self->batch_size) != 0) break;
+        self->slots[self->slot_count] = Slot{static_cast<char*>(data), 0, 0, 0};
+    }
+    if (self->slot_count == 0) {
+#ifdef HAVE_LIBURING
+        if (self->uring_active) io_uring_queue_exit(&self->ring);
+#endif
+        self->uring_active = false;
+        close(self->fd);
+        self->fd = -1;
+        return FALSE;
+    }
+
+    self->current = 0;
+    self->position = self->file_size = self->allocated = 0;
+    self->pending_start = self->pending_end = self->keep_from = self->dropped_to = 0;
+    self->last_sync = self->last_report = g_get_monotonic_time();
+    self->failed = false;
+    self->error = 0;
+    self->inflight = self->fsyncs_inflight = self->max_depth = 0;
+    self->stall_ns = self->stalls = 0;
+    return TRUE;
+}
+
+static gboolean record_sink_stop(GstBaseSink* sink) {
+    RecordSink* self = RECORD_SINK(sink);
+    if (self->fd < 0) return TRUE;
+
+    // First failure wins: a failed write, else the first call below to fail
+    write_batch(self);
+    drain(self);
+    int error = self->failed ? self->error : 0;
+    post_stats(self, true);
+#ifdef HAVE_LIBURING
+    if (self->uring_active) io_uring_queue_exit(&self->ring);
+#endif
+    self->uring_active = false;
+
+    if (fdatasync(self->fd) != 0 && error == 0) error = errno;
+    // Give back the unused preallocation and leave nothing of the file cached
+    if (ftruncate(self->fd, self->file_size) != 0 && error == 0) error = errno;
+    posix_fadvise(self->fd, 0, 0, POSIX_FADV_DONTNEED);
+    if (close(self->fd) != 0 && error == 0) error = errno;
+    self->fd = -1;
+    free_slots(self);
+
+    if (error != 0) {
+        GST_ELEMENT_ERROR(self, RESOURCE, CLOSE, ("Error closing file \"%s\".", self->location), ("%s", strerror(error)));
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static GstFlowReturn record_sink_render(GstBaseSink* sink, GstBuffer* buffer) {
+    RecordSink* self = RECORD_SINK(sink);
+    GstMapInfo map;
+    if (!gst_buffer_map(buffer, &map, GST_MAP_READ)) return GST_FLOW_ERROR;
+
+    // A byte segment moved us back (matroskamux patching what it wrote) or,
+    // rarely, ahead (a new batch starts there)
+    bool ok = !self->failed;
+    Slot* slot = &self->slots[self->current];
+    guint64 end = slot->offset + slot->len;
+    size_t done = 0;
+    if (ok && self->position < end) {
+        done = std::min<guint64>(map.size, end - self->position);
+        ok = write_patch(self, self->position, map.data, done);
+    } else if (ok && self->position > end) {
+        ok = write_batch(self);
+        slot = &self->slots[self->current];
+        slot->offset = self->position;
+    }
+
+    while (ok && done < map.size) {
+        size_t n = std::min<size_t>(self->batch_size - slot->len, map.size - done);
+        memcpy(slot->data + slot->len, map.data + done, n);
+        slot->len += n;
+        done += n;
+        if (slot->len == self->batch_size) {
+            ok = write_batch(self);
+            slot = &self->slots[self->current];
+        }
+    }
+    self->position += map.size;
+    gst_buffer_unmap(buffer, &map);
+    post_stats(self, false);
+
+    if (!ok) {
+        GST_ELEMENT_ERROR(self, RESOURCE, WRITE, ("Error while writing to file \"%s\".", self->location),
+                          ("%s", strerror(self->error)));
+        return GST_FLOW_ERROR;
+    }
+    return GST_FLOW_OK;
+}
+
+static gboolean record_sink_event(GstBaseSink* sink, GstEvent* event) {
+    RecordSink* self = RECORD_SINK(sink);
+    switch (GST_EVENT_TYPE(event)) {
+    case GST_EVENT_SEGMENT: {
+        const GstSegment* segment;
+        gst_event_parse_segment(event, &segment);
+        if (segment->format != GST_FORMAT_BYTES) break;
+        if (self->fd >= 0) {
+            const Slot& slot = self->slots[self->current];
+            guint64 end = slot.offset + slot.len;
+            if (segment->start == end && self->position != end) {
+                // Back at the end after a patch: the next cluster starts here,
+                // the ones before are final
+                self->keep_from = end;
+                drop_cached(self);
+            }
+        }
+        self->position = segment->start;
+        break;
+    }
+    case GST_EVENT_EOS:
+        // Durable before splitmuxsink reports the fragment as closed
+        if (self->fd >= 0) {
+            bool failed_before = self->failed;
+            write_batch(self);
+            drain(self);
+            if (!self->failed && fdatasync(self->fd) != 0) {
+                self->failed = true;
+                self->error = errno;
+            }
+            post_stats(self, true);
+            if (self->failed) {
+                // Not durable: the fragment must not be reported as closed
+                if (!failed_before) {
+                    GST_ELEMENT_ERROR(self, RESOURCE, WRITE, ("Error while writing to file \"%s\".", self->location),
+                                      ("%s", strerror(self->error)));
+                }
+                gst_event_unref(event);
+                return FALSE;
+            }
+        }
+        break;
+    default:
+        break;
+    }
+    return GST_BASE_SINK_CLASS(record_sink_parent_class)->event(sink, event);
+}
+
+static gboolean record_sink_query(GstBaseSink* sink, GstQuery* query) {
+    RecordSink* self = RECORD_SINK(sink);
+    switch (GST_QUERY_TYPE(query)) {
+    case GST_QUERY_SEEKING: {
+        // Lets matroskamux write cues and the final duration
+        GstFormat format;
+        gst_query_parse_seeking(query, &format, nullptr, nullptr, nullptr);
+        gst_query_set_seeking(query, format, format == GST_FORMAT_BYTES || format == GST_FORMAT_DEFAULT, 0, -1);
+        return TRUE;
+    }
+    case GST_QUERY_POSITION: {
+        GstFormat format;
+        gst_query_parse_position(query, &format, nullptr);
+        if (format != GST_FORMAT_BYTES && format != GST_FORMAT_DEFAULT) break;
+        gst_query_set_position(query, GST_FORMAT_BYTES, self->position);
+        return TRUE;
+    }
+    default:
+        break;
+    }
+    return GST_BASE_SINK_CLASS(record_sink_parent_class)->query(sink, query);
+}
+
+static void record_sink_class_init(RecordSinkClass* klass) {
+    GObjectClass* gobject_class = G_OBJECT_CLASS(klass);
+    GstElementClass* element_class = GST_ELEMENT_CLASS(klass);
+    GstBaseSinkClass* basesink_class = GST_BASE_SINK_CLASS(klass);
+
+    gobject_class->set_property = record_sink_set_property;
+    gobject_class->get_property = record_sink_get_property;
+    gobject_class->finalize = record_sink_finalize;
+
+    GParamFlags flags = static_cast<GParamFlags>(G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+    g_object_class_install_property(gobject_class, PROP_LOCATION,
+        g_param_spec_string("location", "Location", "File to write", nullptr, flags));
+    g_object_class_install_property(gobject_class, PROP_PREALLOCATE,
+        g_param_spec_uint64("preallocate", "Preallocate", "fallocate extent in bytes (0 = off)",
+                            0, G_MAXUINT64, 64 * 1024 * 1024, flags));
+    g_object_class_install_property(gobject_class, PROP_BATCH_SIZE,
+        g_param_spec_uint("batch-size", "Batch size", "Bytes per aligned write",
+                          PAGE, 64 * 1024 * 1024, 1024 * 1024, flags));
+    g_object_class_install_property(gobject_class, PROP_SYNC_INTERVAL,
+        g_param_spec_uint("sync-interval", "Sync interval", "Seconds between fdatasync calls (0 = on close only)",
+                          0, 3600, 5, flags));
+    g_object_class_install_property(gobject_class, PROP_IO_URING,
+        g_param_spec_boolean("io-uring", "io_uring", "Submit writes through io_uring (falls back to pwrite)",
+                             FALSE, flags));
+    g_object_class_install_property(gobject_class, PROP_MAX_INFLIGHT,
+        g_param_spec_uint("max-inflight", "Max in flight", "Batches queued to io_uring before render blocks",
+                          1, MAX_SLOTS, 8, flags));
+
+    gst_element_class_set_static_metadata(element_class, "Recording file sink", "Sink/File",
+                                          "Preallocating, page-cache friendly file writer", "Nandadeep");
+    gst_element_class_add_static_pad_template(element_class, &sink_template);
+
+    basesink_class->start = record_sink_start;
+    basesink_class->stop = record_sink_stop;
+    basesink_class->render = record_sink_render;
+    basesink_class->event = record_sink_event;
+    basesink_class->query = record_sink_query;
+}
+
+bool record_sink_register() {
+    return gst_element_register(nullptr, RECORD_SINK_FACTORY, GST_RANK_NONE, record_sink_get_type());
+}
+
+#else
+
+bool record_sink_register() {
+    return false;
+}
+
+#endif
@@ -0,0 +1,28 @@
+#pragma once
+#include <gst/gst.h>
+
+// "recordsink": file sink for the recorders (splitmuxsink sink-factory),
+// tuned for long sessions on ext4 (Linux only):
+//  - preallocate: files grow in fallocate'd extents of this many bytes, so a
+//    recording stays in a few large extents (0 = off)
+//  - batch-size: data is written in page-aligned batches of this size
+//  - written ranges are pushed to disk with sync_file_range and dropped from
+//    the page cache (POSIX_FADV_DONTNEED) one batch behind, so recordings
+//    do not evict everything else; the current cluster stays cached until
+//    matroskamux has patched its size
+//  - sync-interval: fdatasync every N seconds for crash durability (0 = only
+//    when the file is closed)
+//  - io-uring: writes are queued to io_uring (up to max-inflight batches,
+//    each followed by a linked sync_file_range) and completed
+//    asynchronously; render only blocks when the queue is full. Falls back
+//    to pwrite when built without liburing or the kernel refuses the ring.
+// Posts a "recordsink-stats" element message about once a second and on close
+// (io-uring, queue-depth, max-queue-depth, stall-time in ns, stalls,
+// write-error: "" or why the file failed, including at EOS and close).
+// Handles the byte seeks matroskamux does to patch cluster sizes and its
+// header: the patch goes into the batch being filled or straight to the file
+// with pwrite, without flushing that batch or draining the io_uring queue.
+static constexpr const char* RECORD_SINK_FACTORY = "recordsink";
+
+// Registers the element; false where it is not available (use filesink)
+bool record_sink_register();
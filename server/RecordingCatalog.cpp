@@ -0,0 +1,436 @@
+#include "RecordingCatalog.hpp"
+#include <filesystem>
+#include <algorithm>
+#include <chrono>
+#include <sstream>
+#include <iomanip>
+#include <cstdio>
+#include <ctime>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+#include "SeekIndex.hpp"
+#include "Logger.hpp"
+
+namespace fs = std::filesystem;
+
+static std::string normalize(const std::string& path) {
+    return fs::path(path).lexically_normal().string();
+}
+
+static bool is_video(const fs::path& path) {
+    return path.extension() == ".mkv";
+}
+
+RecordingCatalog::RecordingCatalog(const std::string& root_dir) : roots{normalize(root_dir)} {}
+
+void RecordingCatalog::add_root(const std::string& dir) {
+    roots.push_back(normalize(dir));
+}
+
+bool RecordingCatalog::locate(const std::string& path, std::string& key, int& tier) {
+    size_t best = 0;
+    bool found = false;
+    for (size_t i = 0; i < roots.size(); ++i) {
+        fs::path relative = fs::path(path).lexically_relative(roots[i]);
+        // Deepest root wins should one tier sit inside another
+        if (relative.empty() || *relative.begin() == ".." || (found && roots[i].size() < best)) continue;
+        key = relative.generic_string();
+        tier = static_cast<int>(i);
+        best = roots[i].size();
+        found = true;
+    }
+    return found;
+}
+
+RecordingCatalog::~RecordingCatalog() {
+    stop();
+}
+
+void RecordingCatalog::start() {
+#ifdef __linux__
+    // Watches first, so nothing written during the build is missed
+    inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotify_fd < 0) Logger::error("[Catalog] inotify unavailable, only recorder events keep the catalog current");
+#endif
+    build();
+#ifdef __linux__
+    if (inotify_fd >= 0) watcher = std::thread(&RecordingCatalog::watch, this);
+#endif
+}
+
+void RecordingCatalog::stop() {
+    quit = true;
+    if (watcher.joinable()) watcher.join();
+#ifdef __linux__
+    if (inotify_fd >= 0) ::close(inotify_fd);
+#endif
+    inotify_fd = -1;
+}
+
+// File name layout from VideoStorage::create_filename():
+//   YYYY-MM-DD_HH-MM-SS_<doctor>[_<n>].mkv (local time)
+bool RecordingCatalog::read_recording(const std::string& path, bool live, Recording& out) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) return false;
+
+    fs::path file(path);
+    std::string stem = file.stem().string();
+    std::tm tm = {};
+    out.start = st.st_mtime;
+    out.doctor.clear();
+    if (stem.size() > 20 && stem[19] == '_' &&
+        sscanf(stem.c_str(), "%4d-%2d-%2d_%2d-%2d-%2d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday,
+               &tm.tm_hour, &tm.tm_min, &tm.tm_sec) == 6) {
+        tm.tm_year -= 1900;
+        tm.tm_mon -= 1;
+        tm.tm_isdst = -1;
+        out.start = std::mktime(&tm);
+        out.doctor = stem.substr(20);
+        // Collision counter
+        size_t sep = out.doctor.rfind('_');
+        if (sep != std::string::npos && sep + 1 < out.doctor.size() &&
+            out.doctor.find_first_not_of("0123456789", sep + 1) == std::string::npos) {
+            out.doctor.resize(sep);
+        }
+    }
+
+    if (!locate(path, out.path, out.tier)) return false;
+    fs::path relative(out.path);
+    out.location = path;
+    out.camera = relative.has_parent_path() ? relative.begin()->string() : "";
+    out.size = st.st_size;
+    out.modified = st.st_mtime;
+    out.live = live;
+
+    out.duration = 0;
+    SeekIndex index;
+    if (index.open(SeekIndexWriter::path_for(path))) {
+        index.limit_to(out.size);
+        if (index.size() > 0) out.duration = index[index.size() - 1].pts / 1e9;
+    }
+    return true;
+}
+
+void RecordingCatalog::insert(Catalog& catalog, const std::string& key, const Recording& recording) {
+    erase(catalog, key);
+    const Recording* stored = &(catalog.recordings[key] = recording);
+    std::pair<int64_t, std::string> start = {recording.start, key};
+    catalog.by_start.insert({start, stored});
+    catalog.by_camera[recording.camera].insert({start, stored});
+    catalog.by_doctor[recording.doctor].insert({start, stored});
+    catalog.by_size.insert({{recording.size, key}, stored});
+    catalog.by_duration.insert({{recording.duration, key}, stored});
+    catalog.bytes.total += recording.size;
+    catalog.bytes.cameras[recording.camera] += recording.size;
+}
+
+void RecordingCatalog::erase(Catalog& catalog, const std::string& key) {
+    auto it = catalog.recordings.find(key);
+    if (it == catalog.recordings.end()) return;
+    const Recording& recording = it->second;
+    std::pair<int64_t, std::string> start = {recording.start, key};
+    catalog.by_start.erase(start);
+    catalog.by_size.erase({recording.size, key});
+    catalog.by_duration.erase({recording.duration, key});
+    catalog.bytes.total -= recording.size;
+    auto used = catalog.bytes.cameras.find(recording.camera);
+    if (used != catalog.bytes.cameras.end() && (used->second -= recording.size) == 0) catalog.bytes.cameras.erase(used);
+    auto unindex = [&start](std::map<std::string, StartIndex>& index, const std::string& name) {
+        auto keys = index.find(name);
+        if (keys == index.end()) return;
+        keys->second.erase(start);
+        if (keys->second.empty()) index.erase(keys);
+    };
+    unindex(catalog.by_camera, recording.camera);
+    unindex(catalog.by_doctor, recording.doctor);
+    catalog.recordings.erase(it);
+}
+
+// Member by member: the trees hold pointers into recordings, whose nodes a
+// swap leaves where they are
+void RecordingCatalog::Catalog::swap(Catalog& other) {
+    recordings.swap(other.recordings);
+    by_start.swap(other.by_start);
+    by_camera.swap(other.by_camera);
+    by_doctor.swap(other.by_doctor);
+    by_size.swap(other.by_size);
+    by_duration.swap(other.by_duration);
+    std::swap(bytes, other.bytes);
+}
+
+void RecordingCatalog::update(const std::string& path, bool live) {
+    std::string key = normalize(path);
+    Recording recording;
+    if (!read_recording(key, live, recording)) {
+        remove(key);
+        return;
+    }
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    insert(current, recording.path, recording);
+}
+
+void RecordingCatalog::remove(const std::string& path) {
+    std::string location = normalize(path);
+    std::string key;
+    int tier;
+    if (!locate(location, key, tier)) return;
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    auto it = current.recordings.find(key);
+    if (it != current.recordings.end() && it->second.location == location) erase(current, key);
+}
+
+RecordingUsage RecordingCatalog::usage() {
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return current.bytes;
+}
+
+size_t RecordingCatalog::size() {
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return current.recordings.size();
+}
+
+bool RecordingCatalog::contains(const std::string& relative) {
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return current.recordings.count(relative) > 0;
+}
+
+void RecordingCatalog::scan_dir(const std::string& dir, std::vector<std::pair<std::string, Recording>>& out) {
+    std::error_code ec;
+    for (const auto& entry : fs::directory_iterator(dir, ec)) {
+        if (!entry.is_regular_file(ec) || !is_video(entry.path())) continue;
+        Recording recording;
+        if (read_recording(normalize(entry.path().string()), false, recording)) out.emplace_back(recording.path, recording);
+    }
+}
+
+// Folders are listed first (cheap), then stat'ed and parsed in parallel
+void RecordingCatalog::build(bool replace) {
+    auto started = std::chrono::steady_clock::now();
+    std::vector<std::string> dirs;
+    std::error_code ec;
+    for (const auto& root : roots) {
+        dirs.push_back(root);
+        for (const auto& entry : fs::recursive_directory_iterator(root, ec)) {
+            if (entry.is_directory(ec)) dirs.push_back(entry.path().string());
+        }
+    }
+#ifdef __linux__
+    if (inotify_fd >= 0) {
+        for (const auto& dir : dirs) add_watch(dir);
+    }
+#endif
+
+    unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+    size_t thread_count = std::min<size_t>(cores, dirs.size());
+    std::vector<std::vector<std::pair<std::string, Recording>>> found(thread_count);
+    std::atomic<size_t> next{0};
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < thread_count; ++t) {
+        threads.emplace_back([&, t]() {
+            for (size_t i = next++; i < dirs.size(); i = next++) scan_dir(dirs[i], found[t]);
+        });
+    }
+    for (auto& thread : threads) thread.join();
+
+    size_t total = 0;
+    if (replace) {
+        // Built next to the current view, which keeps answering queries until
+        // the new one is swapped in; recordings still being written stay live
+        Catalog fresh;
+        for (const auto& part : found) {
+            for (const auto& [key, recording] : part) {
+                if (!fresh.recordings.count(key)) insert(fresh, key, recording);
+            }
+        }
+        std::unique_lock<std::shared_mutex> lock(mutex);
+        for (auto& [key, recording] : fresh.recordings) {
+            auto old = current.recordings.find(key);
+            if (old != current.recordings.end() && old->second.live) recording.live = true;
+        }
+        current.swap(fresh);
+        total = current.recordings.size();
+    } else {
+        std::unique_lock<std::shared_mutex> lock(mutex);
+        for (const auto& part : found) {
+            for (const auto& [key, recording] : part) {
+                // A watcher event may already have a fresher view of this file; a
+                // recording found on two tiers (move interrupted) is listed once
+                if (!current.recordings.count(key)) insert(current, key, recording);
+            }
+        }
+        total = current.recordings.size();
+    }
+    built = true;
+
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - started).count();
+    std::stringstream ss;
+    ss << "[Catalog] " << total << " recordings in " << dirs.size() << " folders indexed in " << std::fixed
+       << std::setprecision(1) << ms << " ms (" << thread_count << " threads)";
+    Logger::info(ss.str());
+}
+
+RecordingPage RecordingCatalog::query(const RecordingQuery& q) {
+    RecordingPage page = {0, {}};
+    auto now = std::time(nullptr);
+    auto output = [now](Recording recording) {
+        // Live files have no final index yet; report how long they have run
+        if (recording.live && now > recording.start) recording.duration = double(now - recording.start);
+        return recording;
+    };
+
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    if (q.from > 0 && q.to > 0 && q.to < q.from) return page;
+    // Copies the page of ranks [first, last) of an index, in either order
+    auto copy_page = [&](const auto& index, size_t first, size_t last) {
+        page.total = last - first;
+        if (q.offset >= page.total) return;
+        size_t count = std::min(q.limit, page.total - q.offset);
+        if (q.descending) {
+            auto it = index.find_by_order(last - 1 - q.offset);
+            for (; count > 0; --count, --it) page.items.push_back(output(*it->second));
+        } else {
+            auto it = index.find_by_order(first + q.offset);
+            for (; count > 0; --count, ++it) page.items.push_back(output(*it->second));
+        }
+    };
+
+    bool filtered = !q.camera.empty() || !q.doctor.empty() || q.from > 0 || q.to > 0;
+    if (q.sort != RecordingQuery::BY_START && !filtered) {
+        if (q.sort == RecordingQuery::BY_SIZE) copy_page(current.by_size, 0, current.by_size.size());
+        else copy_page(current.by_duration, 0, current.by_duration.size());
+        return page;
+    }
+
+    // The narrowest index for the filters; only a doctor on a camera is left
+    // to check per recording
+    const StartIndex* keys = &current.by_start;
+    bool check_doctor = false;
+    const std::string& filter = q.camera.empty() ? q.doctor : q.camera;
+    if (!filter.empty()) {
+        auto& index = q.camera.empty() ? current.by_doctor : current.by_camera;
+        auto found = index.find(filter);
+        if (found == index.end()) return page;
+        keys = &found->second;
+        check_doctor = !q.camera.empty() && !q.doctor.empty();
+    }
+    size_t first_rank = q.from > 0 ? keys->order_of_key({q.from, ""}) : 0;
+    size_t last_rank = q.to > 0 ? keys->order_of_key({q.to + 1, ""}) : keys->size();
+    auto first = keys->find_by_order(first_rank);
+    auto last = keys->find_by_order(last_rank);
+
+    if (q.sort == RecordingQuery::BY_START && !check_doctor) {
+        // Already in order and all matches: ranks give the count and the page
+        copy_page(*keys, first_rank, last_rank);
+        return page;
+    }
+
+    auto matches = [&](const Recording& recording) { return !check_doctor || recording.doctor == q.doctor; };
+
+    if (q.sort == RecordingQuery::BY_START) {
+        // Walk the range once, copying only the page
+        auto visit = [&](const Recording& recording) {
+            if (!matches(recording)) return;
+            if (page.total >= q.offset && page.items.size() < q.limit) page.items.push_back(output(recording));
+            page.total++;
+        };
+        if (q.descending) {
+            for (auto it = last; it != first;) visit(*(--it)->second);
+        } else {
+            for (auto it = first; it != last; ++it) visit(*it->second);
+        }
+        return page;
+    }
+
+    std::vector<const Recording*> found;
+    for (auto it = first; it != last; ++it) {
+        if (matches(*it->second)) found.push_back(it->second);
+    }
+    page.total = found.size();
+    if (q.offset >= found.size()) return page;
+
+    bool by_size = q.sort == RecordingQuery::BY_SIZE;
+    size_t end = q.offset + std::min(q.limit, found.size() - q.offset);
+    std::partial_sort(found.begin(), found.begin() + end, found.end(), [&](const Recording* a, const Recording* b) {
+        double va = by_size ? double(a->size) : a->duration;
+        double vb = by_size ? double(b->size) : b->duration;
+        return q.descending ? va > vb : va < vb;
+    });
+    for (size_t i = q.offset; i < end; ++i) page.items.push_back(output(*found[i]));
+    return page;
+}
+
+#ifdef __linux__
+void RecordingCatalog::add_watch(const std::string& dir) {
+    int wd = inotify_add_watch(inotify_fd, dir.c_str(),
+                               IN_CREATE | IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE);
+    if (wd >= 0) watch_dirs[wd] = dir;
+}
+
+void RecordingCatalog::watch() {
+    alignas(struct inotify_event) char buffer[64 * 1024];
+    while (!quit) {
+        struct pollfd pfd = {inotify_fd, POLLIN, 0};
+        if (poll(&pfd, 1, 500) <= 0) continue;
+        ssize_t len = read(inotify_fd, buffer, sizeof(buffer));
+        if (len <= 0) continue;
+
+        for (char* p = buffer; p < buffer + len;) {
+            const struct inotify_event* event = reinterpret_cast<const struct inotify_event*>(p);
+            p += sizeof(struct inotify_event) + event->len;
+
+            if (event->mask & IN_Q_OVERFLOW) {
+                // Events were lost: start over from the disk
+                Logger::error("[Catalog] inotify queue overflow, rebuilding");
+                built = false; // Retention waits for the new view
+                build(true);
+                break;
+            }
+            if (event->mask & IN_IGNORED) {
+                watch_dirs.erase(event->wd);
+                continue;
+            }
+            auto dir = watch_dirs.find(event->wd);
+            if (dir == watch_dirs.end() || event->len == 0) continue;
+            std::string path = dir->second + "/" + event->name;
+
+            if (event->mask & IN_ISDIR) {
+                // New camera (or day) folder, possibly moved in with recordings
+                if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+                    add_watch(path);
+                    std::vector<std::pair<std::string, Recording>> found;
+                    scan_dir(path, found);
+                    std::unique_lock<std::shared_mutex> lock(mutex);
+                    for (const auto& [key, recording] : found) insert(current, key, recording);
+                }
+                continue;
+            }
+
+            fs::path file(path);
+            if (is_video(file)) {
+                if (event->mask & IN_CREATE) update(path, true);
+                else if (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) update(path, false);
+                else if (event->mask & (IN_DELETE | IN_MOVED_FROM)) remove(path);
+            } else if (file.extension() == ".idx" && (event->mask & IN_CLOSE_WRITE)) {
+                // The index is final now: pick up the duration
+                std::string video = normalize(file.replace_extension().string());
+                std::string key;
+                int tier;
+                bool known = false;
+                if (locate(video, key, tier)) {
+                    std::shared_lock<std::shared_mutex> lock(mutex);
+                    auto it = current.recordings.find(key);
+                    known = it != current.recordings.end() && it->second.location == video;
+                }
+                if (known) update(video, false);
+            }
+        }
+    }
+}
+#else
+void RecordingCatalog::add_watch(const std::string&) {}
+void RecordingCatalog::watch() {}
+#endif
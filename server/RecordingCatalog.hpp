@@ -0,0 +1,118 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <shared_mutex>
+#include <atomic>
+#include <cstdint>
+#include <ext/pb_ds/assoc_container.hpp>
+#include <ext/pb_ds/tree_policy.hpp>
+
+struct Recording {
+    std::string path;     // Relative to its tier's folder ("CameraID/day/file.mkv"); same on every tier
+    std::string location; // Full path on the tier that holds it now
+    int tier;             // 0 = storage folder, then the roots added with add_root()
+    std::string camera;   // Empty for files in the root
+    std::string doctor;
+    int64_t start;        // Unix seconds, from the file name (mtime if it has none)
+    double duration;      // Seconds up to the last keyframe in the seek index; 0 if unknown
+    uint64_t size;
+    int64_t modified;     // Unix seconds, mtime when the file was last read
+    bool live;            // Still being written
+};
+
+struct RecordingQuery {
+    enum Sort { BY_START, BY_SIZE, BY_DURATION };
+
+    std::string camera;   // Exact match; empty = any
+    std::string doctor;   // Exact match; empty = any
+    int64_t from = 0;     // Start time range, unix seconds; 0 = open
+    int64_t to = 0;
+    Sort sort = BY_START;
+    bool descending = true;
+    size_t offset = 0;
+    size_t limit = 50;
+};
+
+// Bytes held by the catalogued recordings (every tier), kept as they change
+struct RecordingUsage {
+    uint64_t total;
+    std::map<std::string, uint64_t> cameras; // "" = files in the root
+};
+
+struct RecordingPage {
+    size_t total;         // Matches before offset/limit
+    std::vector<Recording> items;
+};
+
+// In-memory index of every .mkv in the storage folder. Built once by start()
+// with one thread per core over the camera folders, then kept current by
+// inotify (Linux) and by update()/remove() from the recorders and retention,
+// so queries never touch the disk. Recordings are kept ordered by start time,
+// globally, per camera and per doctor, and by size and by duration; the
+// indexes are order-statistics trees, so a page at any offset is found in
+// O(log n). A recording is known by its relative path, so one
+// moved to another tier stays a single entry that follows the file.
+class RecordingCatalog {
+public:
+    explicit RecordingCatalog(const std::string& root_dir);
+    ~RecordingCatalog();
+
+    void add_root(const std::string& dir); // Another tier; before start()
+    void start();
+    void stop(); // Joins the watcher; also done by the destructor
+
+    // (Re)reads one file's metadata; live marks it as being written
+    void update(const std::string& path, bool live = false);
+    // Forgets the file, unless the recording already lives elsewhere (moved)
+    void remove(const std::string& path);
+
+    RecordingPage query(const RecordingQuery& query);
+    RecordingUsage usage();
+    size_t size();
+    bool contains(const std::string& relative); // A recording by relative path ("CameraID/day/file.mkv")
+    bool ready() const { return built; } // First build done
+
+private:
+    // Recordings by (value, key), into recordings (nodes stay put); rank and
+    // find_by_order in O(log n)
+    template <typename Value>
+    using Index = __gnu_pbds::tree<std::pair<Value, std::string>, const Recording*,
+                                   std::less<std::pair<Value, std::string>>, __gnu_pbds::rb_tree_tag,
+                                   __gnu_pbds::tree_order_statistics_node_update>;
+    using StartIndex = Index<int64_t>;
+
+    struct Catalog {
+        std::unordered_map<std::string, Recording> recordings; // Key: relative path
+        StartIndex by_start;
+        std::map<std::string, StartIndex> by_camera;
+        std::map<std::string, StartIndex> by_doctor;
+        Index<uint64_t> by_size;
+        Index<double> by_duration;
+        RecordingUsage bytes = {0, {}};
+
+        void swap(Catalog& other);
+    };
+
+    std::vector<std::string> roots; // Tier folders, normalized
+    std::shared_mutex mutex;
+    Catalog current;
+    std::atomic<bool> built{false};
+
+    std::thread watcher;
+    std::atomic<bool> quit{false};
+    int inotify_fd = -1;
+    std::map<int, std::string> watch_dirs; // inotify watch -> folder (watcher thread once started)
+
+    bool locate(const std::string& path, std::string& key, int& tier); // false if outside every tier
+    bool read_recording(const std::string& path, bool live, Recording& out);
+    static void insert(Catalog& catalog, const std::string& key, const Recording& recording); // mutex held
+    static void erase(Catalog& catalog, const std::string& key);                             // mutex held
+    void build(bool replace = false); // replace: a new view, swapped in once complete
+    void scan_dir(const std::string& dir, std::vector<std::pair<std::string, Recording>>& out);
+    void watch();
+    void add_watch(const std::string& dir);
+};
@@ -0,0 +1,398 @@
+#include "RetentionEngine.hpp"
+#include <filesystem>
+#include <algorithm>
+#include <sstream>
+#include <cstdio>
+#include <ctime>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#include "Checksum.hpp"
+#include "Logger.hpp"
+
+namespace fs = std::filesystem;
+
+static std::string normalize(const std::string& path) {
+    return fs::path(path).lexically_normal().string();
+}
+
+RetentionEngine::RetentionEngine(VideoStorage& storage) : storage(storage) {}
+
+RetentionEngine::~RetentionEngine() {
+    stop();
+}
+
+void RetentionEngine::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        quit = true;
+    }
+    cond.notify_all();
+    if (thread.joinable()) thread.join();
+}
+
+void RetentionEngine::start(std::function<bool()> stop_oldest_recording) {
+    stop_oldest = std::move(stop_oldest_recording);
+    thread = std::thread(&RetentionEngine::run, this);
+}
+
+void RetentionEngine::set_policy(const RetentionPolicy& new_policy) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        policy = new_policy;
+    }
+    cond.notify_all(); // Apply right away
+}
+
+void RetentionEngine::mark_live(const std::string& path) {
+    std::lock_guard<std::mutex> lock(mutex);
+    live_files.insert(normalize(path));
+}
+
+void RetentionEngine::mark_closed(const std::string& path) {
+    std::lock_guard<std::mutex> lock(mutex);
+    live_files.erase(normalize(path));
+}
+
+bool RetentionEngine::hold(const std::string& path) {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::string file = normalize(path);
+    if (file == busy_file) return false;
+    return held_files.insert(file).second;
+}
+
+void RetentionEngine::release(const std::string& path) {
+    std::lock_guard<std::mutex> lock(mutex);
+    held_files.erase(normalize(path));
+}
+
+bool RetentionEngine::claim(const std::string& path) {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::string file = normalize(path);
+    if (held_files.count(file)) return false;
+    busy_file = file;
+    return true;
+}
+
+void RetentionEngine::unclaim() {
+    std::lock_guard<std::mutex> lock(mutex);
+    busy_file.clear();
+}
+
+RetentionEngine::Stats RetentionEngine::get_stats() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return stats;
+}
+
+bool RetentionEngine::sleep_for(std::chrono::milliseconds duration) {
+    std::unique_lock<std::mutex> lock(mutex);
+    return !cond.wait_for(lock, duration, [this]() { return quit.load(); });
+}
+
+void RetentionEngine::run() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!quit) {
+        lock.unlock();
+        enforce();
+        lock.lock();
+        // Woken early by set_policy() and on shutdown
+        cond.wait_for(lock, std::chrono::seconds(CHECK_INTERVAL_SEC));
+    }
+}
+
+// Oldest first (by start) from the catalog, a page at a time, until visit()
+// says STOP. Files evicted along the way leave the catalog, so the next page
+// starts after the ones that are still there.
+void RetentionEngine::walk_oldest(const std::string& camera, const std::function<Step(const Entry&)>& visit) {
+    RecordingQuery query;
+    query.camera = camera;
+    query.descending = false;
+    query.limit = PAGE_SIZE;
+    int64_t now = std::time(nullptr);
+    while (!quit) {
+        RecordingPage page = storage.get_catalog().query(query);
+        for (const auto& recording : page.items) {
+            bool writing;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                bool marked = live_files.count(recording.location) > 0;
+                writing = recording.live || (marked && now - recording.modified < LIVE_STALE_SEC);
+            }
+            bool live = writing || now - recording.modified < RECENT_SEC;
+            Entry entry = {recording.location, recording.camera, recording.size, recording.start,
+                           recording.modified, live, writing, recording.tier > 0};
+            Step step = visit(entry);
+            if (step == STOP || quit) return;
+            if (step == NEXT) query.offset++;
+        }
+        if (page.items.size() < query.limit) return;
+    }
+}
+
+void RetentionEngine::enforce() {
+    RecordingCatalog& catalog = storage.get_catalog();
+    if (!catalog.ready()) return; // Nothing to go by before its first build
+
+    RetentionPolicy current;
+    std::vector<std::string> marked;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        current = policy;
+        marked.assign(live_files.begin(), live_files.end());
+    }
+    // Recordings being written grow past the size the catalog read when they
+    // were created: refresh those few (captures are not catalogued)
+    for (const auto& path : marked) {
+        if (fs::path(path).extension() == ".mkv") catalog.update(path, true);
+    }
+
+    // 0. Finalized recordings leave the fast tier once old enough, or early
+    //    when it runs short of space; the bulk tier's own space is made below
+    bool tiered = !storage.get_bulk_dir().empty();
+    uint64_t fast_free = storage.get_available_space();
+    int64_t now = std::time(nullptr);
+    if (tiered) {
+        walk_oldest("", [&](const Entry& entry) {
+            bool pressed = fast_free < current.min_free_bytes;
+            if (now - entry.start < current.migrate_after_sec && !pressed) return STOP; // All younger from here
+            if (entry.live || entry.bulk || (now - entry.mtime < current.migrate_after_sec && !pressed)) return NEXT;
+            if (storage.get_available_space(true) < entry.size + current.min_free_bytes) return STOP;
+            if (!claim(entry.path)) return NEXT;
+            bool moved = migrate(entry, current);
+            unclaim();
+            if (moved) fast_free += entry.size;
+            return NEXT; // Same recording, now on the bulk tier
+        });
+    }
+
+    RecordingUsage usage = catalog.usage();
+    auto remove_entry = [&](const Entry& entry) {
+        if (!claim(entry.path)) return false;
+        bool removed = evict(entry, current);
+        unclaim();
+        if (!removed) return false;
+        usage.cameras[entry.camera] -= entry.size;
+        usage.total -= entry.size;
+        return true;
+    };
+
+    // 1. Per camera quotas (files in the root only count globally)
+    const auto cameras = usage.cameras;
+    for (const auto& [camera, used] : cameras) {
+        auto quota = current.camera_quotas.find(camera);
+        uint64_t limit = quota != current.camera_quotas.end() ? quota->second : current.camera_quota_bytes;
+        if (camera.empty() || limit == 0 || used <= limit) continue;
+        walk_oldest(camera, [&](const Entry& entry) {
+            if (usage.cameras[camera] <= limit) return STOP;
+            return !entry.live && remove_entry(entry) ? REMOVED : NEXT;
+        });
+    }
+
+    // 2. Global quota and free space, on the disk of each tier
+    uint64_t free_bytes = storage.get_available_space();
+    uint64_t bulk_free = tiered ? storage.get_available_space(true) : 0;
+    walk_oldest("", [&](const Entry& entry) {
+        bool over_quota = current.global_quota_bytes > 0 && usage.total > current.global_quota_bytes;
+        bool fast_low = free_bytes < current.min_free_bytes;
+        bool bulk_low = tiered && bulk_free < current.min_free_bytes;
+        if (!over_quota && !fast_low && !bulk_low) return STOP;
+        if (entry.live || (!over_quota && !(entry.bulk ? bulk_low : fast_low))) return NEXT;
+        if (!remove_entry(entry)) return NEXT;
+        (entry.bulk ? bulk_free : free_bytes) += entry.size;
+        return REMOVED;
+    });
+
+    // 3. Still critically full: every finished file on this disk goes, however
+    //    recent, before a live recording is stopped
+    free_bytes = storage.get_available_space();
+    if (free_bytes < current.critical_free_bytes) {
+        walk_oldest("", [&](const Entry& entry) {
+            if (free_bytes >= current.critical_free_bytes) return STOP;
+            if (entry.writing || entry.bulk || !remove_entry(entry)) return NEXT;
+            free_bytes += entry.size;
+            return REMOVED;
+        });
+        free_bytes = storage.get_available_space();
+    }
+    bool stopped = false;
+    if (free_bytes < current.critical_free_bytes && stop_oldest) {
+        Logger::error("[Retention] Disk critically full and nothing left to evict: stopping the oldest recording");
+        stopped = stop_oldest();
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    stats.free_bytes = free_bytes;
+    stats.bulk_free_bytes = tiered ? storage.get_available_space(true) : 0;
+    stats.used_bytes = usage.total;
+    if (stopped) stats.stopped_recordings++;
+}
+
+bool RetentionEngine::evict(const Entry& entry, const RetentionPolicy& current) {
+    if (!current.archive_dir.empty()) return archive(entry, current);
+
+    std::error_code ec;
+    if (!fs::remove(entry.path, ec)) {
+        Logger::error("[Retention] Could not delete " + entry.path + (ec ? ": " + ec.message() : ""));
+        return false;
+    }
+    fs::remove(SeekIndexWriter::path_for(entry.path), ec);
+    fs::remove(ChecksumWriter::path_for(entry.path), ec);
+    storage.get_catalog().remove(entry.path);
+    remove_empty_day(entry.path);
+    Logger::info("[Retention] Deleted " + entry.path + " (" + std::to_string(entry.size / (1024 * 1024)) + " MB)");
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stats.evicted_files++;
+        stats.evicted_bytes += entry.size;
+    }
+    sleep_for(std::chrono::milliseconds(DELETE_PAUSE_MS));
+    return true;
+}
+
+// Drops a day folder once its last recording is gone (fails harmlessly otherwise)
+void RetentionEngine::remove_empty_day(const std::string& path) {
+    fs::path folder = fs::path(path).parent_path();
+    std::error_code ec;
+    if (VideoStorage::is_day_folder(folder.filename().string())) fs::remove(folder, ec);
+}
+
+// Copies source to target through target.part at io_bytes_per_sec at most,
+// flushes it to disk, reads it back and only renames it into place when size
+// and CRC32C match what was read from the source
+bool RetentionEngine::copy_verified(const std::string& source, const fs::path& target, uint64_t size,
+                                    const RetentionPolicy& current) {
+    std::string partial = target.string() + ".part";
+    std::error_code ec;
+    fs::create_directories(target.parent_path(), ec);
+
+    FILE* in = fopen(source.c_str(), "rb");
+    FILE* out = in ? fopen(partial.c_str(), "wb") : nullptr;
+    if (!in || !out) {
+        if (in) fclose(in);
+        Logger::error("[Retention] Could not copy " + source + " to " + target.parent_path().string());
+        return false;
+    }
+
+    std::vector<char> chunk(1024 * 1024);
+    uint64_t copied = 0;
+    auto started = std::chrono::steady_clock::now();
+    // Stay at or below io_bytes_per_sec so live recordings keep their bandwidth
+    auto throttle = [&]() {
+        if (current.io_bytes_per_sec == 0) return true;
+        auto due = started + std::chrono::milliseconds(copied * 1000 / current.io_bytes_per_sec);
+        if (due <= std::chrono::steady_clock::now()) return true;
+        return sleep_for(std::chrono::duration_cast<std::chrono::milliseconds>(due - std::chrono::steady_clock::now()));
+    };
+
+    uint32_t source_crc = 0;
+    bool ok = true;
+    while (ok) {
+        size_t n = fread(chunk.data(), 1, chunk.size(), in);
+        if (n == 0) break;
+        source_crc = crc32c(source_crc, chunk.data(), n);
+        ok = fwrite(chunk.data(), 1, n, out) == n;
+        copied += n;
+        if (!throttle()) ok = false; // Shutting down
+    }
+    ok = ok && !ferror(in) && fflush(out) == 0;
+    fclose(in);
+#ifndef _WIN32
+    ok = ok && fsync(fileno(out)) == 0;
+#ifdef __linux__
+    // Drop the cached pages so the check below reads what reached the disk
+    posix_fadvise(fileno(out), 0, 0, POSIX_FADV_DONTNEED);
+#endif
+#endif
+    ok = fclose(out) == 0 && ok;
+    ok = ok && fs::file_size(partial, ec) == size && !ec;
+
+    if (ok) {
+        FILE* check = fopen(partial.c_str(), "rb");
+        uint32_t target_crc = 0;
+        ok = check != nullptr;
+        while (ok) {
+            size_t n = fread(chunk.data(), 1, chunk.size(), check);
+            if (n == 0) break;
+            target_crc = crc32c(target_crc, chunk.data(), n);
+            copied += n;
+            if (!throttle()) ok = false;
+        }
+        if (check) {
+            ok = ok && !ferror(check);
+            fclose(check);
+        }
+        if (ok && target_crc != source_crc) {
+            Logger::error("[Retention] Copy of " + source + " does not match the original");
+            ok = false;
+        }
+    }
+
+    if (ok) fs::rename(partial, target, ec);
+    if (!ok || ec) {
+        fs::remove(partial, ec);
+        if (!quit) Logger::error("[Retention] Copy of " + source + " failed");
+        return false;
+    }
+    return true;
+}
+
+// The index and checksums are small: copied as is, so the recording stays
+// seekable and verifiable
+static void move_sidecars(const std::string& video, const std::string& target_video) {
+    std::error_code ec;
+    for (auto path_for : {SeekIndexWriter::path_for, ChecksumWriter::path_for}) {
+        std::string sidecar = path_for(video);
+        if (fs::exists(sidecar, ec)) {
+            fs::copy_file(sidecar, path_for(target_video), fs::copy_options::overwrite_existing, ec);
+            fs::remove(sidecar, ec);
+        }
+    }
+}
+
+// Verified copy to archive_dir/<camera>/<day>/ before the source goes
+bool RetentionEngine::archive(const Entry& entry, const RetentionPolicy& current) {
+    fs::path relative = fs::path(storage.relative_path(entry.path)).parent_path();
+    fs::path folder = fs::path(current.archive_dir) / (relative.empty() ? fs::path("unknown") : relative);
+    fs::path target = folder / fs::path(entry.path).filename();
+    if (!copy_verified(entry.path, target, entry.size, current)) return false;
+
+    std::error_code ec;
+    if (!fs::remove(entry.path, ec)) {
+        Logger::error("[Retention] Could not move " + entry.path + " to the archive");
+        return false;
+    }
+    move_sidecars(entry.path, target.string());
+    storage.get_catalog().remove(entry.path);
+    remove_empty_day(entry.path);
+
+    Logger::info("[Retention] Archived " + entry.path + " to " + target.string());
+    std::lock_guard<std::mutex> lock(mutex);
+    stats.evicted_files++;
+    stats.evicted_bytes += entry.size;
+    return true;
+}
+
+// Fast tier -> bulk tier, same relative path. The catalog switches to the
+// copy before the original goes, so the recording never disappears from it.
+bool RetentionEngine::migrate(const Entry& entry, const RetentionPolicy& current) {
+    std::string target = storage.bulk_path_for(entry.path);
+    if (target.empty() || !copy_verified(entry.path, target, entry.size, current)) return false;
+
+    move_sidecars(entry.path, target);
+    storage.get_catalog().update(target);
+    std::error_code ec;
+    if (!fs::remove(entry.path, ec)) {
+        Logger::error("[Retention] Moved " + entry.path + " to the bulk tier but could not delete it");
+    }
+    storage.get_catalog().remove(entry.path);
+    remove_empty_day(entry.path);
+
+    Logger::info("[Retention] Moved " + entry.path + " to " + target + " (" +
+                 std::to_string(entry.size / (1024 * 1024)) + " MB)");
+    std::lock_guard<std::mutex> lock(mutex);
+    stats.migrated_files++;
+    stats.migrated_bytes += entry.size;
+    return true;
+}
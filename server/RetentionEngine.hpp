@@ -0,0 +1,114 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include "VideoStorage.hpp"
+
+struct RetentionPolicy {
+    uint64_t min_free_bytes = 2ULL * 1024 * 1024 * 1024;  // Evict finalized recordings below this
+    uint64_t critical_free_bytes = 500ULL * 1024 * 1024;  // Last resort: stop a live recording
+    uint64_t global_quota_bytes = 0;                      // All recordings; 0 = no limit
+    uint64_t camera_quota_bytes = 0;                      // Default per camera; 0 = no limit
+    std::map<std::string, uint64_t> camera_quotas;        // Per camera overrides
+    std::string archive_dir;                              // Move evicted files here (another disk, outside
+                                                          // the storage folder); empty = delete
+    uint64_t io_bytes_per_sec = 50ULL * 1024 * 1024;      // Archive and bulk tier copy throttle
+    int64_t migrate_after_sec = 10 * 60;                  // Finalized recordings untouched this long move to
+                                                          // the bulk tier (VideoStorage::set_bulk_dir())
+};
+
+// Keeps the recording disk within its quotas so recording can run
+// indefinitely. A background thread evicts (deletes or archives) the oldest
+// finalized recordings, per camera first, then globally, going by the
+// RecordingCatalog (sizes and order without walking the disk), and only asks the
+// engine to stop a live recording when nothing finalized is left and the disk
+// is still critically full. With a bulk tier, finalized recordings are first
+// moved off the fast disk (verified copy), and each tier is kept within
+// min_free_bytes on its own disk.
+class RetentionEngine {
+public:
+    static constexpr int CHECK_INTERVAL_SEC = 10;
+    static constexpr int LIVE_STALE_SEC = 600;   // A "live" file untouched this long was abandoned
+    static constexpr int RECENT_SEC = 60;        // Files written this recently are left alone (e.g. remux output)
+    static constexpr int DELETE_PAUSE_MS = 100;  // Spreads unlinks of large files
+    static constexpr size_t PAGE_SIZE = 256;     // Catalog entries per query while walking
+
+    struct Stats {
+        uint64_t free_bytes;
+        uint64_t bulk_free_bytes; // 0 without a bulk tier
+        uint64_t used_bytes;
+        uint64_t evicted_files;
+        uint64_t evicted_bytes;
+        uint64_t stopped_recordings;
+        uint64_t migrated_files;  // To the bulk tier
+        uint64_t migrated_bytes;
+    };
+
+    RetentionEngine(VideoStorage& storage);
+    ~RetentionEngine();
+
+    // stop_oldest_recording stops one live recording (gracefully) and returns
+    // false if there was none. Called from the retention thread.
+    void start(std::function<bool()> stop_oldest_recording);
+    void stop(); // Joins the thread; also done by the destructor
+    void set_policy(const RetentionPolicy& policy);
+
+    // Files being written are never evicted (any thread, cheap)
+    void mark_live(const std::string& path);
+    void mark_closed(const std::string& path);
+
+    // A finalized file in use elsewhere (e.g. being transcoded) is neither
+    // evicted nor moved until released. hold() fails while retention is
+    // deleting, archiving or moving that very file, or someone else holds it.
+    bool hold(const std::string& path);
+    void release(const std::string& path);
+
+    Stats get_stats();
+
+private:
+    struct Entry {
+        std::string path;
+        std::string camera;
+        uint64_t size;
+        int64_t start; // Seconds
+        int64_t mtime;
+        bool live;    // Being written, or written within RECENT_SEC
+        bool writing; // Being written
+        bool bulk;
+    };
+
+    VideoStorage& storage;
+    RetentionPolicy policy;
+    std::function<bool()> stop_oldest;
+    std::set<std::string> live_files;
+    std::set<std::string> held_files;
+    std::string busy_file; // Being evicted or moved right now
+    Stats stats = {};
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::atomic<bool> quit{false};
+    std::thread thread;
+
+    void run();
+    void enforce();
+    enum Step { NEXT, REMOVED, STOP }; // REMOVED: the recording left the catalog
+    void walk_oldest(const std::string& camera, const std::function<Step(const Entry&)>& visit);
+    bool evict(const Entry& entry, const RetentionPolicy& current);
+    bool archive(const Entry& entry, const RetentionPolicy& current);
+    bool migrate(const Entry& entry, const RetentionPolicy& current);
+    bool copy_verified(const std::string& source, const std::filesystem::path& target, uint64_t size,
+                       const RetentionPolicy& current);
+    void remove_empty_day(const std::string& path);
+    bool claim(const std::string& path); // false if held
+    void unclaim();
+    bool sleep_for(std::chrono::milliseconds duration); // false on shutdown
+};
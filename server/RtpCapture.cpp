@@ -0,0 +1,295 @@
+#include "RtpCapture.hpp"
+#include <gst/app/gstappsrc.h>
+#include <filesystem>
+#include <chrono>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include "Checksum.hpp"
+#include "Logger.hpp"
+#include "SeekIndex.hpp"
+#include "VideoStorage.hpp"
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+namespace fs = std::filesystem;
+
+static constexpr uint32_t MAX_RTP_PACKET = 65535;
+
+RtpCapture::RtpCapture(const std::string& filename) : filename(filename) {}
+
+RtpCapture::~RtpCapture() {
+    close();
+}
+
+bool RtpCapture::open() {
+    file = fopen(filename.c_str(), "wb");
+    if (!file) {
+        Logger::error("[RtpCapture] Cannot create " + filename);
+        return false;
+    }
+    // Packets are ~1.4 KB; let stdio batch them into large writes
+    setvbuf(file, nullptr, _IOFBF, 1024 * 1024);
+    fwrite(MAGIC, 1, 8, file);
+    closing = false;
+    writer = std::thread(&RtpCapture::write_loop, this);
+    return true;
+}
+
+void RtpCapture::close() {
+    if (!file) return;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        closing = true;
+    }
+    cond.notify_all();
+    if (writer.joinable()) writer.join();
+    if (dropped_packets > 0) {
+        Logger::error("[RtpCapture] " + std::to_string(dropped_packets) + " packet(s) dropped, disk too slow: " +
+                      filename);
+    }
+    fclose(file);
+    file = nullptr;
+}
+
+// Runs on the ingest's receive thread: a ref and a queue push per packet
+void RtpCapture::on_rtp(GstBuffer* buffer) {
+    if (!file || write_failed) return;
+
+    gsize size = gst_buffer_get_size(buffer);
+    bool first_drop = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (queued_bytes + size > MAX_QUEUED_BYTES) {
+            first_drop = dropped_packets++ == 0;
+        } else {
+            queue.push_back(gst_buffer_ref(buffer));
+            queued_bytes += size;
+        }
+    }
+    if (first_drop) Logger::error("[RtpCapture] Writer behind, dropping packets: " + filename);
+    else cond.notify_one();
+}
+
+void RtpCapture::write_loop() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        cond.wait(lock, [this]() { return closing || !queue.empty(); });
+        if (queue.empty()) return; // Closing, all written
+
+        std::deque<GstBuffer*> batch;
+        batch.swap(queue);
+        lock.unlock();
+        size_t written = 0;
+        for (GstBuffer* buffer : batch) {
+            written += gst_buffer_get_size(buffer);
+            write_packet(buffer);
+            gst_buffer_unref(buffer);
+        }
+        lock.lock();
+        queued_bytes -= written;
+    }
+}
+
+void RtpCapture::write_packet(GstBuffer* buffer) {
+    if (write_failed) return;
+
+    GstMapInfo map;
+    if (!gst_buffer_map(buffer, &map, GST_MAP_READ)) return;
+    uint64_t pts = GST_BUFFER_PTS(buffer);
+    uint32_t length = static_cast<uint32_t>(map.size);
+    bool ok = fwrite(&pts, sizeof(pts), 1, file) == 1 &&
+              fwrite(&length, sizeof(length), 1, file) == 1 &&
+              fwrite(map.data, 1, length, file) == length;
+    gst_buffer_unmap(buffer, &map);
+
+    if (!ok) {
+        write_failed = true;
+        Logger::error("[RtpCapture] Write failed, capture truncated: " + filename);
+    }
+}
+
+bool RtpCapture::remux(const std::string& capture_file, const std::string& output_file,
+                       const std::atomic<bool>* abort) {
+    FILE* in = fopen(capture_file.c_str(), "rb");
+    if (!in) return false;
+    char magic[8];
+    if (fread(magic, 1, 8, in) != 8 || memcmp(magic, MAGIC, 8) != 0) {
+        Logger::error("[RtpCapture] Not a capture file: " + capture_file);
+        fclose(in);
+        return false;
+    }
+
+    std::string pipeline_str =
+        "appsrc name=src format=time block=true max-bytes=4194304 "
+        "caps=\"application/x-rtp, media=video, clock-rate=90000, encoding-name=H264, payload=96\" ! "
+        "rtph264depay ! h264parse ! matroskamux ! filesink name=sink";
+
+    GError* error = nullptr;
+    GstElement* pipeline = gst_parse_launch(pipeline_str.c_str(), &error);
+    if (error) {
+        Logger::error(std::string("[RtpCapture] Pipeline error: ") + error->message);
+        g_error_free(error);
+        if (pipeline) gst_object_unref(pipeline);
+        fclose(in);
+        return false;
+    }
+
+    GstElement* sink = gst_bin_get_by_name(GST_BIN(pipeline), "sink");
+    g_object_set(sink, "location", output_file.c_str(), nullptr);
+    // Session details from the storage layout: <camera>/<day>/<YYYY-MM-DD_HH-MM-SS_>doctor.mkv
+    fs::path output_path(output_file);
+    std::string stem = output_path.stem().string();
+    fs::path folder = output_path.parent_path();
+    if (VideoStorage::is_day_folder(folder.filename().string())) folder = folder.parent_path();
+    SeekIndexInfo info = {stem.size() > 20 ? stem.substr(20) : stem, folder.filename().string()};
+    SeekIndexWriter::attach(sink, [info]() { return info; });
+    ChecksumWriter::attach(sink);
+    gst_object_unref(sink);
+    GstElement* appsrc = gst_bin_get_by_name(GST_BIN(pipeline), "src");
+    gst_element_set_state(pipeline, GST_STATE_PLAYING);
+
+    // Not live and filesink does not sync: runs as fast as the CPU allows,
+    // throttled by appsrc blocking on max-bytes
+    GstClockTime first_pts = GST_CLOCK_TIME_NONE;
+    uint64_t pts;
+    uint32_t length;
+    bool flowing = true;
+    while (flowing && !(abort && *abort) &&
+           fread(&pts, sizeof(pts), 1, in) == 1 && fread(&length, sizeof(length), 1, in) == 1) {
+        if (length > MAX_RTP_PACKET) break; // Corrupt record; keep what we have
+
+        GstBuffer* buffer = gst_buffer_new_allocate(nullptr, length, nullptr);
+        GstMapInfo map;
+        gst_buffer_map(buffer, &map, GST_MAP_WRITE);
+        size_t got = fread(map.data, 1, length, in);
+        gst_buffer_unmap(buffer, &map);
+        if (got != length) { // Truncated tail
+            gst_buffer_unref(buffer);
+            break;
+        }
+
+        if (pts != GST_CLOCK_TIME_NONE) {
+            if (first_pts == GST_CLOCK_TIME_NONE) first_pts = pts;
+            GST_BUFFER_PTS(buffer) = pts > first_pts ? pts - first_pts : 0;
+        }
+        flowing = gst_app_src_push_buffer(GST_APP_SRC(appsrc), buffer) == GST_FLOW_OK;
+    }
+    fclose(in);
+
+    bool aborted = abort && *abort;
+    gst_app_src_end_of_stream(GST_APP_SRC(appsrc));
+    gst_object_unref(appsrc);
+
+    // Wait for matroskamux to write cues and duration; a shutdown does not
+    // wait for it
+    GstBus* bus = gst_element_get_bus(pipeline);
+    GstMessage* msg = nullptr;
+    while (!msg && !(abort && *abort)) {
+        msg = gst_bus_timed_pop_filtered(bus, GST_SECOND, (GstMessageType)(GST_MESSAGE_EOS | GST_MESSAGE_ERROR));
+    }
+    aborted = aborted || (abort && *abort);
+    bool ok = !aborted && msg && GST_MESSAGE_TYPE(msg) == GST_MESSAGE_EOS;
+    if (msg && GST_MESSAGE_TYPE(msg) == GST_MESSAGE_ERROR) {
+        GError* err = nullptr;
+        gst_message_parse_error(msg, &err, nullptr);
+        Logger::error("[RtpCapture] Remux of " + capture_file + " failed: " + err->message);
+        g_error_free(err);
+    }
+    if (msg) gst_message_unref(msg);
+    gst_object_unref(bus);
+
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+    gst_object_unref(pipeline);
+    return ok;
+}
+
+CaptureRemuxer::CaptureRemuxer() {
+    thread = std::thread(&CaptureRemuxer::run, this);
+}
+
+CaptureRemuxer::~CaptureRemuxer() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        quit = true;
+    }
+    cond.notify_all();
+    if (thread.joinable()) thread.join();
+}
+
+void CaptureRemuxer::enqueue(const std::string& capture_file) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        jobs.push_back(capture_file);
+    }
+    cond.notify_all();
+}
+
+size_t CaptureRemuxer::pending() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return jobs.size();
+}
+
+bool CaptureRemuxer::wait_for_idle() {
+    std::unique_lock<std::mutex> lock(mutex);
+#ifndef _WIN32
+    double cores = std::max(1u, std::thread::hardware_concurrency());
+    double load = 0;
+    while (!quit && getloadavg(&load, 1) == 1 && load >= IDLE_LOAD * cores) {
+        cond.wait_for(lock, std::chrono::seconds(IDLE_POLL_SEC));
+    }
+#endif
+    return !quit;
+}
+
+void CaptureRemuxer::run() {
+#ifndef _WIN32
+    // On Linux this lowers only this thread; the remux pipeline's streaming
+    // threads are created from here and inherit it
+    setpriority(PRIO_PROCESS, 0, 19);
+#endif
+    while (true) {
+        std::string capture;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cond.wait(lock, [this]() { return quit || !jobs.empty(); });
+            if (quit) return;
+            capture = jobs.front();
+        }
+        if (!wait_for_idle()) return;
+
+        fs::path base = fs::path(capture).replace_extension();
+        std::string output = VideoStorage::create_exclusive(base.string(), ".mkv");
+        if (output.empty()) {
+            // Picked up again at the next start
+            Logger::error("[CaptureRemuxer] No output for " + capture + ", capture kept");
+            std::lock_guard<std::mutex> lock(mutex);
+            jobs.pop_front();
+            continue;
+        }
+
+        auto started = std::chrono::steady_clock::now();
+        if (RtpCapture::remux(capture, output, &quit)) {
+            std::error_code ec;
+            fs::remove(capture, ec);
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+            std::stringstream ss;
+            ss << "[CaptureRemuxer] " << output << " ready (" << std::fixed << std::setprecision(1) << seconds << " s)";
+            Logger::info(ss.str());
+        } else {
+            // Keep the capture for another try; drop the partial output
+            std::error_code ec;
+            fs::remove(output, ec);
+            fs::remove(SeekIndexWriter::path_for(output), ec);
+            fs::remove(ChecksumWriter::path_for(output), ec);
+            if (!quit) Logger::error("[CaptureRemuxer] Could not remux " + capture + ", capture kept");
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        jobs.pop_front();
+    }
+}
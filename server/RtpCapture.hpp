@@ -0,0 +1,82 @@
+#pragma once
+#include <gst/gst.h>
+#include <string>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cstdio>
+#include <cstdint>
+#include "IngestPipeline.hpp"
+
+// Raw recording mode: the camera's RTP packets are appended to a capture file
+// as they arrive, with no depayloading, parsing or muxing on the recording
+// path. File layout (host byte order):
+//   "RTPCAP01" then per packet: uint64 pts (ns) | uint32 length | RTP packet
+// A truncated last record (power loss) is ignored by remux().
+// The ingest's receive thread only queues a ref of each packet; a writer
+// thread per capture does the file writes. Past MAX_QUEUED_BYTES (the disk
+// not keeping up) packets are dropped rather than holding up the ingest.
+class RtpCapture : public RtpListener {
+public:
+    static constexpr char MAGIC[9] = "RTPCAP01";
+    static constexpr const char* EXTENSION = ".rtpcap";
+    static constexpr size_t MAX_QUEUED_BYTES = 16 * 1024 * 1024; // ~13 s at 10 Mbit/s
+
+    explicit RtpCapture(const std::string& filename);
+    ~RtpCapture() override;
+
+    bool open();
+    void close(); // Writes out what is queued first
+    void on_rtp(GstBuffer* buffer) override;
+
+    const std::string& get_filename() const { return filename; }
+
+    // Converts a capture into a Matroska file:
+    //   appsrc ! rtph264depay ! h264parse ! matroskamux ! filesink
+    // Blocking; runs at the caller's priority and gives up once *abort is set.
+    static bool remux(const std::string& capture_file, const std::string& output_file,
+                      const std::atomic<bool>* abort = nullptr);
+
+private:
+    std::string filename;
+    FILE* file = nullptr;
+    std::atomic<bool> write_failed{false};
+
+    std::deque<GstBuffer*> queue; // Refs, oldest first
+    size_t queued_bytes = 0;      // Queued or being written
+    uint64_t dropped_packets = 0;
+    bool closing = false;
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::thread writer;
+
+    void write_loop();
+    void write_packet(GstBuffer* buffer); // Writer thread
+};
+
+// Background remux of finished captures. Jobs wait until the CPU is idle
+// (load average below IDLE_LOAD per core) and run on a lowest-priority
+// thread; the capture is deleted once its .mkv is complete.
+class CaptureRemuxer {
+public:
+    static constexpr double IDLE_LOAD = 0.5;
+    static constexpr int IDLE_POLL_SEC = 5;
+
+    CaptureRemuxer();
+    ~CaptureRemuxer();
+
+    void enqueue(const std::string& capture_file);
+    size_t pending();
+
+private:
+    std::deque<std::string> jobs;
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::atomic<bool> quit{false}; // Also aborts a running remux
+    std::thread thread;
+
+    void run();
+    bool wait_for_idle(); // false on shutdown
+};
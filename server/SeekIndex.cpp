@@ -0,0 +1,237 @@
+#include "SeekIndex.hpp"
+#include <algorithm>
+#include <cstring>
+#include <ctime>
+#include <chrono>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#include "Logger.hpp"
+
+namespace {
+
+struct Header {
+    char magic[8];
+    uint32_t header_size;
+    uint32_t entry_size;
+    int64_t created_ms;
+    char doctor[SeekIndexWriter::NAME_SIZE];
+    char camera[SeekIndexWriter::NAME_SIZE];
+};
+static_assert(sizeof(Header) <= SeekIndexWriter::HEADER_SIZE, "index header too large");
+static_assert(sizeof(SeekIndexEntry) == 16, "index entry layout");
+
+// Per sink state of SeekIndexWriter::attach()
+struct SinkIndexer {
+    GstElement* sink; // Not owned: the probe goes away with the sink's pad
+    std::function<SeekIndexInfo()> describe;
+    SeekIndexWriter writer;
+    bool opened = false;  // Tried for the current file
+    uint64_t position = 0;
+    GstClockTime first_pts = GST_CLOCK_TIME_NONE;
+    // Candidate entry: matroskamux flags a cluster header like the block that
+    // follows it, so a key frame is only committed once the next timestamp
+    // shows no delta block shared its time
+    bool have_candidate = false;
+    SeekIndexEntry candidate = {};
+};
+
+void commit_candidate(SinkIndexer* indexer) {
+    if (!indexer->have_candidate) return;
+    indexer->have_candidate = false;
+    if (!GST_CLOCK_TIME_IS_VALID(indexer->first_pts)) indexer->first_pts = indexer->candidate.pts;
+    if (indexer->candidate.pts < indexer->first_pts) return;
+    indexer->writer.append(indexer->candidate.pts - indexer->first_pts, indexer->candidate.offset);
+}
+
+void copy_name(char* out, const std::string& name) {
+    strncpy(out, name.c_str(), SeekIndexWriter::NAME_SIZE - 1);
+}
+
+} // namespace
+
+SeekIndexWriter::~SeekIndexWriter() {
+    close();
+}
+
+bool SeekIndexWriter::open(const std::string& video_file, const SeekIndexInfo& info) {
+    close();
+    std::string path = path_for(video_file);
+    file = fopen(path.c_str(), "wb");
+    if (!file) {
+        Logger::error("[SeekIndex] Could not create " + path);
+        return false;
+    }
+
+    char block[HEADER_SIZE] = {0};
+    Header header = {};
+    memcpy(header.magic, MAGIC, 8);
+    header.header_size = HEADER_SIZE;
+    header.entry_size = sizeof(SeekIndexEntry);
+    header.created_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    copy_name(header.doctor, info.doctor);
+    copy_name(header.camera, info.camera);
+    memcpy(block, &header, sizeof(header));
+    if (fwrite(block, 1, HEADER_SIZE, file) != HEADER_SIZE || fflush(file) != 0) {
+        Logger::error("[SeekIndex] Could not write " + path);
+        fclose(file);
+        file = nullptr;
+        return false;
+    }
+    return true;
+}
+
+// Unbuffered on purpose: one entry per GOP, and each should reach the file
+// as soon as its keyframe has been handed to the sink
+void SeekIndexWriter::append(uint64_t pts, uint64_t offset) {
+    if (!file) return;
+    SeekIndexEntry entry = {pts, offset};
+    fwrite(&entry, sizeof(entry), 1, file);
+    fflush(file);
+}
+
+void SeekIndexWriter::close() {
+    if (!file) return;
+    fflush(file);
+#ifndef _WIN32
+    fsync(fileno(file));
+#endif
+    fclose(file);
+    file = nullptr;
+}
+
+void SeekIndexWriter::attach(GstElement* sink, std::function<SeekIndexInfo()> describe) {
+    GstPad* pad = gst_element_get_static_pad(sink, "sink");
+    if (!pad) return;
+    SinkIndexer* indexer = new SinkIndexer{sink, std::move(describe)};
+    gst_pad_add_probe(pad, static_cast<GstPadProbeType>(GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM),
+                      sink_probe, indexer, [](gpointer data) { delete static_cast<SinkIndexer*>(data); });
+    gst_object_unref(pad);
+}
+
+GstPadProbeReturn SeekIndexWriter::sink_probe(GstPad*, GstPadProbeInfo* info, gpointer user_data) {
+    SinkIndexer* indexer = static_cast<SinkIndexer*>(user_data);
+
+    if (GST_PAD_PROBE_INFO_TYPE(info) & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM) {
+        GstEvent* event = GST_PAD_PROBE_INFO_EVENT(info);
+        if (GST_EVENT_TYPE(event) == GST_EVENT_SEGMENT) {
+            const GstSegment* segment;
+            gst_event_parse_segment(event, &segment);
+            if (segment->format == GST_FORMAT_BYTES) indexer->position = segment->start;
+        } else if (GST_EVENT_TYPE(event) == GST_EVENT_EOS) {
+            commit_candidate(indexer);
+            indexer->writer.close();
+            indexer->opened = false;
+        }
+        return GST_PAD_PROBE_OK;
+    }
+
+    GstBuffer* buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    if (!indexer->opened) {
+        indexer->opened = true;
+        indexer->position = 0;
+        indexer->first_pts = GST_CLOCK_TIME_NONE;
+        indexer->have_candidate = false;
+        gchar* location = nullptr;
+        g_object_get(indexer->sink, "location", &location, nullptr);
+        if (location) indexer->writer.open(location, indexer->describe());
+        g_free(location);
+    }
+
+    GstClockTime pts = GST_BUFFER_PTS(buffer);
+    if (indexer->writer.is_open() && GST_CLOCK_TIME_IS_VALID(pts) &&
+        !GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_HEADER)) {
+        bool keyframe = !GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT);
+        if (indexer->have_candidate && pts != indexer->candidate.pts) commit_candidate(indexer);
+        if (keyframe && !indexer->have_candidate) {
+            indexer->candidate = {pts, indexer->position};
+            indexer->have_candidate = true;
+        } else if (!keyframe && indexer->have_candidate) {
+            indexer->have_candidate = false; // A cluster opened on a delta frame
+        }
+    }
+    indexer->position += gst_buffer_get_size(buffer);
+    return GST_PAD_PROBE_OK;
+}
+
+SeekIndex::~SeekIndex() {
+#ifndef _WIN32
+    if (map) munmap(map, map_size);
+#endif
+}
+
+bool SeekIndex::open(const std::string& index_file) {
+    Header header = {};
+    const char* data = nullptr;
+    size_t size = 0;
+
+#ifndef _WIN32
+    int fd = ::open(index_file.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < SeekIndexWriter::HEADER_SIZE) {
+        ::close(fd);
+        return false;
+    }
+    map_size = st.st_size;
+    map = mmap(nullptr, map_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED) {
+        map = nullptr;
+        return false;
+    }
+    data = static_cast<const char*>(map);
+    size = map_size;
+#else
+    FILE* file = fopen(index_file.c_str(), "rb");
+    if (!file) return false;
+    std::vector<char> raw;
+    char chunk[64 * 1024];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), file)) > 0) raw.insert(raw.end(), chunk, chunk + n);
+    fclose(file);
+    data = raw.data();
+    size = raw.size();
+    if (size < SeekIndexWriter::HEADER_SIZE) return false;
+#endif
+
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.magic, SeekIndexWriter::MAGIC, 8) != 0 || header.header_size < sizeof(Header) ||
+        header.header_size > size || header.entry_size != sizeof(SeekIndexEntry)) {
+        Logger::error("[SeekIndex] Not an index: " + index_file);
+        return false;
+    }
+    header.doctor[SeekIndexWriter::NAME_SIZE - 1] = '\0';
+    header.camera[SeekIndexWriter::NAME_SIZE - 1] = '\0';
+    meta = {header.doctor, header.camera};
+    created = header.created_ms;
+
+    // A torn last entry is left out
+    count = (size - header.header_size) / sizeof(SeekIndexEntry);
+#ifndef _WIN32
+    entries = reinterpret_cast<const SeekIndexEntry*>(data + header.header_size);
+#else
+    copy.resize(count);
+    memcpy(copy.data(), data + header.header_size, count * sizeof(SeekIndexEntry));
+    entries = copy.data();
+#endif
+    return true;
+}
+
+void SeekIndex::limit_to(uint64_t video_size) {
+    const SeekIndexEntry* end = std::lower_bound(entries, entries + count, video_size,
+        [](const SeekIndexEntry& entry, uint64_t size) { return entry.offset < size; });
+    count = end - entries;
+}
+
+bool SeekIndex::find(uint64_t pts, SeekIndexEntry& out) const {
+    if (count == 0) return false;
+    const SeekIndexEntry* it = std::upper_bound(entries, entries + count, pts,
+        [](uint64_t value, const SeekIndexEntry& entry) { return value < entry.pts; });
+    out = it == entries ? entries[0] : *(it - 1);
+    return true;
+}
@@ -0,0 +1,89 @@
+#pragma once
+#include <gst/gst.h>
+#include <string>
+#include <vector>
+#include <functional>
+#include <cstdio>
+#include <cstdint>
+
+// Keyframe index kept next to every recording (<recording>.idx), so players
+// can seek by time without scanning the Matroska file. File layout (host byte
+// order):
+//   Header (HEADER_SIZE bytes): "MKVIDX01" | uint32 header size | uint32 entry
+//     size | int64 created (unix ms) | char doctor[64] | char camera[64] | zeros
+//   Entries, appended as the recording progresses: uint64 pts (ns, from the
+//     first keyframe of the file) | uint64 byte offset of the keyframe's block
+// A truncated last entry (power loss) is ignored by SeekIndex.
+struct SeekIndexEntry {
+    uint64_t pts;
+    uint64_t offset;
+};
+
+struct SeekIndexInfo {
+    std::string doctor;
+    std::string camera;
+};
+
+// Appends to an index; one small write per keyframe, fsynced on close
+class SeekIndexWriter {
+public:
+    static constexpr char MAGIC[9] = "MKVIDX01";
+    static constexpr size_t HEADER_SIZE = 256;
+    static constexpr size_t NAME_SIZE = 64;
+
+    ~SeekIndexWriter();
+
+    bool open(const std::string& video_file, const SeekIndexInfo& info);
+    void append(uint64_t pts, uint64_t offset);
+    void close();
+    bool is_open() const { return file != nullptr; }
+
+    static std::string path_for(const std::string& video_file) { return video_file + ".idx"; }
+
+    // Indexes everything written through a file sink (filesink, recordsink):
+    // follows its byte segments to know each buffer's offset and records the
+    // timestamped non-delta buffers, which are the muxer's keyframe blocks. A
+    // new index is opened from the sink's "location" on the first buffer after
+    // each EOS (splitmuxsink fragments); describe() is called at that point.
+    static void attach(GstElement* sink, std::function<SeekIndexInfo()> describe);
+
+private:
+    FILE* file = nullptr;
+
+    static GstPadProbeReturn sink_probe(GstPad* pad, GstPadProbeInfo* info, gpointer user_data);
+};
+
+// Read-only view of an index, memory-mapped where possible
+class SeekIndex {
+public:
+    SeekIndex() = default;
+    ~SeekIndex();
+    SeekIndex(const SeekIndex&) = delete;
+    SeekIndex& operator=(const SeekIndex&) = delete;
+
+    bool open(const std::string& index_file);
+
+    // Drops entries at or past the end of the recording (the index can be
+    // ahead of the video after a crash)
+    void limit_to(uint64_t video_size);
+
+    size_t size() const { return count; }
+    const SeekIndexEntry& operator[](size_t i) const { return entries[i]; }
+    const SeekIndexInfo& info() const { return meta; }
+    int64_t created_ms() const { return created; }
+
+    // Last keyframe at or before pts (binary search); false if the index is
+    // empty. Times before the first keyframe give the first one.
+    bool find(uint64_t pts, SeekIndexEntry& out) const;
+
+private:
+    const SeekIndexEntry* entries = nullptr;
+    size_t count = 0;
+    SeekIndexInfo meta;
+    int64_t created = 0;
+
+    // Mapping (or a plain copy where mmap is not available)
+    void* map = nullptr;
+    size_t map_size = 0;
+    std::vector<SeekIndexEntry> copy;
+};
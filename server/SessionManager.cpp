@@ -1,5 +1,6 @@
 #include "SessionManager.hpp"
 #include "Logger.hpp"
+#include <algorithm>
 
 SessionManager::SessionManager() : recording_active(false) {}
 
@@ -39,6 +40,16 @@ void SessionManager::register_node(const std::string& id, const std::string& ip)
     Logger::info("[Node] Registered: " + id + " (" + ip + ")");
 }
 
+void SessionManager::unregister_node(const std::string& id) {
+    std::lock_guard<std::mutex> lock(session_mutex);
+    auto it = std::remove_if(observers.begin(), observers.end(),
+                             [&id](const ObserverNode& node) { return node.id == id; });
+    if (it == observers.end()) return;
+
+    observers.erase(it, observers.end());
+    Logger::info("[Node] Unregistered: " + id);
+}
+
 std::vector<ObserverNode> SessionManager::get_active_observers() {
     std::lock_guard<std::mutex> lock(session_mutex);
     return observers; 
@@ -23,6 +23,7 @@ public:
 
     // Node Management
     void register_node(const std::string& id, const std::string& ip);
+    void unregister_node(const std::string& id);
     std::vector<ObserverNode> get_active_observers();
 
 private:
@@ -1,51 +1,88 @@
 #include "StreamEngine.hpp"
 #include <iostream>
+#include <chrono>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <filesystem>
+#include "Checksum.hpp"
 #include "Logger.hpp"
+#include "RecordSink.hpp"
 
-StreamEngine::StreamEngine(VideoStorage& storage) : storage_ref(storage) {}
+StreamEngine::StreamEngine(VideoStorage& storage)
+    : storage_ref(storage), retention(storage), transcoder(storage, retention), recovery(storage, retention) {}
 
 StreamEngine::~StreamEngine() {
     if (loop) g_main_loop_quit(loop);
+    retention.stop(); // It may call back into the engine
     // Clean up any active recordings
-    std::lock_guard<std::mutex> lock(engine_mutex);
-    for (auto const& [doc, pipeline] : active_recorders) {
-        gst_element_set_state(pipeline, GST_STATE_NULL);
-        gst_object_unref(pipeline);
+    {
+        std::unique_lock<std::mutex> lock(engine_mutex);
+        live_cameras.clear(); // Pending pool refills bail out
+        for (auto& [doc, capture] : active_captures) {
+            auto ingest = ingests.find(capture.port);
+            if (ingest != ingests.end()) ingest->second->remove_rtp_listener(capture.file.get());
+        }
+        active_captures.clear(); // Remuxed on the next start
+        for (auto const& [doc, recorder] : active_recorders) destroy_recorder(recorder);
+        for (auto const& [port, pool] : recorder_pool) {
+            for (Recorder* recorder : pool) destroy_recorder(recorder);
+        }
+        ingests.clear();
+        // Stopped recordings get their EOS on the workers; the finalize
+        // timeout bounds the wait
+        recorders_finished.wait_for(lock, std::chrono::milliseconds(FINALIZE_TIMEOUT_MS + 1000),
+                                    [this]() { return stopping_recorders.empty(); });
     }
+    // Joined outside the lock: a worker may be waiting for it
+    workers.clear();
+    // Whatever a stuck worker never got to is torn down unfinished
+    for (Recorder* recorder : stopping_recorders) {
+        Logger::error("[StreamEngine] Not finalized before shutdown: " + recorder->filename);
+        recorder->finalized.set_value(false);
+        destroy_recorder(recorder);
+    }
+    stopping_recorders.clear();
+    if (mcast_pool) g_object_unref(mcast_pool);
 }
 
 void StreamEngine::init() {
     gst_init(nullptr, nullptr);
     loop = g_main_loop_new(nullptr, FALSE);
+    record_sink_available = record_sink_register();
     
     // Create the RTSP Server
     server = gst_rtsp_server_new();
     gst_rtsp_server_set_service(server, "8554"); // Standard RTSP port
+    set_rtsp_threads(std::max(2u, std::thread::hardware_concurrency()));
     
+    // Cameras get their /live/<id> mount from add_camera() once discovered
     mounts = gst_rtsp_server_get_mount_points(server);
-    factory = gst_rtsp_media_factory_new();
-    
-    // THE PIPELINE:
-    // 1. Receives UDP stream from Raspi (port 5000)
-    // 2. Payloads it for RTSP clients
-    // Note: We use 'shared' so multiple clients see the same stream
-    gst_rtsp_media_factory_set_shared(factory, TRUE);
-    
-    // Input: Expecting H264 UDP stream from Pi on Port 5000
-    // Output: RTSP Clients connect to this server
-    std::string launch_cmd = 
-        "( udpsrc port=5000 multicast-group=239.0.0.1 auto-multicast=true buffer-size=10000000 do-timestamp=true ! application/x-rtp, encoding-name=H264, payload=96 ! "
-        "rtph264depay ! h264parse ! rtph264pay name=pay0 pt=96 )";
-        
-    gst_rtsp_media_factory_set_launch(factory, launch_cmd.c_str());
-    
-    // Attach to /live endpoint
-    gst_rtsp_mount_points_add_factory(mounts, "/live", factory);
-    
-    Logger::info("[StreamEngine] RTSP Server ready at rtsp://<server_ip>:8554/live");
+    Logger::info("[StreamEngine] RTSP Server ready at rtsp://<server_ip>:8554/live/<camera_id>");
+    // Recordings get their /vod/... mount when a client first asks for one
+    g_signal_connect(server, "client-connected", G_CALLBACK(client_connected_callback), this);
+
+    // Camera pipelines run on their own worker threads (see get_worker), so
+    // these only ever delay each other and RTSP connection accepts.
+    // Captures left over from the last run (stopped or cut off) are all final now
+    for (const auto& capture : storage_ref.list_captures()) remuxer.enqueue(capture);
+    // Recordings cut off without cues and duration (crash, power cut, quit)
+    // are repaired in the background
+    recovery.start();
 
-    // Check storage every 10 seconds
-    g_timeout_add_seconds(10, (GSourceFunc)check_storage_callback, this);
+    // Quotas and free space are enforced off the main loop
+    retention.start([this]() { return stop_oldest_recording(); });
+    // Aged recordings are re-encoded with whatever CPU live work leaves over
+    transcoder.start([this]() {
+        std::lock_guard<std::mutex> lock(engine_mutex);
+        return active_recorders.size() + active_captures.size();
+    });
+    g_timeout_add_seconds(10, (GSourceFunc)reclaim_hls_callback, this);
+    g_timeout_add_seconds(10, (GSourceFunc)reclaim_vod_callback, this);
+    // Expired RTSP sessions (clients gone without TEARDOWN) release their media
+    g_timeout_add_seconds(2, (GSourceFunc)session_cleanup_callback, this);
 }
 
 void StreamEngine::run() {
@@ -54,85 +91,1049 @@ void StreamEngine::run() {
     g_main_loop_run(loop);
 }
 
-// Independent Recording Pipeline
-// Note: In production, we would use 'interpipes' or 'tee' to record the exact 
-// same buffer as the live stream. For simplicity here, we open a parallel socket listener
-// or assume the Pi sends to a multicast group.
-// 
-// Simplified approach: We spin up a separate GStreamer pipeline that listens 
-// to the SAME UDP port (using multicast) or a separate port if the Pi splits it.
-// Here we assume the Pi sends to a Multicast Address (e.g., 224.1.1.1) so both 
-// the RTSP server and Recorder can read it.
-void StreamEngine::start_recording(const std::string& doctor_name, int port) {
-    std::lock_guard<std::mutex> lock(engine_mutex);
+void StreamEngine::set_rtsp_threads(guint max_threads) {
+    GstRTSPThreadPool* pool = gst_rtsp_server_get_thread_pool(server);
+    gst_rtsp_thread_pool_set_max_threads(pool, max_threads);
+    g_object_unref(pool);
+    Logger::info("[StreamEngine] RTSP thread pool: up to " + std::to_string(max_threads) + " threads");
+}
 
-    // Check for minimum 500MB space
-    if (storage_ref.get_available_space() < 500ULL * 1024 * 1024) {
-        Logger::error("[StreamEngine] Not enough disk space to start recording!");
+void StreamEngine::set_multicast(const std::string& min_address, const std::string& max_address,
+                                 guint16 min_port, guint16 max_port, guint ttl) {
+    std::lock_guard<std::mutex> lock(engine_mutex);
+    GstRTSPAddressPool* pool = gst_rtsp_address_pool_new();
+    if (!gst_rtsp_address_pool_add_range(pool, min_address.c_str(), max_address.c_str(), min_port, max_port, ttl)) {
+        Logger::error("[StreamEngine] Invalid multicast range " + min_address + " - " + max_address);
+        g_object_unref(pool);
         return;
     }
+    if (mcast_pool) g_object_unref(mcast_pool);
+    mcast_pool = pool;
+    mcast_ttl = ttl;
+    Logger::info("[StreamEngine] RTSP multicast on " + min_address + " - " + max_address + ", ports " +
+                 std::to_string(min_port) + "-" + std::to_string(max_port) + ", TTL " + std::to_string(ttl));
+}
 
-    if (active_recorders.find(doctor_name) != active_recorders.end()) {
-        Logger::info("[StreamEngine] Already recording for " + doctor_name);
+void StreamEngine::add_camera(const std::string& camera_id, int port, const IngestOptions& options) {
+    std::lock_guard<std::mutex> lock(engine_mutex);
+    auto it = live_cameras.find(camera_id);
+    bool options_changed = update_ingest_options(port, options);
+    if (it != live_cameras.end() && it->second == port && !options_changed) return;
+    if (it != live_cameras.end() && it->second == port) {
+        // Same mount, new receive mode: rebuild the ingest if nothing is attached
+        auto ingest = ingests.find(port);
+        if (ingest != ingests.end() && ingest->second->consumer_count() == 0) ingests.erase(ingest);
+        else if (ingest != ingests.end()) Logger::info("[StreamEngine] " + camera_id + ": new receive mode applies once the stream is idle");
+        if (preroll_time > 0) acquire_ingest(port);
         return;
     }
 
-    std::string filename = storage_ref.create_filename(doctor_name);
-    Logger::info("[StreamEngine] Recording Port " + std::to_string(port) + " to: " + filename);
+    // Creating the factory is cheap: no pipeline (and no ingest) exists until
+    // the first client asks for the mount, and then it is shared by all clients.
+    GstRTSPMediaFactory* factory = gst_rtsp_media_factory_new();
+    gst_rtsp_media_factory_set_shared(factory, TRUE);
+
+    // Input: appsrc fed by the camera's IngestPipeline (see media_configure_callback)
+    // Output: RTSP Clients connect to this server
+    std::string launch_cmd =
+        "( appsrc name=src is-live=true format=time ! rtph264pay name=pay0 pt=96 config-interval=1 )";
+    gst_rtsp_media_factory_set_launch(factory, launch_cmd.c_str());
+
+    // Multicast clients of the mount share one group (allocated from the pool
+    // when the first of them sets up), so egress no longer grows per viewer.
+    // Clients that cannot join still get unicast UDP or TCP.
+    if (mcast_pool) {
+        gst_rtsp_media_factory_set_address_pool(factory, mcast_pool);
+        gst_rtsp_media_factory_set_max_mcast_ttl(factory, mcast_ttl);
+        gst_rtsp_media_factory_set_protocols(factory, (GstRTSPLowerTrans)(GST_RTSP_LOWER_TRANS_UDP_MCAST |
+                                                                          GST_RTSP_LOWER_TRANS_UDP |
+                                                                          GST_RTSP_LOWER_TRANS_TCP));
+    }
+
+    g_object_set_data(G_OBJECT(factory), "ingest-port", GINT_TO_POINTER(port));
+    g_signal_connect(factory, "media-configure", G_CALLBACK(media_configure_callback), this);
+
+    // Replaces any previous mount (camera re-registered on a new port)
+    std::string path = "/live/" + camera_id;
+    gst_rtsp_mount_points_add_factory(mounts, path.c_str(), factory);
+    int old_port = it != live_cameras.end() ? it->second : -1;
+    if (old_port != -1) drop_hls_packager(camera_id);
+    live_cameras[camera_id] = port;
+    if (old_port != -1) release_ingest(old_port);
+
+    // With pre-roll the ingest runs from registration on, so a recording can
+    // start from the GOP that is already buffered
+    if (preroll_time > 0) acquire_ingest(port);
+
+    // Pre-warm recorder pipelines for this camera
+    if (old_port != -1 && !is_camera_port(old_port)) drain_pool(old_port);
+    schedule_pool_refill(port);
+
+    Logger::info("[StreamEngine] Camera " + camera_id + " (port " + std::to_string(port) +
+                 (options.reliable ? ", reliable" : "") + (mcast_pool ? ", multicast" : "") +
+                 ") at rtsp://<server_ip>:8554" + path);
+}
+
+// Returns true if the port's receive mode changed
+bool StreamEngine::update_ingest_options(int port, const IngestOptions& options) {
+    auto it = ingest_options.find(port);
+    bool changed = it == ingest_options.end()
+        ? options.reliable
+        : it->second.reliable != options.reliable || it->second.sender_ip != options.sender_ip ||
+          it->second.latency_ms != options.latency_ms;
+    ingest_options[port] = options;
+    return changed;
+}
+
+void StreamEngine::remove_camera(const std::string& camera_id) {
+    std::lock_guard<std::mutex> lock(engine_mutex);
+    auto it = live_cameras.find(camera_id);
+    if (it == live_cameras.end()) return;
+
+    // Connected clients keep their media until they disconnect
+    std::string path = "/live/" + camera_id;
+    gst_rtsp_mount_points_remove_factory(mounts, path.c_str());
+    drop_hls_packager(camera_id);
+    int port = it->second;
+    live_cameras.erase(it);
+    release_ingest(port);
+    if (!is_camera_port(port)) drain_pool(port);
+    Logger::info("[StreamEngine] Removed mount " + path);
+}
+
+void StreamEngine::set_preroll(guint max_seconds, size_t max_bytes) {
+    std::lock_guard<std::mutex> lock(engine_mutex);
+    preroll_time = max_seconds * GST_SECOND;
+    preroll_max_bytes = max_bytes;
+}
+
+std::vector<StreamEngine::IngestInfo> StreamEngine::get_ingest_info() {
+    std::lock_guard<std::mutex> lock(engine_mutex);
+    std::vector<IngestInfo> info;
+    for (auto const& [port, ingest] : ingests) {
+        std::string camera_id;
+        for (auto const& [id, camera_port] : live_cameras) {
+            if (camera_port == port) camera_id = id;
+        }
+        info.push_back({port, camera_id, ingest->consumer_count(), ingest->preroll_bytes(), ingest->get_health()});
+    }
+    return info;
+}
+
+std::shared_ptr<HlsPackager> StreamEngine::get_hls_packager(const std::string& camera_id) {
+    std::lock_guard<std::mutex> lock(engine_mutex);
+    auto it = hls_packagers.find(camera_id);
+    if (it != hls_packagers.end()) return it->second;
+
+    auto camera = live_cameras.find(camera_id);
+    if (camera == live_cameras.end()) return nullptr;
+    IngestPipeline* ingest = acquire_ingest(camera->second);
+    if (!ingest) return nullptr;
+
+    // Start from the buffered GOP so the first segment is ready sooner
+    auto packager = std::make_shared<HlsPackager>(camera_id);
+    ingest->add_listener(packager.get(), true);
+    hls_packagers[camera_id] = packager;
+    Logger::info("[StreamEngine] HLS packager started for " + camera_id);
+    return packager;
+}
+
+// Must be called with engine_mutex held
+void StreamEngine::drop_hls_packager(const std::string& camera_id) {
+    auto it = hls_packagers.find(camera_id);
+    if (it == hls_packagers.end()) return;
+
+    auto camera = live_cameras.find(camera_id);
+    if (camera != live_cameras.end()) {
+        auto ingest = ingests.find(camera->second);
+        if (ingest != ingests.end()) ingest->second->remove_listener(it->second.get());
+        release_ingest(camera->second);
+    }
+    hls_packagers.erase(it);
+    Logger::info("[StreamEngine] HLS packager stopped for " + camera_id);
+}
+
+gboolean StreamEngine::reclaim_hls_callback(gpointer user_data) {
+    StreamEngine* engine = static_cast<StreamEngine*>(user_data);
+    auto idle_since = std::chrono::steady_clock::now() - std::chrono::seconds(HLS_IDLE_TIMEOUT_SEC);
+
+    std::lock_guard<std::mutex> lock(engine->engine_mutex);
+    std::vector<std::string> idle;
+    for (auto const& [id, packager] : engine->hls_packagers) {
+        if (packager->last_access() < idle_since) idle.push_back(id);
+    }
+    for (const auto& id : idle) engine->drop_hls_packager(id);
+    return TRUE;
+}
+
+gboolean StreamEngine::session_cleanup_callback(gpointer user_data) {
+    StreamEngine* engine = static_cast<StreamEngine*>(user_data);
+    GstRTSPSessionPool* pool = gst_rtsp_server_get_session_pool(engine->server);
+    gst_rtsp_session_pool_cleanup(pool);
+    g_object_unref(pool);
+    return TRUE;
+}
+
+// Mount path of a /vod/ request URI: "/vod/<camera>/<file>.mkv", without the
+// "/stream=N" control suffix of SETUP; empty if it is not a VOD request
+static std::string vod_mount_path(const GstRTSPContext* ctx) {
+    if (!ctx->uri || !ctx->uri->abspath) return "";
+    std::string path = ctx->uri->abspath;
+    if (path.rfind("/vod/", 0) != 0) return "";
+    size_t ext = path.find(".mkv");
+    while (ext != std::string::npos && ext + 4 < path.size() && path[ext + 4] != '/') ext = path.find(".mkv", ext + 1);
+    if (ext == std::string::npos) return "";
+    return path.substr(0, ext + 4);
+}
+
+// The recording behind a mount path, "" if it is gone. Resolved again for
+// every media: a recording can move to the bulk tier while its mount is cached.
+static std::string vod_file(VideoStorage& storage, const std::string& path) {
+    gchar* relative = g_uri_unescape_string(path.c_str() + 5, nullptr);
+    std::string file = relative ? storage.resolve(relative) : "";
+    g_free(relative);
+    return file;
+}
+
+size_t StreamEngine::vod_mount_count() {
+    std::lock_guard<std::mutex> lock(engine_mutex);
+    return vod_mounts.size();
+}
+
+void StreamEngine::client_connected_callback(GstRTSPServer*, GstRTSPClient* client, gpointer user_data) {
+    g_signal_connect(client, "pre-describe-request", G_CALLBACK(vod_request_callback), user_data);
+    g_signal_connect(client, "pre-setup-request", G_CALLBACK(vod_request_callback), user_data);
+    g_signal_connect(client, "pre-play-request", G_CALLBACK(vod_play_callback), user_data);
+}
+
+// Runs before the mount lookup, so the mount exists by the time it is needed
+GstRTSPStatusCode StreamEngine::vod_request_callback(GstRTSPClient*, GstRTSPContext* ctx, gpointer user_data) {
+    StreamEngine* engine = static_cast<StreamEngine*>(user_data);
+    std::string path = vod_mount_path(ctx);
+    if (path.empty()) return GST_RTSP_STS_OK;
+
+    std::lock_guard<std::mutex> lock(engine->engine_mutex);
+    return engine->ensure_vod_mount(path);
+}
+
+// Must be called with engine_mutex held
+GstRTSPStatusCode StreamEngine::ensure_vod_mount(const std::string& path) {
+    auto it = vod_mounts.find(path);
+    if (it != vod_mounts.end()) return GST_RTSP_STS_OK;
+
+    std::string file = vod_file(storage_ref, path);
+    if (file.empty()) return GST_RTSP_STS_NOT_FOUND;
+
+    // Bounded: make room by dropping idle mounts early, refuse if all are busy
+    if (vod_mounts.size() >= MAX_VOD_MOUNTS) {
+        auto oldest = vod_mounts.end();
+        for (auto m = vod_mounts.begin(); m != vod_mounts.end(); ++m) {
+            if (m->second.media == 0 && (oldest == vod_mounts.end() || m->second.idle_since < oldest->second.idle_since)) oldest = m;
+        }
+        if (oldest == vod_mounts.end()) {
+            Logger::error("[StreamEngine] Too many VOD streams, refusing " + path);
+            return GST_RTSP_STS_SERVICE_UNAVAILABLE;
+        }
+        gst_rtsp_mount_points_remove_factory(mounts, oldest->first.c_str());
+        vod_mounts.erase(oldest);
+    }
+
+    // The file is set in vod_configure_callback (no quoting in launch lines).
+    // Not shared: every client seeks and changes speed in its own media.
+    GstRTSPMediaFactory* factory = gst_rtsp_media_factory_new();
+    gst_rtsp_media_factory_set_shared(factory, FALSE);
+    gst_rtsp_media_factory_set_launch(factory,
+        "( filesrc name=file ! matroskademux ! h264parse ! rtph264pay name=pay0 pt=96 config-interval=-1 )");
+    g_object_set_data_full(G_OBJECT(factory), "vod-path", g_strdup(path.c_str()), g_free);
+    g_signal_connect(factory, "media-configure", G_CALLBACK(vod_configure_callback), this);
+    gst_rtsp_mount_points_add_factory(mounts, path.c_str(), factory);
+
+    VodMount& mount = vod_mounts[path];
+    mount.file = file;
+    mount.idle_since = std::chrono::steady_clock::now();
+    Logger::info("[StreamEngine] VOD mount rtsp://<server_ip>:8554" + path);
+    return GST_RTSP_STS_OK;
+}
+
+// Snaps the requested start to the keyframe at or before it, so the demuxer's
+// key unit seek lands exactly there, and switches keyframe-only trick play
+GstRTSPStatusCode StreamEngine::vod_play_callback(GstRTSPClient*, GstRTSPContext* ctx, gpointer user_data) {
+    StreamEngine* engine = static_cast<StreamEngine*>(user_data);
+    if (vod_mount_path(ctx).empty() || !ctx->media) return GST_RTSP_STS_OK;
+
+    // This client's media, as vod_configure_callback set it up
+    const gchar* file = static_cast<const gchar*>(g_object_get_data(G_OBJECT(ctx->media), "vod-file"));
+    auto keyframes_only = static_cast<std::shared_ptr<std::atomic<bool>>*>(
+        g_object_get_data(G_OBJECT(ctx->media), "vod-keyframes"));
+    if (!file || !keyframes_only) return GST_RTSP_STS_OK;
+
+    gchar* value = nullptr;
+    double rate = 1.0;
+    if (gst_rtsp_message_get_header(ctx->request, GST_RTSP_HDR_SCALE, &value, 0) == GST_RTSP_OK) rate = std::atof(value);
+    **keyframes_only = std::abs(rate) >= VOD_KEYFRAMES_ONLY_RATE;
+
+    GstRTSPTimeRange* range = nullptr;
+    if (gst_rtsp_message_get_header(ctx->request, GST_RTSP_HDR_RANGE, &value, 0) != GST_RTSP_OK ||
+        gst_rtsp_range_parse(value, &range) != GST_RTSP_OK) {
+        return GST_RTSP_STS_OK;
+    }
+    std::unique_ptr<SeekIndex> index = engine->storage_ref.open_index(file);
+    SeekIndexEntry entry;
+    if (range->min.type == GST_RTSP_TIME_SECONDS && index &&
+        index->find(static_cast<uint64_t>(std::max(0.0, range->min.seconds) * GST_SECOND), entry)) {
+        range->min.seconds = entry.pts / (double)GST_SECOND;
+        gchar* snapped = gst_rtsp_range_to_string(range);
+        gst_rtsp_message_remove_header(ctx->request, GST_RTSP_HDR_RANGE, -1);
+        gst_rtsp_message_add_header(ctx->request, GST_RTSP_HDR_RANGE, snapped);
+        g_free(snapped);
+        if (gst_rtsp_message_get_header(ctx->request, GST_RTSP_HDR_SEEK_STYLE, &value, 0) != GST_RTSP_OK) {
+            gst_rtsp_message_add_header(ctx->request, GST_RTSP_HDR_SEEK_STYLE, "RAP");
+        }
+    }
+    gst_rtsp_range_free(range);
+    return GST_RTSP_STS_OK;
+}
+
+void StreamEngine::vod_configure_callback(GstRTSPMediaFactory* factory, GstRTSPMedia* media, gpointer user_data) {
+    StreamEngine* engine = static_cast<StreamEngine*>(user_data);
+    std::string path = static_cast<const gchar*>(g_object_get_data(G_OBJECT(factory), "vod-path"));
+
+    std::lock_guard<std::mutex> lock(engine->engine_mutex);
+    auto it = engine->vod_mounts.find(path);
+    if (it == engine->vod_mounts.end()) return;
+    VodMount& mount = it->second;
+    std::string file = vod_file(engine->storage_ref, path);
+    if (!file.empty()) mount.file = file;
+    else Logger::error("[StreamEngine] " + mount.file + " is gone, " + path + " cannot play");
+    auto keyframes_only = std::make_shared<std::atomic<bool>>(false);
+
+    GstElement* element = gst_rtsp_media_get_element(media);
+    GstElement* filesrc = gst_bin_get_by_name(GST_BIN(element), "file");
+    GstElement* pay = gst_bin_get_by_name(GST_BIN(element), "pay0");
+    gst_object_unref(element);
+    if (filesrc) {
+        g_object_set(filesrc, "location", file.c_str(), nullptr);
+        gst_object_unref(filesrc);
+    }
+    if (pay) {
+        GstPad* pad = gst_element_get_static_pad(pay, "sink");
+        gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, vod_trickplay_probe,
+                          new std::shared_ptr<std::atomic<bool>>(keyframes_only),
+                          [](gpointer data) { delete static_cast<std::shared_ptr<std::atomic<bool>>*>(data); });
+        gst_object_unref(pad);
+        gst_object_unref(pay);
+    }
+
+    mount.media++;
+    g_object_set_data_full(G_OBJECT(media), "vod-path", g_strdup(path.c_str()), g_free);
+    g_object_set_data_full(G_OBJECT(media), "vod-file", g_strdup(file.c_str()), g_free);
+    g_object_set_data_full(G_OBJECT(media), "vod-keyframes", new std::shared_ptr<std::atomic<bool>>(keyframes_only),
+                           [](gpointer data) { delete static_cast<std::shared_ptr<std::atomic<bool>>*>(data); });
+    g_signal_connect(media, "unprepared", G_CALLBACK(vod_unprepared_callback), engine);
+}
+
+void StreamEngine::vod_unprepared_callback(GstRTSPMedia* media, gpointer user_data) {
+    StreamEngine* engine = static_cast<StreamEngine*>(user_data);
+    const gchar* path = static_cast<const gchar*>(g_object_get_data(G_OBJECT(media), "vod-path"));
+    if (!path) return;
+
+    std::lock_guard<std::mutex> lock(engine->engine_mutex);
+    auto it = engine->vod_mounts.find(path);
+    if (it == engine->vod_mounts.end() || it->second.media == 0) return;
+    if (--it->second.media == 0) it->second.idle_since = std::chrono::steady_clock::now();
+}
+
+GstPadProbeReturn StreamEngine::vod_trickplay_probe(GstPad*, GstPadProbeInfo* info, gpointer user_data) {
+    auto keyframes_only = static_cast<std::shared_ptr<std::atomic<bool>>*>(user_data);
+    if (**keyframes_only && GST_BUFFER_FLAG_IS_SET(GST_PAD_PROBE_INFO_BUFFER(info), GST_BUFFER_FLAG_DELTA_UNIT)) {
+        return GST_PAD_PROBE_DROP;
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+gboolean StreamEngine::reclaim_vod_callback(gpointer user_data) {
+    StreamEngine* engine = static_cast<StreamEngine*>(user_data);
+    auto idle_since = std::chrono::steady_clock::now() - std::chrono::seconds(VOD_IDLE_TIMEOUT_SEC);
+
+    std::lock_guard<std::mutex> lock(engine->engine_mutex);
+    for (auto it = engine->vod_mounts.begin(); it != engine->vod_mounts.end();) {
+        if (it->second.media == 0 && it->second.idle_since < idle_since) {
+            gst_rtsp_mount_points_remove_factory(engine->mounts, it->first.c_str());
+            Logger::info("[StreamEngine] Removed idle VOD mount " + it->first);
+            it = engine->vod_mounts.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    return TRUE;
+}
+
+ContextThread* StreamEngine::get_worker(int port) {
+    auto& worker = workers[port];
+    if (!worker) worker = std::make_unique<ContextThread>("camera port " + std::to_string(port));
+    return worker.get();
+}
+
+IngestPipeline* StreamEngine::acquire_ingest(int port) {
+    auto it = ingests.find(port);
+    if (it != ingests.end()) return it->second.get();
 
-    // Pipeline: Listen UDP -> Parse -> Mux -> File
-    // We use 'matroskamux' (MKV) because it is resilient to power failure.
+    auto options = ingest_options.find(port);
+    auto ingest = std::make_unique<IngestPipeline>(port, preroll_time, preroll_max_bytes,
+                                                   options != ingest_options.end() ? options->second : IngestOptions());
+    if (!ingest->start(get_worker(port))) return nullptr;
+    return (ingests[port] = std::move(ingest)).get();
+}
+
+void StreamEngine::release_ingest(int port) {
+    auto it = ingests.find(port);
+    if (it == ingests.end() || it->second->consumer_count() > 0) return;
+
+    // Registered cameras keep a warm ingest while pre-roll is enabled
+    if (preroll_time > 0 && is_camera_port(port)) return;
+    ingests.erase(it);
+}
+
+void StreamEngine::detach_consumer(int port, GstElement* appsrc) {
+    auto it = ingests.find(port);
+    if (it != ingests.end()) it->second->remove_consumer(appsrc);
+    release_ingest(port);
+}
+
+// Hooks a freshly built /live/<id> media into the camera's shared ingest
+void StreamEngine::media_configure_callback(GstRTSPMediaFactory* factory, GstRTSPMedia* media, gpointer user_data) {
+    StreamEngine* engine = static_cast<StreamEngine*>(user_data);
+    int port = GPOINTER_TO_INT(g_object_get_data(G_OBJECT(factory), "ingest-port"));
+
+    GstElement* element = gst_rtsp_media_get_element(media);
+    GstElement* appsrc = gst_bin_get_by_name_recurse_up(GST_BIN(element), "src");
+    gst_object_unref(element);
+    if (!appsrc) return;
+
+    {
+        std::lock_guard<std::mutex> lock(engine->engine_mutex);
+        IngestPipeline* ingest = engine->acquire_ingest(port);
+        if (ingest) ingest->add_consumer(appsrc);
+    }
+
+    // The media owns the appsrc reference until it is unprepared
+    g_object_set_data(G_OBJECT(media), "ingest-port", GINT_TO_POINTER(port));
+    g_object_set_data_full(G_OBJECT(media), "ingest-src", appsrc, gst_object_unref);
+    g_signal_connect(media, "unprepared", G_CALLBACK(media_unprepared_callback), engine);
+}
+
+void StreamEngine::media_unprepared_callback(GstRTSPMedia* media, gpointer user_data) {
+    StreamEngine* engine = static_cast<StreamEngine*>(user_data);
+    int port = GPOINTER_TO_INT(g_object_get_data(G_OBJECT(media), "ingest-port"));
+    GstElement* appsrc = static_cast<GstElement*>(g_object_get_data(G_OBJECT(media), "ingest-src"));
+    if (!appsrc) return;
+
+    std::lock_guard<std::mutex> lock(engine->engine_mutex);
+    engine->detach_consumer(port, appsrc);
+}
+
+// Recording Pipeline
+// The recorder no longer opens its own socket: it registers an appsrc on the
+// camera's IngestPipeline and receives the exact same (refcounted) buffers as
+// the live stream, so each camera is received, depayloaded and parsed once.
+//
+// Pipeline: Shared Ingest -> Mux -> File(s)
+// Files are written by recordsink where available (see RecordSink.hpp),
+// filesink otherwise.
+// We use 'matroskamux' (MKV) because it is resilient to power failure.
+// splitmuxsink starts a new file on the first keyframe past the segment
+// limits (0/0 = one file per session) and, with async-finalize, closes the
+// previous segment in the background while the next one is being written.
+StreamEngine::Recorder* StreamEngine::build_recorder(int port, ContextThread* worker) {
     std::string pipeline_str = 
-        "udpsrc port=" + std::to_string(port) + " multicast-group=239.0.0.1 buffer-size=10000000 do-timestamp=true ! application/x-rtp, encoding-name=H264 ! "
-        "rtph264depay ! h264parse ! matroskamux ! filesink location=" + filename;
+        "appsrc name=src is-live=true format=time ! "
+        "queue name=writer max-size-buffers=0 max-size-time=0 ! "
+        "splitmuxsink name=mux muxer-factory=matroskamux async-finalize=true sink-factory=" +
+        std::string(record_sink_available ? RECORD_SINK_FACTORY : "filesink");
 
     GError* error = nullptr;
     GstElement* new_pipeline = gst_parse_launch(pipeline_str.c_str(), &error);
 
     if (error) {
         Logger::error(std::string("Pipeline error: ") + error->message);
-        return;
+        g_error_free(error);
+        if (new_pipeline) gst_object_unref(new_pipeline);
+        return nullptr;
     }
 
-    gst_element_set_state(new_pipeline, GST_STATE_PLAYING);
-    active_recorders[doctor_name] = new_pipeline;
+    Recorder* recorder = new Recorder();
+    recorder->engine = this;
+    recorder->pipeline = new_pipeline;
+    recorder->appsrc = gst_bin_get_by_name(GST_BIN(new_pipeline), "src");
+    recorder->port = port;
+    recorder->worker = worker;
+    recorder->finalized_future = recorder->finalized.get_future().share();
+
+    GstElement* mux = gst_bin_get_by_name(GST_BIN(new_pipeline), "mux");
+    g_signal_connect(mux, "format-location", G_CALLBACK(format_location_callback), recorder);
+    g_signal_connect(mux, "sink-added", G_CALLBACK(sink_added_callback), recorder);
+    gst_object_unref(mux);
+
+    recorder->writer_queue = gst_bin_get_by_name(GST_BIN(new_pipeline), "writer");
+    GstPad* pad = gst_element_get_static_pad(recorder->writer_queue, "sink");
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, writer_in_probe, recorder, nullptr);
+    gst_object_unref(pad);
+    pad = gst_element_get_static_pad(recorder->writer_queue, "src");
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, writer_out_probe, recorder, nullptr);
+    gst_object_unref(pad);
+
+    recorder->bus_watch = worker->add_bus_watch(new_pipeline, recorder_bus_callback, recorder);
+
+    // READY: elements are created and allocated, but nothing is opened yet
+    // (the sink would open its file on the way to PAUSED)
+    gst_element_set_state(new_pipeline, GST_STATE_READY);
+    return recorder;
+}
+
+void StreamEngine::destroy_recorder(Recorder* recorder) {
+    ContextThread::remove(recorder->bus_watch);
+    ContextThread::remove(recorder->timeout);
+
+    gst_element_set_state(recorder->pipeline, GST_STATE_NULL);
+    gst_object_unref(recorder->writer_queue);
+    gst_object_unref(recorder->appsrc);
+    gst_object_unref(recorder->pipeline);
+    delete recorder;
+}
+
+bool StreamEngine::start_recording(const std::string& doctor_name, int port, RecordMode mode, double* latency_ms) {
+    auto started = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> lock(engine_mutex);
+
+    // Check for minimum 500MB space
+    if (storage_ref.get_available_space() < 500ULL * 1024 * 1024) {
+        Logger::error("[StreamEngine] Not enough disk space to start recording!");
+        return false;
+    }
+
+    if (active_recorders.count(doctor_name) || active_captures.count(doctor_name)) {
+        Logger::info("[StreamEngine] Already recording for " + doctor_name);
+        return false;
+    }
+
+    if (mode == RAW_RTP) {
+        IngestPipeline* ingest = acquire_ingest(port);
+        if (!ingest) return false;
+        std::string filename = storage_ref.create_filename(doctor_name, camera_for_port(port), RtpCapture::EXTENSION);
+        auto capture = std::make_unique<RtpCapture>(filename);
+        if (filename.empty() || !capture->open()) {
+            // Drop create_filename()'s placeholder, nothing will be written to it
+            std::error_code ec;
+            if (!filename.empty()) std::filesystem::remove(filename, ec);
+            release_ingest(port);
+            return false;
+        }
+        Logger::info("[StreamEngine] Capturing Port " + std::to_string(port) + " (raw RTP) to: " + capture->get_filename());
+        retention.mark_live(capture->get_filename());
+        ingest->add_rtp_listener(capture.get());
+        active_captures[doctor_name] = {port, std::move(capture), started};
+        report_start_latency(started, latency_ms, "raw capture");
+        return true;
+    }
+
+    // Prefer a pre-warmed pipeline; build one on the spot otherwise
+    Recorder* recorder = nullptr;
+    auto& pool = recorder_pool[port];
+    bool warm = !pool.empty();
+    if (warm) {
+        recorder = pool.back();
+        pool.pop_back();
+    } else {
+        recorder = build_recorder(port, get_worker(port));
+        if (!recorder) return false;
+    }
+
+    // First segment; later segments get their own name in format_location_callback
+    std::string camera = camera_for_port(port);
+    std::string filename = storage_ref.create_filename(doctor_name, camera);
+    if (filename.empty()) {
+        if (warm) pool.push_back(recorder);
+        else destroy_recorder(recorder);
+        return false;
+    }
+
+    IngestPipeline* ingest = acquire_ingest(port);
+    if (!ingest) {
+        std::error_code ec;
+        std::filesystem::remove(filename, ec); // The pipeline never got the placeholder
+        destroy_recorder(recorder);
+        return false;
+    }
+
+    recorder->name = doctor_name;
+    recorder->camera = camera;
+    recorder->filename = filename;
+    recorder->state = Recorder::RECORDING;
+    recorder->started_at = started;
+    recorder->io_uring = mode == MUXED_URING;
+    Logger::info("[StreamEngine] Recording Port " + std::to_string(port) + " to: " + recorder->filename);
+
+    GstElement* mux = gst_bin_get_by_name(GST_BIN(recorder->pipeline), "mux");
+    g_object_set(mux, "max-size-time", segment_max_time, "max-size-bytes", segment_max_bytes, nullptr);
+    if (record_sink_available) {
+        GstStructure* props = gst_structure_new("properties",
+            "preallocate", G_TYPE_UINT64, write_preallocate,
+            "batch-size", G_TYPE_UINT, write_batch_size,
+            "sync-interval", G_TYPE_UINT, write_sync_interval,
+            "io-uring", G_TYPE_BOOLEAN, recorder->io_uring, nullptr);
+        g_object_set(mux, "sink-properties", props, nullptr);
+        gst_structure_free(props);
+    }
+    gst_object_unref(mux);
+
+    recorder->queue_limit = writer_max_bytes;
+    recorder->queue_high_water = (guint64)(writer_max_bytes * writer_high_water);
+    recorder->queue_policy = writer_policy;
+    // DROP_TO_KEYFRAME drops in writer_in_probe before the queue fills up
+    g_object_set(recorder->writer_queue, "max-size-bytes", (guint)std::min<guint64>(writer_max_bytes, G_MAXUINT),
+                 "leaky", writer_policy == WRITER_DROP_OLDEST ? 2 : 0, nullptr);
+    // Behind a full queue (WRITER_BLOCK) the appsrc takes as much again, then leaks
+    g_object_set(recorder->appsrc, "max-bytes", writer_max_bytes, "block", FALSE, "leaky-type", 2, nullptr);
+
+    gst_element_set_state(recorder->pipeline, GST_STATE_PLAYING);
+    ingest->add_consumer(recorder->appsrc, true);
+    active_recorders[doctor_name] = recorder;
+
+    if (is_camera_port(port)) schedule_pool_refill(port);
+
+    report_start_latency(started, latency_ms, warm ? "pre-warmed pipeline" : "cold pipeline");
+    return true;
+}
+
+void StreamEngine::report_start_latency(std::chrono::steady_clock::time_point started, double* latency_ms,
+                                        const std::string& how) {
+    double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - started).count();
+    if (latency_ms) *latency_ms = elapsed;
+    std::stringstream ss;
+    ss << "[StreamEngine] Recording started in " << std::fixed << std::setprecision(2) << elapsed
+       << " ms (" << how << ")";
+    Logger::info(ss.str());
 }
 
-void StreamEngine::stop_recording(const std::string& doctor_name) {
+// Storage folder for recordings of a port
+std::string StreamEngine::camera_for_port(int port) {
+    for (auto const& [id, camera_port] : live_cameras) {
+        if (camera_port == port) return id;
+    }
+    return "port_" + std::to_string(port);
+}
+
+bool StreamEngine::is_camera_port(int port) {
+    for (auto const& [id, camera_port] : live_cameras) {
+        if (camera_port == port) return true;
+    }
+    return false;
+}
+
+void StreamEngine::schedule_pool_refill(int port) {
+    get_worker(port)->add_idle(refill_pool_callback, new PoolRefill{this, port});
+}
+
+// Builds the replacement pipeline on the camera's worker thread, outside
+// engine_mutex, so the cost never lands on a start_recording() caller
+gboolean StreamEngine::refill_pool_callback(gpointer user_data) {
+    std::unique_ptr<PoolRefill> request(static_cast<PoolRefill*>(user_data));
+    StreamEngine* engine = request->engine;
+    int port = request->port;
+
+    ContextThread* worker;
+    {
+        std::lock_guard<std::mutex> lock(engine->engine_mutex);
+        if (!engine->is_camera_port(port) || engine->recorder_pool[port].size() >= RECORDER_POOL_SIZE)
+            return FALSE;
+        worker = engine->get_worker(port);
+    }
+
+    Recorder* recorder = engine->build_recorder(port, worker);
+    if (!recorder) return FALSE;
+
+    std::lock_guard<std::mutex> lock(engine->engine_mutex);
+    auto& pool = engine->recorder_pool[port];
+    if (engine->is_camera_port(port) && pool.size() < RECORDER_POOL_SIZE) {
+        pool.push_back(recorder);
+        if (pool.size() < RECORDER_POOL_SIZE) engine->schedule_pool_refill(port);
+    } else {
+        destroy_recorder(recorder);
+    }
+    return FALSE;
+}
+
+void StreamEngine::drain_pool(int port) {
+    auto it = recorder_pool.find(port);
+    if (it == recorder_pool.end()) return;
+    for (Recorder* recorder : it->second) destroy_recorder(recorder);
+    recorder_pool.erase(it);
+}
+
+void StreamEngine::set_writer_queue(guint64 max_bytes, WriterPolicy policy, double high_water) {
     std::lock_guard<std::mutex> lock(engine_mutex);
+    writer_max_bytes = max_bytes;
+    writer_policy = policy;
+    writer_high_water = std::min(1.0, std::max(0.0, high_water));
+}
+
+void StreamEngine::set_write_options(guint64 preallocate_bytes, guint batch_bytes, guint sync_interval_sec) {
+    std::lock_guard<std::mutex> lock(engine_mutex);
+    write_preallocate = preallocate_bytes;
+    write_batch_size = batch_bytes;
+    write_sync_interval = sync_interval_sec;
+    if (!record_sink_available) Logger::info("[StreamEngine] recordsink not available here, recording through filesink");
+}
+
+void StreamEngine::set_segment_limits(guint64 max_seconds, guint64 max_bytes) {
+    std::lock_guard<std::mutex> lock(engine_mutex);
+    segment_max_time = max_seconds * GST_SECOND;
+    segment_max_bytes = max_bytes;
+}
+
+// Runs on the recorder's streaming thread whenever splitmuxsink opens a segment
+// Every fragment's sink gets a seek index and checksums. Pre-warmed recorders add their sink
+// before they have a name, hence the lookup when the index is opened; name and
+// camera do not change while the recorder is PLAYING.
+void StreamEngine::sink_added_callback(GstElement*, GstElement* sink, gpointer user_data) {
+    Recorder* recorder = static_cast<Recorder*>(user_data);
+    SeekIndexWriter::attach(sink, [recorder]() { return SeekIndexInfo{recorder->name, recorder->camera}; });
+    ChecksumWriter::attach(sink);
+}
+
+gchar* StreamEngine::format_location_callback(GstElement*, guint fragment_id, gpointer user_data) {
+    Recorder* recorder = static_cast<Recorder*>(user_data);
+    StreamEngine* engine = recorder->engine;
+    if (fragment_id == 0) {
+        engine->retention.mark_live(recorder->filename);
+        return g_strdup(recorder->filename.c_str());
+    }
+
+    std::string filename = engine->storage_ref.create_filename(recorder->name, recorder->camera);
+    if (filename.empty()) {
+        // No location: the sink fails to open and the recorder's bus reports it
+        Logger::error("[StreamEngine] No file for the next segment of " + recorder->name);
+        return nullptr;
+    }
+    engine->retention.mark_live(filename);
+    Logger::info("[StreamEngine] Next segment for " + recorder->name + ": " + filename);
+    return g_strdup(filename.c_str());
+}
+
+std::shared_future<bool> StreamEngine::stop_recording(const std::string& doctor_name) {
+    std::lock_guard<std::mutex> lock(engine_mutex);
+    if (active_captures.count(doctor_name)) return end_capture(doctor_name);
     auto it = active_recorders.find(doctor_name);
-    if (it == active_recorders.end()) return;
+    if (it == active_recorders.end()) return {};
 
     Logger::info("[StreamEngine] Stopping recording for " + doctor_name + "...");
-    GstElement* pipeline = it->second;
-    
-    // Send EOS (End of Stream) to close file cleanly if possible
-    gst_element_send_event(pipeline, gst_event_new_eos());
-    
-    // Wait a moment for EOS to process
-    std::this_thread::sleep_for(std::chrono::milliseconds(500));
-    
-    gst_element_set_state(pipeline, GST_STATE_NULL);
-    gst_object_unref(pipeline);
+    Recorder* recorder = it->second;
     active_recorders.erase(it);
+    return begin_stop(recorder);
 }
 
-gboolean StreamEngine::check_storage_callback(gpointer user_data) {
-    StreamEngine* engine = static_cast<StreamEngine*>(user_data);
-    
-    // 500 MB Threshold
-    if (engine->storage_ref.get_available_space() < 500ULL * 1024 * 1024) {
+// The capture is complete once it is detached and closed, so the future is
+// ready right away; the .mkv follows whenever the remuxer gets to it.
+std::shared_future<bool> StreamEngine::end_capture(const std::string& doctor_name) {
+    auto it = active_captures.find(doctor_name);
+    Capture& capture = it->second;
+    auto ingest = ingests.find(capture.port);
+    if (ingest != ingests.end()) ingest->second->remove_rtp_listener(capture.file.get());
+    release_ingest(capture.port);
+
+    capture.file->close();
+    retention.mark_closed(capture.file->get_filename());
+    Logger::info("[StreamEngine] Capture closed: " + capture.file->get_filename());
+    remuxer.enqueue(capture.file->get_filename());
+    active_captures.erase(it);
+
+    std::promise<bool> closed;
+    closed.set_value(true);
+    return closed.get_future().share();
+}
+
+// Detaches the recorder from its ingest and hands the EOS over to its worker
+// thread. The caller never waits for the muxer; see recorder_bus_callback().
+std::shared_future<bool> StreamEngine::begin_stop(Recorder* recorder) {
+    detach_consumer(recorder->port, recorder->appsrc);
+    recorder->state = Recorder::STOP_PENDING;
+    stopping_recorders.insert(recorder);
+    std::shared_future<bool> future = recorder->finalized_future;
+    recorder->worker->add_idle(send_eos_callback, recorder);
+    return future;
+}
+
+gboolean StreamEngine::send_eos_callback(gpointer user_data) {
+    Recorder* recorder = static_cast<Recorder*>(user_data);
+    {
+        std::lock_guard<std::mutex> lock(recorder->engine->engine_mutex);
+        if (!recorder->failed) {
+            // Send EOS (End of Stream) so matroskamux writes cues and duration
+            recorder->state = Recorder::FINALIZING;
+            gst_app_src_end_of_stream(GST_APP_SRC(recorder->appsrc));
+            recorder->timeout = recorder->worker->add_timeout(FINALIZE_TIMEOUT_MS, finalize_timeout_callback, recorder);
+            return FALSE;
+        }
+    }
+    finish_recorder(recorder, false);
+    return FALSE;
+}
+
+gboolean StreamEngine::finalize_timeout_callback(gpointer user_data) {
+    Recorder* recorder = static_cast<Recorder*>(user_data);
+    Logger::error("[StreamEngine] EOS timed out for " + recorder->filename);
+    finish_recorder(recorder, false);
+    return FALSE;
+}
+
+gboolean StreamEngine::recorder_bus_callback(GstBus*, GstMessage* msg, gpointer user_data) {
+    Recorder* recorder = static_cast<Recorder*>(user_data);
+    StreamEngine* engine = recorder->engine;
+
+    // Pre-warmed pipelines sit in READY and are not ours to tear down here
+    {
         std::lock_guard<std::mutex> lock(engine->engine_mutex);
-        if (!engine->active_recorders.empty()) {
-            Logger::error("[StreamEngine] Disk full! Stopping all recordings.");
-            for (auto const& [doc, pipeline] : engine->active_recorders) {
-                gst_element_send_event(pipeline, gst_event_new_eos());
-                // We can't wait here inside the main loop, so we just set NULL
-                gst_element_set_state(pipeline, GST_STATE_NULL);
-                gst_object_unref(pipeline);
+        if (recorder->state == Recorder::POOLED) return TRUE;
+    }
+
+    switch (GST_MESSAGE_TYPE(msg)) {
+    case GST_MESSAGE_EOS: {
+        std::unique_lock<std::mutex> lock(engine->engine_mutex);
+        if (recorder->state != Recorder::FINALIZING) return TRUE;
+        lock.unlock();
+        finish_recorder(recorder, true);
+        return FALSE;
+    }
+    case GST_MESSAGE_ELEMENT: {
+        const GstStructure* st = gst_message_get_structure(msg);
+        if (st && gst_structure_has_name(st, "splitmuxsink-fragment-closed")) {
+            const gchar* location = gst_structure_get_string(st, "location");
+            if (location) {
+                Logger::info(std::string("[StreamEngine] Segment closed: ") + location);
+                engine->retention.mark_closed(location);
+                engine->storage_ref.get_catalog().update(location);
             }
-            engine->active_recorders.clear();
+        } else if (st && gst_structure_has_name(st, "recordsink-stats")) {
+            Recorder::WriterStats stats;
+            gboolean io_uring = FALSE;
+            gst_structure_get_boolean(st, "io-uring", &io_uring);
+            gst_structure_get_uint(st, "queue-depth", &stats.queue_depth);
+            gst_structure_get_uint(st, "max-queue-depth", &stats.max_queue_depth);
+            gst_structure_get_uint64(st, "stall-time", &stats.stall_ns);
+            gst_structure_get_uint64(st, "stalls", &stats.stalls);
+            const gchar* error = gst_structure_get_string(st, "write-error");
+            if (error) stats.error = error;
+            stats.io_uring = io_uring;
+
+            std::lock_guard<std::mutex> lock(engine->engine_mutex);
+            // Counters restart with every segment's sink (a new element, or the
+            // same one restarted); the final report of a segment comes from stop
+            if (GST_MESSAGE_SRC(msg) != recorder->writer_source || stats.stalls < recorder->writer.stalls ||
+                stats.stall_ns < recorder->writer.stall_ns) {
+                recorder->closed_writer.stall_ns += recorder->writer.stall_ns;
+                recorder->closed_writer.stalls += recorder->writer.stalls;
+                recorder->closed_writer.max_queue_depth =
+                    std::max(recorder->closed_writer.max_queue_depth, recorder->writer.max_queue_depth);
+                if (recorder->closed_writer.error.empty()) recorder->closed_writer.error = recorder->writer.error;
+                recorder->writer_source = GST_MESSAGE_SRC(msg);
+            }
+            recorder->writer = stats;
         }
+        return TRUE;
+    }
+    case GST_MESSAGE_ERROR: {
+        GError* err = nullptr;
+        gst_message_parse_error(msg, &err, nullptr);
+        Logger::error("[StreamEngine] Recording " + recorder->filename + " failed: " + err->message);
+        g_error_free(err);
+
+        std::unique_lock<std::mutex> lock(engine->engine_mutex);
+        if (recorder->state == Recorder::STOP_PENDING) {
+            // send_eos_callback is already queued and will clean up
+            recorder->failed = true;
+            return TRUE;
+        }
+        if (recorder->state == Recorder::RECORDING) {
+            engine->active_recorders.erase(recorder->name);
+            engine->detach_consumer(recorder->port, recorder->appsrc);
+        }
+        lock.unlock();
+        finish_recorder(recorder, false);
+        return FALSE;
+    }
+    default:
+        return TRUE;
+    }
+}
+
+void StreamEngine::finish_recorder(Recorder* recorder, bool clean) {
+    if (clean) Logger::info("[StreamEngine] Finalized " + recorder->filename);
+    StreamEngine* engine = recorder->engine;
+    bool last;
+    {
+        std::lock_guard<std::mutex> lock(engine->engine_mutex);
+        engine->stopping_recorders.erase(recorder);
+        last = engine->stopping_recorders.empty();
+    }
+    recorder->finalized.set_value(clean);
+    destroy_recorder(recorder);
+    if (last) engine->recorders_finished.notify_all();
+}
+
+std::vector<StreamEngine::RecorderInfo> StreamEngine::get_recorder_info() {
+    std::lock_guard<std::mutex> lock(engine_mutex);
+    std::vector<RecorderInfo> info;
+    for (auto const& [doc, recorder] : active_recorders) {
+        const Recorder::WriterStats& w = recorder->writer;
+        guint64 stall_ns = recorder->closed_writer.stall_ns + w.stall_ns;
+        RecorderInfo r = {doc, recorder->camera, recorder->filename, w.io_uring, w.queue_depth,
+                          std::max(w.max_queue_depth, recorder->closed_writer.max_queue_depth),
+                          stall_ns / 1e6, recorder->closed_writer.stalls + w.stalls};
+
+        guint level_buffers = 0, level_bytes = 0;
+        guint64 appsrc_bytes = 0, appsrc_dropped = 0;
+        g_object_get(recorder->writer_queue, "current-level-buffers", &level_buffers,
+                     "current-level-bytes", &level_bytes, nullptr);
+        g_object_get(recorder->appsrc, "current-level-bytes", &appsrc_bytes, "dropped", &appsrc_dropped, nullptr);
+        const Recorder::QueueStats& q = recorder->queue_stats;
+        // Whatever went in and neither came out nor is still queued was leaked
+        guint64 out_buffers = q.out_buffers + level_buffers;
+        guint64 out_bytes = q.out_bytes + level_bytes;
+        guint64 leaked_buffers = q.in_buffers > out_buffers ? q.in_buffers - out_buffers : 0;
+        guint64 leaked_bytes = q.in_bytes > out_bytes ? q.in_bytes - out_bytes : 0;
+        r.queued_bytes = level_bytes + appsrc_bytes;
+        r.max_queued_bytes = q.max_level;
+        r.max_queue_stall_ms = q.max_stall_ns / 1e6;
+        r.dropped_buffers = q.skipped_buffers + leaked_buffers + appsrc_dropped;
+        r.dropped_bytes = q.skipped_bytes + leaked_bytes;
+        r.high_water_alarms = q.alarms;
+        r.above_high_water = q.high;
+        r.write_error = recorder->closed_writer.error.empty() ? w.error : recorder->closed_writer.error;
+        info.push_back(r);
+    }
+    return info;
+}
+
+GstPadProbeReturn StreamEngine::writer_in_probe(GstPad*, GstPadProbeInfo* info, gpointer user_data) {
+    Recorder* recorder = static_cast<Recorder*>(user_data);
+    Recorder::QueueStats& q = recorder->queue_stats;
+    GstBuffer* buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    gsize size = gst_buffer_get_size(buffer);
+    // Queue level from the probes' own counters; a DROP_OLDEST queue leaks
+    // without telling, so past high water its real level is read back
+    guint64 gone = q.out_bytes + q.leaked_bytes;
+    guint64 level = q.in_bytes > gone ? q.in_bytes - gone : 0;
+    if (recorder->queue_policy == WRITER_DROP_OLDEST && level + size >= recorder->queue_high_water) {
+        guint level_buffers = 0, level_bytes = 0;
+        g_object_get(recorder->writer_queue, "current-level-buffers", &level_buffers,
+                     "current-level-bytes", &level_bytes, nullptr);
+        guint64 out_buffers = q.out_buffers + level_buffers;
+        q.leaked_buffers = q.in_buffers > out_buffers ? q.in_buffers - out_buffers : 0;
+        if (level > level_bytes) q.leaked_bytes += level - level_bytes;
+        level = level_bytes;
+    }
+
+    if (recorder->queue_policy == WRITER_DROP_TO_KEYFRAME) {
+        bool keyframe = !GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT);
+        if (q.skipping && keyframe && level < recorder->queue_high_water) {
+            q.skipping = false;
+            Logger::info("[StreamEngine] Writer caught up, recording " + recorder->name + " resumes on a keyframe");
+        }
+        if (!q.skipping && level + size > recorder->queue_limit) {
+            q.skipping = true;
+            Logger::error("[StreamEngine] Writer queue full for " + recorder->name + ", dropping to the next keyframe");
+        }
+        if (q.skipping) {
+            q.skipped_buffers++;
+            q.skipped_bytes += size;
+            return GST_PAD_PROBE_DROP;
+        }
+    }
+
+    guint64 queued = level + size;
+    if (queued > q.max_level) q.max_level = queued;
+    if (!q.high && queued >= recorder->queue_high_water) {
+        q.high = true;
+        q.alarms++;
+        Logger::error("[StreamEngine] Writer queue for " + recorder->name + " above high water (" +
+                      std::to_string(queued / 1024) + " KB queued): disk is not keeping up");
+    } else if (q.high && queued < recorder->queue_high_water / 2) {
+        q.high = false;
+        Logger::info("[StreamEngine] Writer queue for " + recorder->name + " back to normal");
+    }
+    q.in_buffers++;
+    q.in_bytes += size;
+    return GST_PAD_PROBE_OK;
+}
+
+GstPadProbeReturn StreamEngine::writer_out_probe(GstPad*, GstPadProbeInfo* info, gpointer user_data) {
+    Recorder* recorder = static_cast<Recorder*>(user_data);
+    Recorder::QueueStats& q = recorder->queue_stats;
+    GstClockTime now = gst_util_get_timestamp();
+    // This buffer has left the queue already
+    guint64 gone = q.out_buffers + 1 + q.leaked_buffers;
+    guint64 behind = q.in_buffers > gone ? q.in_buffers - gone : 0;
+
+    // With buffers waiting, the gap since the last one is the writer's doing
+    if (behind > 0 && GST_CLOCK_TIME_IS_VALID(q.last_out) && now - q.last_out > q.max_stall_ns) {
+        q.max_stall_ns = now - q.last_out;
+    }
+    q.last_out = now;
+    q.out_buffers++;
+    q.out_bytes += gst_buffer_get_size(GST_PAD_PROBE_INFO_BUFFER(info));
+    return GST_PAD_PROBE_OK;
+}
+
+void StreamEngine::set_retention(const RetentionPolicy& policy) {
+    retention.set_policy(policy);
+}
+
+RetentionEngine::Stats StreamEngine::get_storage_stats() {
+    return retention.get_stats();
+}
+
+void StreamEngine::set_transcode(const TranscodePolicy& policy) {
+    transcoder.set_policy(policy);
+}
+
+Transcoder::Stats StreamEngine::get_transcode_stats() {
+    return transcoder.get_stats();
+}
+
+CrashRecovery::Stats StreamEngine::get_recovery_stats() {
+    return recovery.get_stats();
+}
+
+// Retention's last resort: finalize the longest running recording properly
+// (EOS, cues written) rather than letting the disk fill up under all of them
+bool StreamEngine::stop_oldest_recording() {
+    std::lock_guard<std::mutex> lock(engine_mutex);
+    std::string oldest;
+    std::chrono::steady_clock::time_point oldest_start = std::chrono::steady_clock::time_point::max();
+    bool is_capture = false;
+    for (auto const& [doc, recorder] : active_recorders) {
+        if (recorder->started_at < oldest_start) {
+            oldest = doc;
+            oldest_start = recorder->started_at;
+        }
+    }
+    for (auto const& [doc, capture] : active_captures) {
+        if (capture.started_at < oldest_start) {
+            oldest = doc;
+            oldest_start = capture.started_at;
+            is_capture = true;
+        }
+    }
+    if (oldest.empty()) return false;
+
+    Logger::error("[StreamEngine] Disk full! Stopping recording for " + oldest);
+    if (is_capture) {
+        end_capture(oldest);
+    } else {
+        auto it = active_recorders.find(oldest);
+        Recorder* recorder = it->second;
+        active_recorders.erase(it);
+        begin_stop(recorder);
     }
-    return TRUE; // Continue calling this
+    return true;
 }
\ No newline at end of file
@@ -4,8 +4,22 @@
 #include <string>
 #include <thread>
 #include <map>
+#include <set>
+#include <vector>
 #include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <future>
+#include <chrono>
+#include <atomic>
 #include "VideoStorage.hpp"
+#include "ContextThread.hpp"
+#include "IngestPipeline.hpp"
+#include "HlsPackager.hpp"
+#include "RtpCapture.hpp"
+#include "RetentionEngine.hpp"
+#include "Transcoder.hpp"
+#include "CrashRecovery.hpp"
 
 class StreamEngine {
 public:
@@ -18,21 +32,294 @@ public:
     // Starts the main RTSP Server loop
     void run();
 
-    // Dynamically starts/stops recording to disk
-    void start_recording(const std::string& doctor_name, int port);
-    void stop_recording(const std::string& doctor_name);
+    // RTSP clients are served by a pool of up to max_threads threads, each
+    // with its own main context (default: one per core)
+    void set_rtsp_threads(guint max_threads);
+
+    // MUXED records Matroska segments directly. RAW_RTP appends the camera's
+    // RTP packets to a capture file (see RtpCapture) at a fraction of the CPU;
+    // it becomes an .mkv in the background once the CPU is idle.
+    // MUXED_URING is MUXED with recordsink queueing its writes to io_uring
+    // (plain writes where that is unavailable).
+    enum RecordMode { MUXED, MUXED_URING, RAW_RTP };
+
+    // Dynamically starts/stops recording to disk.
+    // start_recording() reports how long the start took in latency_ms.
+    // stop_recording() returns immediately; the future resolves once the file is
+    // finalized (true) or the EOS timed out / the pipeline failed (false). It is
+    // invalid if there was no recording for doctor_name.
+    bool start_recording(const std::string& doctor_name, int port, RecordMode mode = MUXED,
+                         double* latency_ms = nullptr);
+    std::shared_future<bool> stop_recording(const std::string& doctor_name);
+
+    // Rotates recordings into a new segment at the first keyframe past either
+    // limit; 0 disables that limit (both 0 = one file per session)
+    void set_segment_limits(guint64 max_seconds, guint64 max_bytes);
+
+    // recordsink tuning (Linux): fallocate extent, aligned write batch and
+    // fdatasync cadence (0 = only on close). Read when a recording starts.
+    void set_write_options(guint64 preallocate_bytes, guint batch_bytes, guint sync_interval_sec);
+
+    // Writer stage of muxed recordings: a queue of up to max_bytes between the
+    // ingest and the muxer/sink, so disk stalls are absorbed there instead of
+    // blocking the ingest. When it is full:
+    //  - WRITER_BLOCK pushes back into the recorder's appsrc, which holds up to
+    //    max_bytes more and then drops its oldest buffers (it never blocks the
+    //    ingest, which feeds the live clients too; needs GStreamer 1.20)
+    //  - WRITER_DROP_OLDEST leaks the oldest queued buffers
+    //  - WRITER_DROP_TO_KEYFRAME drops new data until the queue is back under
+    //    the high-water mark and a keyframe arrives, so only whole GOPs go missing
+    // Crossing high_water (fraction of max_bytes) logs an alarm and is counted.
+    // Read when a recording starts.
+    enum WriterPolicy { WRITER_BLOCK, WRITER_DROP_OLDEST, WRITER_DROP_TO_KEYFRAME };
+    void set_writer_queue(guint64 max_bytes, WriterPolicy policy, double high_water = 0.75);
+
+    // Keeps the current GOP of every registered camera in memory (capped at
+    // max_seconds / max_bytes per camera) so recordings start on the last
+    // keyframe instead of the next one. 0 disables it.
+    void set_preroll(guint max_seconds, size_t max_bytes);
+
+    // Disk quotas and eviction of old recordings (see RetentionEngine)
+    void set_retention(const RetentionPolicy& policy);
+    RetentionEngine::Stats get_storage_stats();
+
+    // Background re-encoding of aged recordings (see Transcoder)
+    void set_transcode(const TranscodePolicy& policy);
+    Transcoder::Stats get_transcode_stats();
+
+    // Startup repair of recordings a crash left unfinalized (see CrashRecovery)
+    CrashRecovery::Stats get_recovery_stats();
+
+    // Active muxed recordings and how their writer keeps up with the disk
+    struct RecorderInfo {
+        std::string name;
+        std::string camera;
+        std::string filename;
+        bool io_uring;           // Writes actually go through io_uring
+        unsigned queue_depth;    // Batches in flight at the last report
+        unsigned max_queue_depth;
+        double stall_ms;         // Time the writer was blocked on the disk
+        uint64_t stalls;
+
+        // Writer queue (see set_writer_queue)
+        uint64_t queued_bytes;     // Waiting for the muxer, appsrc included
+        uint64_t max_queued_bytes;
+        double max_queue_stall_ms; // Longest wait for the writer with data queued behind
+        uint64_t dropped_buffers;
+        uint64_t dropped_bytes;
+        uint64_t high_water_alarms;
+        bool above_high_water;
+        std::string write_error; // First write failure of the recording ("" = none)
+    };
+    std::vector<RecorderInfo> get_recorder_info();
+
+    struct IngestInfo {
+        int port;
+        std::string camera_id; // Empty if no registered camera uses the port
+        size_t consumers;
+        size_t preroll_bytes;
+        StreamHealth health;
+    };
+    std::vector<IngestInfo> get_ingest_info();
+
+    // LL-HLS packager of a registered camera, created on first request and
+    // shared by all viewers. nullptr if the camera is unknown.
+    std::shared_ptr<HlsPackager> get_hls_packager(const std::string& camera_id);
+
+    // Also offers /live mounts over RTSP multicast, one group per mount taken
+    // from the given range (RTP/RTCP port pairs from min_port..max_port).
+    // Applies to cameras registered afterwards; unicast stays available.
+    void set_multicast(const std::string& min_address, const std::string& max_address,
+                       guint16 min_port, guint16 max_port, guint ttl);
+
+    // Publishes/unpublishes rtsp://<server>:8554/live/<camera_id> for a discovered camera
+    void add_camera(const std::string& camera_id, int port, const IngestOptions& options = IngestOptions());
+    void remove_camera(const std::string& camera_id);
+
+    // Recordings play back at rtsp://<server_ip>:8554/vod/<camera>/<file>.mkv
+    // (the VideoStorage::relative_path of the file). The mount is created on
+    // the first DESCRIBE/SETUP; every client gets its own demux pipeline, so
+    // seeks and speed changes stay its own. PLAY ranges are snapped to
+    // keyframes from the recording's seek index; at Scale >=
+    // VOD_KEYFRAMES_ONLY_RATE only keyframes are sent. Mounts without a
+    // prepared media for VOD_IDLE_TIMEOUT_SEC are removed.
+    size_t vod_mount_count();
 
 private:
     VideoStorage& storage_ref;
     GMainLoop* loop;
     GstRTSPServer* server;
     GstRTSPMountPoints* mounts;
-    GstRTSPMediaFactory* factory;
+
+    // Camera ID -> ingest port of every published /live/<id> mount
+    std::map<std::string, int> live_cameras;
+    GstRTSPAddressPool* mcast_pool = nullptr; // Set by set_multicast()
+    guint mcast_ttl = 1;
     
+    // Worker thread per camera port: bus watches and timers of its ingest and
+    // recorders run there. Kept for the engine's lifetime.
+    std::map<int, std::unique_ptr<ContextThread>> workers;
+
+    // One shared receive chain per camera port, started on first use
+    std::map<int, std::unique_ptr<IngestPipeline>> ingests;
+    std::map<int, IngestOptions> ingest_options; // Receive mode per port, from discovery
+    GstClockTime preroll_time = 0;
+    size_t preroll_max_bytes = IngestPipeline::DEFAULT_PREROLL_BYTES;
+
+    // Lazily created /vod/... mounts by mount path, see vod_request_callback
+    struct VodMount {
+        std::string file; // Where the recording was at the last media; re-resolved for each
+        int media = 0;    // Prepared media, one per client
+        std::chrono::steady_clock::time_point idle_since;
+    };
+    std::map<std::string, VodMount> vod_mounts;
+    static constexpr int VOD_IDLE_TIMEOUT_SEC = 30;
+    static constexpr size_t MAX_VOD_MOUNTS = 16;
+    static constexpr double VOD_KEYFRAMES_ONLY_RATE = 2.0;
+
+    // Camera ID -> live HLS packager; idle ones are reclaimed by reclaim_hls_callback
+    std::map<std::string, std::shared_ptr<HlsPackager>> hls_packagers;
+    static constexpr int HLS_IDLE_TIMEOUT_SEC = 30;
+
     // Recording Pipeline Elements
-    std::map<std::string, GstElement*> active_recorders;
+    // Owned by the engine from start_recording() until finish_recorder() runs
+    // on the camera's worker thread; only that thread tears a recorder down.
+    struct Recorder {
+        enum State { POOLED, RECORDING, STOP_PENDING, FINALIZING };
+
+        StreamEngine* engine;
+        std::string name;
+        std::string camera;
+        std::string filename;
+        GstElement* pipeline;
+        GstElement* appsrc;
+        int port;
+        ContextThread* worker;
+        GSource* bus_watch = nullptr;
+        GSource* timeout = nullptr;
+        State state = POOLED;
+        bool failed = false;
+        std::chrono::steady_clock::time_point started_at;
+        bool io_uring = false; // Requested for this recording
+
+        // Last "recordsink-stats" of the current segment (guarded by engine_mutex)
+        struct WriterStats {
+            bool io_uring = false;
+            guint queue_depth = 0;
+            guint max_queue_depth = 0;
+            guint64 stall_ns = 0;
+            guint64 stalls = 0;
+            std::string error;
+        } writer, closed_writer; // closed_writer: totals of finished segments
+        const void* writer_source = nullptr; // Sink that sent writer
+
+        // Writer queue "writer"; settings are fixed before PLAYING, the
+        // counters are updated by the probes around it
+        GstElement* writer_queue = nullptr;
+        guint64 queue_limit = 0;
+        guint64 queue_high_water = 0;
+        WriterPolicy queue_policy = WRITER_BLOCK;
+        struct QueueStats {
+            std::atomic<guint64> in_buffers{0}, in_bytes{0}, out_buffers{0}, out_bytes{0};
+            std::atomic<guint64> skipped_buffers{0}, skipped_bytes{0}; // WRITER_DROP_TO_KEYFRAME
+            std::atomic<guint64> leaked_buffers{0}, leaked_bytes{0};   // WRITER_DROP_OLDEST, as last read back
+            std::atomic<guint64> max_level{0}, max_stall_ns{0}, alarms{0};
+            std::atomic<bool> high{false};
+            bool skipping = false;                       // Input side only
+            GstClockTime last_out = GST_CLOCK_TIME_NONE; // Output side only
+        } queue_stats;
+        std::promise<bool> finalized;
+        std::shared_future<bool> finalized_future;
+    };
+    std::map<std::string, Recorder*> active_recorders;
+    // Stopped, waiting for their EOS: from begin_stop() until finish_recorder()
+    std::set<Recorder*> stopping_recorders;
+    std::condition_variable recorders_finished; // stopping_recorders emptied
+    static constexpr guint FINALIZE_TIMEOUT_MS = 5000;
+
+    // Raw RTP captures by doctor name
+    struct Capture {
+        int port;
+        std::unique_ptr<RtpCapture> file;
+        std::chrono::steady_clock::time_point started_at;
+    };
+    std::map<std::string, Capture> active_captures;
+    CaptureRemuxer remuxer;
+    RetentionEngine retention;
+    Transcoder transcoder; // Holds files through retention: declared after it
+    CrashRecovery recovery; // Likewise
+
+    // Pre-built READY recorders per registered camera port
+    std::map<int, std::vector<Recorder*>> recorder_pool;
+    static constexpr size_t RECORDER_POOL_SIZE = 1;
+    struct PoolRefill {
+        StreamEngine* engine;
+        int port;
+    };
+
+    // Segment rotation limits (ns / bytes), read when a recorder is built
+    guint64 segment_max_time = 0;
+    guint64 segment_max_bytes = 0;
+
+    // recordsink properties, see set_write_options()
+    bool record_sink_available = false;
+    guint64 write_preallocate = 64 * 1024 * 1024;
+    guint write_batch_size = 1024 * 1024;
+    guint write_sync_interval = 5;
+
+    // Writer queue settings, see set_writer_queue()
+    guint64 writer_max_bytes = 64 * 1024 * 1024;
+    WriterPolicy writer_policy = WRITER_DROP_TO_KEYFRAME;
+    double writer_high_water = 0.75;
     std::mutex engine_mutex;
-    
+
+    // Must be called with engine_mutex held
+    ContextThread* get_worker(int port);
+    IngestPipeline* acquire_ingest(int port);
+    bool update_ingest_options(int port, const IngestOptions& options);
+    void release_ingest(int port);
+    void detach_consumer(int port, GstElement* appsrc);
+    std::shared_future<bool> begin_stop(Recorder* recorder);
+    std::shared_future<bool> end_capture(const std::string& doctor_name);
+    bool is_camera_port(int port);
+    std::string camera_for_port(int port);
+    bool stop_oldest_recording(); // Takes engine_mutex itself
+    void schedule_pool_refill(int port);
+    void drain_pool(int port);
+    void drop_hls_packager(const std::string& camera_id);
+    GstRTSPStatusCode ensure_vod_mount(const std::string& path);
+
+    // Safe without engine_mutex
+    static void report_start_latency(std::chrono::steady_clock::time_point started, double* latency_ms,
+                                     const std::string& how);
+    Recorder* build_recorder(int port, ContextThread* worker);
+    static void destroy_recorder(Recorder* recorder);
+
+    static gchar* format_location_callback(GstElement* splitmux, guint fragment_id, gpointer user_data);
+    static void sink_added_callback(GstElement* splitmux, GstElement* sink, gpointer user_data);
+
+    // Recorder's worker thread only
+    static void finish_recorder(Recorder* recorder, bool clean);
+    static gboolean send_eos_callback(gpointer user_data);
+    static gboolean refill_pool_callback(gpointer user_data);
+    static gboolean finalize_timeout_callback(gpointer user_data);
+    static gboolean recorder_bus_callback(GstBus* bus, GstMessage* msg, gpointer user_data);
+
+    // Streaming threads on either side of a recorder's writer queue
+    static GstPadProbeReturn writer_in_probe(GstPad* pad, GstPadProbeInfo* info, gpointer user_data);
+    static GstPadProbeReturn writer_out_probe(GstPad* pad, GstPadProbeInfo* info, gpointer user_data);
+
     static void media_configure_callback(GstRTSPMediaFactory* factory, GstRTSPMedia* media, gpointer user_data);
-    static gboolean check_storage_callback(gpointer user_data);
+    static void media_unprepared_callback(GstRTSPMedia* media, gpointer user_data);
+    static gboolean reclaim_hls_callback(gpointer user_data);
+    static gboolean session_cleanup_callback(gpointer user_data);
+
+    // VOD, on the RTSP client threads
+    static void client_connected_callback(GstRTSPServer* server, GstRTSPClient* client, gpointer user_data);
+    static GstRTSPStatusCode vod_request_callback(GstRTSPClient* client, GstRTSPContext* ctx, gpointer user_data);
+    static GstRTSPStatusCode vod_play_callback(GstRTSPClient* client, GstRTSPContext* ctx, gpointer user_data);
+    static void vod_configure_callback(GstRTSPMediaFactory* factory, GstRTSPMedia* media, gpointer user_data);
+    static void vod_unprepared_callback(GstRTSPMedia* media, gpointer user_data);
+    static GstPadProbeReturn vod_trickplay_probe(GstPad* pad, GstPadProbeInfo* info, gpointer user_data);
+    static gboolean reclaim_vod_callback(gpointer user_data);
 };
\ No newline at end of file
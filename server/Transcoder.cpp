@@ -0,0 +1,408 @@
+#include "Transcoder.hpp"
+#include <filesystem>
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <iomanip>
+#include <cstdlib>
+#include <ctime>
+#include "Checksum.hpp"
+#include "Logger.hpp"
+#include "SeekIndex.hpp"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#endif
+
+namespace fs = std::filesystem;
+
+// Task pool of the background pipelines: every streaming task gets a thread
+// of its own at the lowest priority, ending with the task. The default pool
+// hands its threads on to the live pipelines, and an unprivileged process
+// cannot raise a thread's priority again.
+struct IdleTaskPool {
+    GstTaskPool parent;
+};
+
+struct IdleTaskPoolClass {
+    GstTaskPoolClass parent_class;
+};
+
+G_DEFINE_TYPE(IdleTaskPool, idle_task_pool, GST_TYPE_TASK_POOL)
+
+struct IdleTask {
+    GstTaskPoolFunction func;
+    gpointer data;
+};
+
+static void lower_thread_priority() {
+#ifdef _WIN32
+    SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_IDLE);
+#else
+#ifdef __linux__
+    // Only runs when a core would otherwise be idle; threads the encoder
+    // and decoder start from here inherit it
+    struct sched_param param = {};
+    pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+#endif
+    setpriority(PRIO_PROCESS, 0, 19); // This thread on Linux
+#endif
+}
+
+static gpointer idle_task_run(gpointer user_data) {
+    IdleTask* task = static_cast<IdleTask*>(user_data);
+    lower_thread_priority();
+    task->func(task->data);
+    delete task;
+    return nullptr;
+}
+
+static void idle_task_pool_prepare(GstTaskPool*, GError**) {}
+static void idle_task_pool_cleanup(GstTaskPool*) {}
+
+static gpointer idle_task_pool_push(GstTaskPool*, GstTaskPoolFunction func, gpointer data, GError** error) {
+    IdleTask* task = new IdleTask{func, data};
+    GThread* thread = g_thread_try_new("idle-task", idle_task_run, task, error);
+    if (!thread) delete task;
+    return thread;
+}
+
+static void idle_task_pool_join(GstTaskPool*, gpointer id) {
+    if (id) g_thread_join(static_cast<GThread*>(id));
+}
+
+static void idle_task_pool_init(IdleTaskPool*) {}
+
+static void idle_task_pool_class_init(IdleTaskPoolClass* klass) {
+    GstTaskPoolClass* pool_class = GST_TASK_POOL_CLASS(klass);
+    pool_class->prepare = idle_task_pool_prepare;
+    pool_class->cleanup = idle_task_pool_cleanup;
+    pool_class->push = idle_task_pool_push;
+    pool_class->join = idle_task_pool_join;
+}
+
+Transcoder::Transcoder(VideoStorage& storage, RetentionEngine& retention) : storage(storage), retention(retention) {}
+
+Transcoder::~Transcoder() {
+    stop();
+}
+
+void Transcoder::start(std::function<size_t()> live) {
+    live_recordings = std::move(live);
+    task_pool = new_idle_pool();
+    thread = std::thread(&Transcoder::run, this);
+}
+
+void Transcoder::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        quit = true;
+    }
+    cond.notify_all();
+    if (thread.joinable()) thread.join();
+    if (task_pool) gst_object_unref(task_pool);
+    task_pool = nullptr;
+}
+
+void Transcoder::set_policy(const TranscodePolicy& new_policy) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        policy = new_policy;
+    }
+    cond.notify_all();
+}
+
+Transcoder::Stats Transcoder::get_stats() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return stats;
+}
+
+bool Transcoder::sleep_for(std::chrono::milliseconds duration) {
+    std::unique_lock<std::mutex> lock(mutex);
+    return !cond.wait_for(lock, duration, [this]() { return quit.load(); });
+}
+
+// The CPU the live pipelines (and everything else) leave idle decides, not
+// the load average: that counts the transcode's own runnable threads, so it
+// would pause itself, see the load fall, resume, and so on. On Linux the
+// share of all cores in use over the last PAUSE_POLL_SEC or more is taken,
+// less what this process's SCHED_IDLE threads used: the background
+// pipelines and the encoder and decoder threads they started.
+bool Transcoder::busy(const TranscodePolicy& current) {
+    if (live_recordings && live_recordings() > current.max_live_recordings) return true;
+#ifdef __linux__
+    CpuSample now;
+    if (read_cpu(now)) {
+        if (cpu_sample.total == 0 || now.at - cpu_sample.at > std::chrono::seconds(2 * CHECK_INTERVAL_SEC)) {
+            // Nothing recent to compare with: a second to measure over
+            cpu_sample = now;
+            if (!sleep_for(std::chrono::seconds(1)) || !read_cpu(now)) return true;
+        } else if (now.at - cpu_sample.at < std::chrono::seconds(PAUSE_POLL_SEC)) {
+            return cpu_loaded;
+        }
+        uint64_t total = now.total - cpu_sample.total;
+        uint64_t background = now.background - cpu_sample.background;
+        uint64_t used = now.used - cpu_sample.used;
+        used = used > background ? used - background : 0;
+        cpu_loaded = total > 0 && used >= current.max_load * total;
+        cpu_sample = now;
+        return cpu_loaded;
+    }
+#endif
+#ifndef _WIN32
+    double cores = std::max(1u, std::thread::hardware_concurrency());
+    double load = 0;
+    if (getloadavg(&load, 1) == 1 && load >= current.max_load * cores) return true;
+#endif
+    return false;
+}
+
+bool Transcoder::read_cpu(CpuSample& out) {
+#ifdef __linux__
+    std::ifstream stat("/proc/stat");
+    std::string cpu;
+    uint64_t user, nice, system, idle, iowait, irq, softirq, steal = 0;
+    if (!(stat >> cpu >> user >> nice >> system >> idle >> iowait >> irq >> softirq) || cpu != "cpu") return false;
+    stat >> steal;
+    out.used = user + nice + system + irq + softirq + steal;
+    out.total = out.used + idle + iowait;
+    out.background = 0;
+    out.at = std::chrono::steady_clock::now();
+
+    // Per thread: the fields after "(comm)" start with the state (3); utime
+    // and stime are fields 14 and 15, the scheduling policy 41
+    std::error_code ec;
+    for (const auto& task : fs::directory_iterator("/proc/self/task", ec)) {
+        std::ifstream in(task.path() / "stat");
+        std::string line;
+        if (!std::getline(in, line)) continue;
+        size_t comm_end = line.rfind(')');
+        if (comm_end == std::string::npos) continue;
+        std::istringstream fields(line.substr(comm_end + 1));
+        std::vector<std::string> field{std::istream_iterator<std::string>(fields), std::istream_iterator<std::string>()};
+        if (field.size() <= 41 - 3 || std::stoul(field[41 - 3]) != SCHED_IDLE) continue;
+        out.background += std::stoull(field[14 - 3]) + std::stoull(field[15 - 3]);
+    }
+    return true;
+#else
+    (void)out;
+    return false;
+#endif
+}
+
+void Transcoder::run() {
+#ifndef _WIN32
+    setpriority(PRIO_PROCESS, 0, 19);
+#endif
+    if (!gst_element_factory_find("x264enc") || !gst_element_factory_find("avdec_h264")) {
+        Logger::error("[Transcoder] x264enc or avdec_h264 missing (gst-plugins-ugly, gst-libav): transcoding off");
+        return;
+    }
+
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!quit) {
+        TranscodePolicy current = policy;
+        lock.unlock();
+
+        Recording recording;
+        bool worked = false;
+        if (current.min_age_sec > 0 && !busy(current) && next_job(current, recording)) {
+            worked = transcode(recording, current);
+        }
+
+        lock.lock();
+        // Straight on to the next file after a success; woken early by set_policy()
+        if (!worked) cond.wait_for(lock, std::chrono::seconds(CHECK_INTERVAL_SEC));
+    }
+}
+
+// Oldest recording past min_age_sec whose bitrate is well above the target
+bool Transcoder::next_job(const TranscodePolicy& current, Recording& out) {
+    RecordingQuery query;
+    query.to = std::time(nullptr) - current.min_age_sec;
+    query.descending = false;
+    query.limit = 200;
+    RecordingCatalog& catalog = storage.get_catalog();
+    for (;; query.offset += query.limit) {
+        RecordingPage page = catalog.query(query);
+        for (const auto& recording : page.items) {
+            if (recording.live || recording.duration <= 0) continue;
+            double kbps = recording.size * 8.0 / recording.duration / 1000.0;
+            if (kbps <= current.bitrate_kbps * MIN_GAIN) continue;
+            std::lock_guard<std::mutex> lock(mutex);
+            if (skipped.count(recording.path)) continue;
+            out = recording;
+            return true;
+        }
+        if (query.offset + page.items.size() >= page.total || page.items.empty()) return false;
+    }
+}
+
+GstTaskPool* Transcoder::new_idle_pool() {
+    return GST_TASK_POOL(g_object_new(idle_task_pool_get_type(), nullptr));
+}
+
+void Transcoder::use_idle_pool(GstElement* pipeline, GstTaskPool* pool) {
+    GstBus* bus = gst_element_get_bus(pipeline);
+    gst_bus_set_sync_handler(bus, bus_sync_handler, pool, nullptr);
+    gst_object_unref(bus);
+}
+
+// Streaming tasks of the pipeline are started on the idle pool
+GstBusSyncReply Transcoder::bus_sync_handler(GstBus*, GstMessage* msg, gpointer user_data) {
+    if (GST_MESSAGE_TYPE(msg) != GST_MESSAGE_STREAM_STATUS) return GST_BUS_PASS;
+    GstStreamStatusType type;
+    gst_message_parse_stream_status(msg, &type, nullptr);
+    if (type == GST_STREAM_STATUS_TYPE_CREATE) {
+        const GValue* value = gst_message_get_stream_status_object(msg);
+        if (value && G_VALUE_HOLDS_OBJECT(value) && GST_IS_TASK(g_value_get_object(value))) {
+            gst_task_set_pool(GST_TASK(g_value_get_object(value)), static_cast<GstTaskPool*>(user_data));
+        }
+    }
+    return GST_BUS_PASS;
+}
+
+bool Transcoder::transcode(const Recording& recording, const TranscodePolicy& current) {
+    const std::string& file = recording.location;
+    if (!retention.hold(file)) return false; // Being moved; try again later
+    std::error_code ec;
+    if (!fs::is_regular_file(file, ec)) {
+        retention.release(file);
+        return false;
+    }
+
+    // Not .mkv, so neither the catalog nor retention pick it up meanwhile
+    std::string output = file + ".transcode";
+    std::string pipeline_str =
+        "filesrc name=src ! matroskademux ! h264parse ! avdec_h264 name=dec ! videoconvert ! "
+        "x264enc name=enc ! h264parse ! matroskamux ! filesink name=sink";
+    GError* error = nullptr;
+    GstElement* pipeline = gst_parse_launch(pipeline_str.c_str(), &error);
+    if (error) {
+        Logger::error(std::string("[Transcoder] Pipeline error: ") + error->message);
+        g_error_free(error);
+        if (pipeline) gst_object_unref(pipeline);
+        retention.release(file);
+        return false;
+    }
+
+    GstElement* element = gst_bin_get_by_name(GST_BIN(pipeline), "src");
+    g_object_set(element, "location", file.c_str(), nullptr);
+    gst_object_unref(element);
+    element = gst_bin_get_by_name(GST_BIN(pipeline), "dec");
+    g_object_set(element, "max-threads", (gint)current.max_threads, nullptr);
+    gst_object_unref(element);
+    element = gst_bin_get_by_name(GST_BIN(pipeline), "enc");
+    g_object_set(element, "bitrate", current.bitrate_kbps, "threads", current.max_threads,
+                 "key-int-max", KEYFRAME_INTERVAL, nullptr);
+    gst_util_set_object_arg(G_OBJECT(element), "speed-preset", current.speed_preset.c_str());
+    gst_object_unref(element);
+    element = gst_bin_get_by_name(GST_BIN(pipeline), "sink");
+    g_object_set(element, "location", output.c_str(), nullptr);
+    SeekIndexInfo info = {recording.doctor, recording.camera};
+    SeekIndexWriter::attach(element, [info]() { return info; });
+    ChecksumWriter::attach(element);
+    gst_object_unref(element);
+
+    use_idle_pool(pipeline, task_pool);
+    GstBus* bus = gst_element_get_bus(pipeline);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stats.current = recording.path;
+    }
+    Logger::info("[Transcoder] Re-encoding " + recording.path + " at " + std::to_string(current.bitrate_kbps) + " kbit/s");
+    auto started = std::chrono::steady_clock::now();
+    gst_element_set_state(pipeline, GST_STATE_PLAYING);
+
+    // Poll for the end, pausing while the machine is busy with live work
+    bool paused = false;
+    double paused_seconds = 0;
+    auto last_check = started;
+    GstMessage* msg = nullptr;
+    while (!quit) {
+        msg = gst_bus_timed_pop_filtered(bus, GST_SECOND, (GstMessageType)(GST_MESSAGE_EOS | GST_MESSAGE_ERROR));
+        if (msg) break;
+        auto now = std::chrono::steady_clock::now();
+        if (paused) paused_seconds += std::chrono::duration<double>(now - last_check).count();
+        last_check = now;
+        bool loaded = busy(current);
+        if (loaded != paused) {
+            paused = loaded;
+            gst_element_set_state(pipeline, paused ? GST_STATE_PAUSED : GST_STATE_PLAYING);
+            Logger::info(std::string("[Transcoder] ") + (paused ? "Paused (load)" : "Resumed"));
+            std::lock_guard<std::mutex> lock(mutex);
+            stats.paused = paused;
+        }
+        if (paused) sleep_for(std::chrono::seconds(PAUSE_POLL_SEC));
+    }
+
+    bool ok = msg && GST_MESSAGE_TYPE(msg) == GST_MESSAGE_EOS;
+    if (msg && GST_MESSAGE_TYPE(msg) == GST_MESSAGE_ERROR) {
+        GError* err = nullptr;
+        gst_message_parse_error(msg, &err, nullptr);
+        Logger::error("[Transcoder] " + recording.path + ": " + err->message);
+        g_error_free(err);
+    }
+    if (msg) gst_message_unref(msg);
+    gst_object_unref(bus);
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+    gst_object_unref(pipeline);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+
+    // Complete (the index reaches the original's end) and worth keeping?
+    uint64_t output_size = ok ? fs::file_size(output, ec) : 0;
+    if (ok && ec) ok = false;
+    if (ok) {
+        std::unique_ptr<SeekIndex> index = storage.open_index(output);
+        double duration = index && index->size() > 0 ? (*index)[index->size() - 1].pts / 1e9 : 0;
+        if (duration < recording.duration - 2.0) {
+            Logger::error("[Transcoder] " + recording.path + ": output ends early, original kept");
+            ok = false;
+        }
+    }
+    bool smaller = ok && output_size < recording.size;
+    if (smaller) {
+        fs::rename(output, file, ec);
+        if (!ec) fs::rename(SeekIndexWriter::path_for(output), SeekIndexWriter::path_for(file), ec);
+        if (!ec) fs::rename(ChecksumWriter::path_for(output), ChecksumWriter::path_for(file), ec);
+        if (ec) {
+            Logger::error("[Transcoder] Could not replace " + file + ": " + ec.message());
+            smaller = false;
+        }
+    }
+    fs::remove(output, ec);
+    fs::remove(SeekIndexWriter::path_for(output), ec);
+    fs::remove(ChecksumWriter::path_for(output), ec);
+    retention.release(file);
+    if (quit) return false;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    stats.current.clear();
+    stats.paused = false;
+    stats.paused_seconds += paused_seconds;
+    stats.encode_seconds += seconds - paused_seconds;
+    if (!smaller) {
+        // Not retried this run: broken, or already as small as it gets
+        skipped.insert(recording.path);
+        if (!ok) stats.failed_files++;
+        else Logger::info("[Transcoder] " + recording.path + " did not get smaller, original kept");
+        return false;
+    }
+    storage.get_catalog().update(file);
+    stats.transcoded_files++;
+    stats.input_bytes += recording.size;
+    stats.output_bytes += output_size;
+
+    std::stringstream ss;
+    ss << "[Transcoder] " << recording.path << ": " << recording.size / (1024 * 1024) << " MB -> "
+       << output_size / (1024 * 1024) << " MB (" << std::fixed << std::setprecision(2)
+       << double(recording.size) / std::max<uint64_t>(output_size, 1) << "x) in " << std::setprecision(0)
+       << seconds << " s, " << paused_seconds << " s paused";
+    Logger::info(ss.str());
+    return true;
+}
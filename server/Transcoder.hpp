@@ -0,0 +1,95 @@
+#pragma once
+#include <gst/gst.h>
+#include <string>
+#include <set>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <chrono>
+#include <cstdint>
+#include "VideoStorage.hpp"
+#include "RetentionEngine.hpp"
+
+struct TranscodePolicy {
+    int64_t min_age_sec = 0;            // Re-encode recordings that started longer ago; 0 = off
+    guint bitrate_kbps = 2500;          // x264 target (cameras record at ~10000)
+    std::string speed_preset = "slow";  // x264 preset: slower = smaller for the same quality
+    guint max_threads = 1;              // Decoder and encoder threads each: the CPU budget
+    double max_load = 0.5;              // Pause above this share of the cores in live use (see busy())
+    size_t max_live_recordings = 4;     // Pause while more recordings than this are running
+};
+
+// Re-encodes aged recordings at a lower bitrate (H.264 in software, so VOD,
+// HLS and downloads keep working unchanged) to stretch retention. One file at
+// a time, oldest first: its streaming threads run at the lowest priority
+// (SCHED_IDLE and nice 19 on Linux) so they only get cores live ingest
+// leaves idle, and the pipeline is paused while the machine is loaded or
+// many recordings are running. The result replaces the original, with a new
+// seek index, only if it is complete and smaller.
+class Transcoder {
+public:
+    static constexpr int CHECK_INTERVAL_SEC = 60;
+    static constexpr int PAUSE_POLL_SEC = 5;
+    static constexpr double MIN_GAIN = 1.25;  // Skip files already within 25% of the target bitrate
+    static constexpr guint KEYFRAME_INTERVAL = 60; // Frames; keeps seeking fine-grained
+
+    struct Stats {
+        uint64_t transcoded_files;
+        uint64_t failed_files;
+        uint64_t input_bytes;   // Of the transcoded files, before
+        uint64_t output_bytes;  // and after
+        double encode_seconds;
+        double paused_seconds;
+        bool paused;
+        std::string current;    // Relative path of the recording in progress
+    };
+
+    Transcoder(VideoStorage& storage, RetentionEngine& retention);
+    ~Transcoder();
+
+    // live_recordings returns how many recordings are running (any thread)
+    void start(std::function<size_t()> live_recordings);
+    void stop(); // Aborts a running job; also done by the destructor
+    void set_policy(const TranscodePolicy& policy);
+    Stats get_stats();
+
+    // Background pipelines (transcodes, crash repairs) start their streaming
+    // tasks on an idle pool: a thread each at the lowest priority. The pool
+    // is shared by any number of pipelines; unref it when they are done.
+    static GstTaskPool* new_idle_pool();
+    static void use_idle_pool(GstElement* pipeline, GstTaskPool* pool);
+
+private:
+    VideoStorage& storage;
+    RetentionEngine& retention;
+    TranscodePolicy policy;
+    std::function<size_t()> live_recordings;
+    std::set<std::string> skipped; // Failed or not worth it, by relative path
+    Stats stats = {};
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::atomic<bool> quit{false};
+    std::thread thread;
+    GstTaskPool* task_pool = nullptr;
+
+    // CPU time counters (clock ticks) behind busy(), from /proc
+    struct CpuSample {
+        uint64_t total = 0;      // All cores, idle included
+        uint64_t used = 0;       // All cores, not idle
+        uint64_t background = 0; // This process's SCHED_IDLE threads
+        std::chrono::steady_clock::time_point at;
+    };
+    CpuSample cpu_sample;
+    bool cpu_loaded = false;
+
+    void run();
+    bool next_job(const TranscodePolicy& current, Recording& out);
+    bool transcode(const Recording& recording, const TranscodePolicy& current);
+    bool busy(const TranscodePolicy& current);
+    static bool read_cpu(CpuSample& out);
+    bool sleep_for(std::chrono::milliseconds duration); // false on shutdown
+
+    static GstBusSyncReply bus_sync_handler(GstBus* bus, GstMessage* msg, gpointer user_data);
+};
@@ -4,10 +4,24 @@
 #include <chrono>
 #include <sstream>
 #include <iomanip>
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <cstdio>
+#include <ctime>
+#include <fcntl.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+#include "Checksum.hpp"
+#include "Logger.hpp"
 
 namespace fs = std::filesystem;
 
-VideoStorage::VideoStorage(const std::string& root_dir) : storage_dir(root_dir) {
+VideoStorage::VideoStorage(const std::string& root_dir) : storage_dir(root_dir), catalog(root_dir) {
     // Check if directory exists, if not create it
     if (!fs::exists(storage_dir)) {
         try {
@@ -18,32 +32,161 @@ VideoStorage::VideoStorage(const std::string& root_dir) : storage_dir(root_dir)
     }
 }
 
-std::string VideoStorage::create_filename(const std::string& doctor_name) {
+std::string VideoStorage::create_filename(const std::string& doctor_name, const std::string& camera_id,
+                                          const std::string& extension) {
     auto now = std::chrono::system_clock::now();
     auto in_time_t = std::chrono::system_clock::to_time_t(now);
-    
+    std::tm local = *std::localtime(&in_time_t);
+
+    // Camera IDs come off the network, doctor names off the API
+    std::string folder = path_component(camera_id);
+
+    std::stringstream day;
+    day << std::put_time(&local, "%Y-%m-%d");
+    fs::path dir = fs::path(storage_dir) / folder / day.str();
+    std::error_code ec;
+    fs::create_directories(dir, ec);
+
     std::stringstream ss;
-    ss << storage_dir << "/";
+    ss << storage_dir << "/" << folder << "/" << day.str() << "/";
     // Format: YYYY-MM-DD_HH-MM-SS
-    ss << std::put_time(std::localtime(&in_time_t), "%Y-%m-%d_%H-%M-%S_");
-    
-    std::string base_path = ss.str() + doctor_name;
-    std::string final_path = base_path + ".mkv";
+    ss << std::put_time(&local, "%Y-%m-%d_%H-%M-%S_");
+    return create_exclusive(ss.str() + path_component(doctor_name), extension);
+}
+
+// Keeps a name to a single safe path component: no separators, no ".."
+std::string VideoStorage::path_component(const std::string& name) {
+    std::string safe = name;
+    for (char& c : safe) {
+        if (!std::isalnum(static_cast<unsigned char>(c)) && c != '-' && c != '_') c = '_';
+    }
+    return safe.empty() ? "unknown" : safe;
+}
+
+std::string VideoStorage::create_exclusive(const std::string& base_path, const std::string& extension) {
+    // O_EXCL makes the existence check and the creation one step, so two
+    // recordings started in the same second never get the same file.
+    // Read-only: closing it must not look like a finished write (IN_CLOSE_WRITE)
+    // to the catalog, which would take the new recording for a closed one.
+    std::string final_path = base_path + extension;
+    for (int counter = 1; counter < 1000; ++counter) {
+#ifdef _WIN32
+        int fd = _open(final_path.c_str(), _O_CREAT | _O_EXCL | _O_RDONLY | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+        int fd = open(final_path.c_str(), O_CREAT | O_EXCL | O_RDONLY | O_CLOEXEC, 0644);
+#endif
+        if (fd >= 0) {
+#ifdef _WIN32
+            _close(fd);
+#else
+            close(fd);
+#endif
+            return final_path;
+        }
+        if (errno != EEXIST) break;
+        final_path = base_path + "_" + std::to_string(counter) + extension;
+    }
+    Logger::error("[VideoStorage] Could not create " + final_path + ": " + std::strerror(errno));
+    return "";
+}
+
+bool VideoStorage::is_day_folder(const std::string& name) {
+    int year, month, day;
+    char end;
+    return name.size() == 10 && sscanf(name.c_str(), "%4d-%2d-%2d%c", &year, &month, &day, &end) == 3;
+}
 
-    // Check if file exists, append counter if needed to prevent overwrite
-    int counter = 1;
-    while (fs::exists(final_path)) {
-        final_path = base_path + "_" + std::to_string(counter++) + ".mkv";
+// Hard link + unlink: unlike rename(), never replaces an existing target
+static bool move_no_replace(const fs::path& from, const fs::path& to) {
+    std::error_code ec;
+    fs::create_hard_link(from, to, ec);
+    if (ec) {
+        if (fs::exists(to)) return false;
+        // No hard links on this file system
+        fs::rename(from, to, ec);
+        return !ec;
     }
-    
-    return final_path;
+    fs::remove(from, ec);
+    return true;
+}
+
+size_t VideoStorage::migrate_layout() {
+    static const char* extensions[] = {".mkv", ".rtpcap"};
+    auto started = std::chrono::steady_clock::now();
+    fs::path root(storage_dir);
+    std::vector<fs::path> files;
+    std::error_code ec;
+
+    // Old layouts: everything in the root, or one folder per camera
+    auto collect = [&](const fs::path& dir) {
+        for (const auto& entry : fs::directory_iterator(dir, ec)) {
+            if (!entry.is_regular_file(ec)) continue;
+            for (const char* extension : extensions) {
+                if (entry.path().extension() == extension) files.push_back(entry.path());
+            }
+        }
+    };
+    collect(root);
+    for (const auto& entry : fs::directory_iterator(root, ec)) {
+        if (entry.is_directory(ec)) collect(entry.path());
+    }
+
+    size_t moved = 0, failed = 0;
+    for (const auto& file : files) {
+        std::string name = file.filename().string();
+        std::string day = name.substr(0, 10);
+        if (!is_day_folder(day)) {
+            // Not named by create_filename(): file the recording under its mtime
+            struct stat st;
+            std::time_t mtime = stat(file.string().c_str(), &st) == 0 ? st.st_mtime : std::time(nullptr);
+            std::stringstream ss;
+            ss << std::put_time(std::localtime(&mtime), "%Y-%m-%d");
+            day = ss.str();
+        }
+        std::string camera = file.parent_path() == root ? "unknown" : file.parent_path().filename().string();
+        fs::path dir = root / camera / day;
+        fs::create_directories(dir, ec);
+
+        if (!move_no_replace(file, dir / name)) {
+            Logger::error("[VideoStorage] Could not move " + file.string() + " (target exists?)");
+            failed++;
+            continue;
+        }
+        for (auto path_for : {SeekIndexWriter::path_for, ChecksumWriter::path_for}) {
+            std::string sidecar = path_for(file.string());
+            if (fs::exists(sidecar, ec)) move_no_replace(sidecar, path_for((dir / name).string()));
+        }
+        moved++;
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    std::stringstream ss;
+    ss << "[VideoStorage] Migrated " << moved << " recordings to the camera/day layout in " << std::fixed
+       << std::setprecision(1) << seconds << " s" << (failed ? ", " + std::to_string(failed) + " left in place" : "");
+    Logger::info(ss.str());
+    return moved;
 }
 
 std::vector<std::string> VideoStorage::list_videos() {
+    return list_files(".mkv");
+}
+
+std::vector<std::string> VideoStorage::list_captures() {
+    return list_files(".rtpcap");
+}
+
+std::vector<std::string> VideoStorage::list_repair_outputs() {
+    return list_files(".recover");
+}
+
+// Root (recordings from before the per-camera layout) and the camera folders below it
+std::vector<std::string> VideoStorage::list_files(const std::string& extension) {
     std::vector<std::string> files;
-    if (fs::exists(storage_dir) && fs::is_directory(storage_dir)) {
-        for (const auto& entry : fs::directory_iterator(storage_dir)) {
-            if (entry.path().extension() == ".mkv") {
+    for (const std::string& root : {storage_dir, bulk_dir}) {
+        if (root.empty() || !fs::exists(root) || !fs::is_directory(root)) continue;
+        std::error_code ec;
+        for (const auto& entry : fs::recursive_directory_iterator(root, ec)) {
+            if (entry.is_regular_file(ec) && entry.path().extension() == extension) {
                 files.push_back(entry.path().string());
             }
         }
@@ -51,9 +194,74 @@ std::vector<std::string> VideoStorage::list_videos() {
     return files;
 }
 
-std::uintmax_t VideoStorage::get_available_space() {
+void VideoStorage::set_bulk_dir(const std::string& dir) {
+    std::error_code ec;
+    fs::create_directories(dir, ec);
+    if (ec) {
+        Logger::error("[VideoStorage] Could not create the bulk tier " + dir + ": " + ec.message());
+        return;
+    }
+    bulk_dir = dir;
+    catalog.add_root(dir);
+    Logger::info("[VideoStorage] Bulk tier: " + dir);
+}
+
+static bool is_inside(const fs::path& path, const std::string& root) {
+    if (root.empty()) return false;
+    fs::path relative = path.lexically_normal().lexically_relative(fs::path(root).lexically_normal());
+    return !relative.empty() && *relative.begin() != "..";
+}
+
+bool VideoStorage::is_bulk(const std::string& path) {
+    return is_inside(fs::path(path), bulk_dir);
+}
+
+std::string VideoStorage::bulk_path_for(const std::string& path) {
+    if (bulk_dir.empty()) return "";
+    return (fs::path(bulk_dir) / fs::path(relative_path(path))).string();
+}
+
+std::string VideoStorage::camera_of(const std::string& path) {
+    fs::path relative = fs::path(relative_path(path));
+    if (!relative.has_parent_path()) return "";
+    return relative.begin()->string();
+}
+
+std::string VideoStorage::relative_path(const std::string& path) {
+    const std::string& root = is_bulk(path) ? bulk_dir : storage_dir;
+    return fs::path(path).lexically_normal().lexically_relative(fs::path(root).lexically_normal()).generic_string();
+}
+
+std::string VideoStorage::resolve(const std::string& relative) {
+    fs::path path = fs::path(relative).lexically_normal();
+    if (relative.empty() || path.is_absolute() || path.has_root_name()) return "";
+    for (const auto& part : path) {
+        if (part == "..") return "";
+    }
+    if (catalog.ready() ? !catalog.contains(path.generic_string()) : path.extension() != ".mkv") return "";
+    // Fast tier first: a file being moved is still complete there
+    for (const std::string& root : {storage_dir, bulk_dir}) {
+        if (root.empty()) continue;
+        fs::path full = fs::path(root) / path;
+        std::error_code ec;
+        if (fs::is_regular_file(full, ec)) return full.string();
+    }
+    return "";
+}
+
+std::unique_ptr<SeekIndex> VideoStorage::open_index(const std::string& video_path) {
+    auto index = std::make_unique<SeekIndex>();
+    if (!index->open(SeekIndexWriter::path_for(video_path))) return nullptr;
+    std::error_code ec;
+    uintmax_t size = fs::file_size(video_path, ec);
+    if (!ec) index->limit_to(size);
+    return index;
+}
+
+std::uintmax_t VideoStorage::get_available_space(bool bulk) {
+    if (bulk && bulk_dir.empty()) return 0;
     try {
-        return fs::space(storage_dir).available;
+        return fs::space(bulk ? bulk_dir : storage_dir).available;
     } catch (...) {
         return 0;
     }
@@ -1,21 +1,80 @@
 #pragma once
 #include <string>
 #include <vector>
+#include <memory>
 #include <cstdint>
+#include "SeekIndex.hpp"
+#include "RecordingCatalog.hpp"
 
 class VideoStorage {
 public:
     VideoStorage(const std::string& root_dir);
 
-    // Creates a filename: root_dir/YYYY-MM-DD_HH-MM-SS_DrName.mkv
-    std::string create_filename(const std::string& doctor_name);
+    // Creates a file: root_dir/CameraID/YYYY-MM-DD/YYYY-MM-DD_HH-MM-SS_DrName.mkv (or
+    // the given extension) and returns its name, or "" if it could not be created.
+    // Recordings are kept per camera so quotas can be applied, and per day so no
+    // folder grows without bound. Both names are reduced to [A-Za-z0-9_-].
+    std::string create_filename(const std::string& doctor_name, const std::string& camera_id,
+                                const std::string& extension = ".mkv");
 
-    // Returns a list of all .mkv files in the directory
+    // Atomically creates base_path + extension, or base_path_N + extension if
+    // taken, and returns the name that was created (empty file); "" on failure
+    static std::string create_exclusive(const std::string& base_path, const std::string& extension);
+
+    // name with everything but [A-Za-z0-9_-] replaced by '_' ("unknown" if empty)
+    static std::string path_component(const std::string& name);
+
+    // True for the YYYY-MM-DD folders of the layout
+    static bool is_day_folder(const std::string& name);
+
+    // Moves recordings (and their indexes) of the older flat and per camera
+    // layouts into camera/day folders; never overwrites. Meant to run while
+    // nothing is recording (video_server --migrate-storage). Returns the count.
+    size_t migrate_layout();
+
+    // Returns a list of all .mkv files in the directory and its camera folders (both tiers)
     std::vector<std::string> list_videos();
 
-    // Returns available disk space in bytes
-    std::uintmax_t get_available_space();
+    // Returns raw RTP captures (.rtpcap) still waiting for their remux
+    std::vector<std::string> list_captures();
+
+    // Returns CrashRecovery outputs (.recover) left behind by an interrupted repair
+    std::vector<std::string> list_repair_outputs();
+
+    // Camera a recording belongs to (its folder); empty for files in the root
+    std::string camera_of(const std::string& path);
+
+    // Path relative to its tier's folder ("CameraID/day/file.mkv") and back; resolve()
+    // looks in the fast tier, then the bulk tier, and returns "" for anything that
+    // is not an existing recording inside them: the catalog's, or any .mkv until
+    // its first build is done (sidecars, captures and repair leftovers never)
+    std::string relative_path(const std::string& path);
+    std::string resolve(const std::string& relative);
+
+    // Keyframe index of a recording, mapped and trimmed to the recording's
+    // current size; nullptr if it has none
+    std::unique_ptr<SeekIndex> open_index(const std::string& video_path);
+
+    const std::string& get_storage_dir() const { return storage_dir; }
+
+    // Second tier on a large (slow) disk: new recordings always land in the
+    // storage folder (fast tier) and RetentionEngine moves finalized ones here.
+    // Set before the catalog starts; empty = one tier.
+    void set_bulk_dir(const std::string& dir);
+    const std::string& get_bulk_dir() const { return bulk_dir; }
+    bool is_bulk(const std::string& path);
+    std::string bulk_path_for(const std::string& path); // Same relative path on the bulk tier
+
+    // Metadata of every recording, kept in memory for listing and search
+    RecordingCatalog& get_catalog() { return catalog; }
+
+    // Returns available disk space in bytes (of the bulk tier's disk if bulk)
+    std::uintmax_t get_available_space(bool bulk = false);
 
 private:
     std::string storage_dir;
+    std::string bulk_dir;
+    RecordingCatalog catalog;
+
+    std::vector<std::string> list_files(const std::string& extension);
 };
\ No newline at end of file
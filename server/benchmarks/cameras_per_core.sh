@@ -0,0 +1,40 @@
+#!/bin/bash
+# Cameras per core when recording muxed MKV against raw RTP capture. For
+# each mode, every camera is recorded (nobody watching) and the server's CPU
+# gives the cameras one core could record. Raw captures are remuxed later
+# when the CPU is idle, so that deferred cost is measured as well: the CPU
+# the server spends until no capture is left.
+#
+# Usage: ./cameras_per_core.sh [cameras] [seconds measured]
+CAMERAS=${1:-8}
+SECONDS_MEASURED=${2:-60}
+source "$(dirname "$0")/common.sh"
+
+captures_left() {
+    find "$WORK/recordings" -name '*.rtpcap' 2>/dev/null | wc -l
+}
+
+for MODE in muxed raw; do
+    bench_start_server
+    bench_start_cameras "$CAMERAS" $((SECONDS_MEASURED + 30))
+    bench_start_recordings "$CAMERAS" "$MODE"
+    sleep 5
+    CPU=$(bench_cpu_percent "$SECONDS_MEASURED")
+    echo -n "$MODE: $CAMERAS cameras recorded with $CPU% of a core," \
+            "$(awk -v c="$CPU" -v n="$CAMERAS" 'BEGIN { printf "%.1f", (c > 0 ? n * 100 / c : 0) }') cameras per core"
+
+    bench_stop_recordings "$CAMERAS"
+    if [ "$MODE" = raw ]; then
+        kill "${BENCH_PIDS[@]}" 2>/dev/null # Cameras off: the remux gets an idle CPU
+        BENCH_PIDS=()
+        BEFORE=$(bench_cpu_seconds)
+        STARTED=$(date +%s)
+        while [ "$(captures_left)" -gt 0 ] && [ $(($(date +%s) - STARTED)) -lt 1800 ]; do sleep 1; done
+        echo -n ", remux afterwards: $(awk -v a="$BEFORE" -v b="$(bench_cpu_seconds)" 'BEGIN { printf "%.1f", b - a }')" \
+                "CPU s in $(($(date +%s) - STARTED)) s ($(captures_left) captures left)"
+    fi
+    echo
+    sleep 2
+    bench_stop_server
+    bench_cleanup
+done
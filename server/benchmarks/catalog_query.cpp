@@ -0,0 +1,190 @@
+// Query benchmark of the recording catalog: lays out a storage folder of N
+// recordings the way VideoStorage names them (camera/day/time_doctor.mkv,
+// sparse, with a seek index each), builds the catalog over it and times the
+// /api/recordings queries against a folder walk, the way the recordings were
+// listed before the catalog.
+//
+// Usage: catalog_query [recordings] [cameras] [dir]
+// Build: see catalog_query.sh
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <filesystem>
+#include <functional>
+#include <string>
+#include <vector>
+#include "../RecordingCatalog.hpp"
+#include "../SeekIndex.hpp"
+
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr int DOCTORS = 40;
+constexpr int PER_DAY = 17; // Sessions per camera and day
+constexpr int KEYFRAMES = 8;
+
+std::string stamp(std::time_t t, const char* format) {
+    char text[32];
+    std::strftime(text, sizeof(text), format, std::localtime(&t));
+    return text;
+}
+
+// A recording of `size` bytes (sparse) and its index, as SeekIndexWriter lays it out
+void make_recording(const std::string& path, const std::string& camera, const std::string& doctor, uint64_t size,
+                    double seconds) {
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || ftruncate(fd, size) != 0) {
+        perror(path.c_str());
+        exit(1);
+    }
+    close(fd);
+
+    unsigned char header[SeekIndexWriter::HEADER_SIZE] = {};
+    uint32_t header_size = SeekIndexWriter::HEADER_SIZE, entry_size = sizeof(SeekIndexEntry);
+    int64_t created = 0;
+    memcpy(header, SeekIndexWriter::MAGIC, 8);
+    memcpy(header + 8, &header_size, 4);
+    memcpy(header + 12, &entry_size, 4);
+    memcpy(header + 16, &created, 8);
+    strncpy(reinterpret_cast<char*>(header) + 24, doctor.c_str(), SeekIndexWriter::NAME_SIZE - 1);
+    strncpy(reinterpret_cast<char*>(header) + 24 + SeekIndexWriter::NAME_SIZE, camera.c_str(),
+            SeekIndexWriter::NAME_SIZE - 1);
+    SeekIndexEntry entries[KEYFRAMES];
+    for (int i = 0; i < KEYFRAMES; ++i) {
+        entries[i] = {static_cast<uint64_t>(seconds * 1e9 * i / (KEYFRAMES - 1)), size / KEYFRAMES * i};
+    }
+    FILE* index = fopen(SeekIndexWriter::path_for(path).c_str(), "wb");
+    if (!index) {
+        perror(path.c_str());
+        exit(1);
+    }
+    fwrite(header, 1, sizeof(header), index);
+    fwrite(entries, 1, sizeof(entries), index);
+    fclose(index);
+}
+
+void populate(const std::string& dir, int recordings, int cameras) {
+    std::time_t day = std::time(nullptr) / 86400 * 86400 - 86400;
+    unsigned seed = 1;
+    auto next = [&seed]() { return seed = seed * 1103515245 + 12345, (seed >> 8); };
+    for (int n = 0; n < recordings; day -= 86400) {
+        for (int c = 0; c < cameras && n < recordings; ++c) {
+            std::string camera = "cam" + std::to_string(c);
+            std::string folder = dir + "/" + camera + "/" + stamp(day, "%Y-%m-%d");
+            fs::create_directories(folder);
+            for (int s = 0; s < PER_DAY && n < recordings; ++s, ++n) {
+                std::time_t start = day + 7 * 3600 + s * 1800 + next() % 600;
+                std::string doctor = "doctor" + std::to_string(next() % DOCTORS);
+                double seconds = 300 + next() % 1500;
+                uint64_t size = static_cast<uint64_t>(seconds * 1.1e6); // ~9 Mbit/s
+                make_recording(folder + "/" + stamp(start, "%Y-%m-%d_%H-%M-%S_") + doctor + ".mkv", camera, doctor,
+                               size, seconds);
+            }
+        }
+    }
+}
+
+// Before the catalog: every listing walked the folder and stat'ed each file
+size_t walk(const std::string& dir, const std::string& doctor) {
+    struct Found {
+        std::string path;
+        uint64_t size;
+    };
+    std::vector<Found> found;
+    std::error_code ec;
+    for (const auto& entry : fs::recursive_directory_iterator(dir, ec)) {
+        if (!entry.is_regular_file(ec) || entry.path().extension() != ".mkv") continue;
+        std::string stem = entry.path().stem().string();
+        if (!doctor.empty() && (stem.size() <= 20 || stem.substr(20) != doctor)) continue;
+        found.push_back({entry.path().string(), static_cast<uint64_t>(entry.file_size(ec))});
+    }
+    std::sort(found.begin(), found.end(), [](const Found& a, const Found& b) {
+        return fs::path(a.path).filename() > fs::path(b.path).filename();
+    });
+    return found.size();
+}
+
+// Median and worst of `runs` calls, in microseconds
+void time_it(const char* name, int runs, const std::function<size_t()>& run) {
+    std::vector<double> us;
+    size_t total = 0;
+    for (int i = 0; i < runs; ++i) {
+        auto started = std::chrono::steady_clock::now();
+        total = run();
+        us.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - started).count());
+    }
+    std::sort(us.begin(), us.end());
+    printf("  %-34s %10.1f us median %10.1f us max  (%zu matches)\n", name, us[us.size() / 2], us.back(), total);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    int recordings = argc > 1 ? atoi(argv[1]) : 100000;
+    int cameras = argc > 2 ? atoi(argv[2]) : 16;
+    std::string dir = argc > 3 ? argv[3] : "./catalog_bench";
+    if (fs::exists(dir)) {
+        fprintf(stderr, "%s exists, give a new folder\n", dir.c_str());
+        return 2;
+    }
+
+    auto started = std::chrono::steady_clock::now();
+    populate(dir, recordings, cameras);
+    printf("%d recordings over %d cameras laid out in %.1f s\n", recordings, cameras,
+           std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count());
+
+    RecordingCatalog catalog(dir);
+    started = std::chrono::steady_clock::now();
+    catalog.start();
+    printf("Catalog built in %.1f ms (%zu recordings)\n",
+           std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - started).count(),
+           catalog.size());
+
+    RecordingPage latest = catalog.query(RecordingQuery());
+    std::string doctor = latest.items.empty() ? "doctor0" : latest.items[0].doctor;
+    int64_t last_start = latest.items.empty() ? 0 : latest.items[0].start;
+
+    printf("Folder walk (before the catalog):\n");
+    time_it("all, one doctor", 3, [&]() { return walk(dir, doctor); });
+    printf("Catalog:\n");
+    time_it("latest 50", 200, [&]() { return catalog.query(RecordingQuery()).total; });
+    time_it("one camera, last 24 h", 200, [&]() {
+        RecordingQuery q;
+        q.camera = "cam0";
+        q.from = last_start - 86399;
+        q.to = last_start;
+        return catalog.query(q).total;
+    });
+    time_it("one doctor, latest 50", 200, [&]() {
+        RecordingQuery q;
+        q.doctor = doctor;
+        return catalog.query(q).total;
+    });
+    time_it("largest 50", 100, [&]() {
+        RecordingQuery q;
+        q.sort = RecordingQuery::BY_SIZE;
+        return catalog.query(q).total;
+    });
+    time_it("longest, page 1000", 100, [&]() {
+        RecordingQuery q;
+        q.sort = RecordingQuery::BY_DURATION;
+        q.offset = 1000 * q.limit;
+        return catalog.query(q).total;
+    });
+    time_it("last page (offset total-50)", 100, [&]() {
+        RecordingQuery q;
+        q.offset = recordings - 50;
+        return catalog.query(q).total;
+    });
+
+    catalog.stop();
+    fs::remove_all(dir);
+    return 0;
+}
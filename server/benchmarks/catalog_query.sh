@@ -0,0 +1,15 @@
+#!/bin/bash
+# Query times of the recording catalog against a folder walk: builds
+# catalog_query.cpp against ../RecordingCatalog.cpp and runs it over a
+# generated storage folder (sparse files, removed afterwards). Put DIR on the
+# recordings disk.
+#
+# Usage: ./catalog_query.sh [recordings] [cameras] [dir]
+RECORDINGS=${1:-100000}
+CAMERAS=${2:-16}
+DIR=${3:-./catalog_bench}
+cd "$(dirname "$0")" || exit 1
+
+g++ -o catalog_query catalog_query.cpp ../RecordingCatalog.cpp ../SeekIndex.cpp \
+    $(pkg-config --cflags --libs gstreamer-1.0) -lpthread -O2 || exit 1
+./catalog_query "$RECORDINGS" "$CAMERAS" "$DIR"
@@ -0,0 +1,121 @@
+# Helpers for the end-to-end benchmarks, sourced by the scripts next to it.
+# They run the server in a scratch folder and replay a pre-encoded 1080p
+# clip as cameras, the way connection.sh sends (H.264 RTP to 239.0.0.1).
+# Needs gst-launch-1.0 with x264enc, curl and a multicast route on this host.
+#
+# SERVER_BIN: server to measure (default ../video_server, see
+# installation_linux.sh); point it at a build of an older commit to compare.
+SERVER_BIN=$(realpath "${SERVER_BIN:-$(dirname "${BASH_SOURCE[0]}")/../video_server}")
+BENCH_CACHE=${BENCH_CACHE:-${XDG_CACHE_HOME:-$HOME/.cache}/video_server_bench}
+FIRST_PORT=5100 # Away from discovery (5001) and the observer groups (7000+)
+CLK_TCK=$(getconf CLK_TCK)
+
+BENCH_PIDS=()
+WORK=""
+SERVER_PID=""
+
+bench_cleanup() {
+    [ ${#BENCH_PIDS[@]} -gt 0 ] && kill "${BENCH_PIDS[@]}" 2>/dev/null
+    [ -n "$SERVER_PID" ] && kill "$SERVER_PID" 2>/dev/null && wait "$SERVER_PID" 2>/dev/null
+    [ -n "$WORK" ] && rm -rf "$WORK"
+    BENCH_PIDS=()
+    SERVER_PID=""
+    WORK=""
+}
+trap bench_cleanup EXIT
+
+# Starts the server in a new scratch folder. Its console reads a fifo kept
+# open on fd 9 (send commands with: echo "stop doc" >&9)
+bench_start_server() {
+    [ -x "$SERVER_BIN" ] || { echo "No server at $SERVER_BIN (set SERVER_BIN)" >&2; exit 1; }
+    WORK=$(mktemp -d)
+    mkfifo "$WORK/console"
+    (cd "$WORK" && exec "$SERVER_BIN" < console > server.log 2>&1) &
+    SERVER_PID=$!
+    exec 9> "$WORK/console"
+    for _ in $(seq 50); do
+        curl -s -o /dev/null http://127.0.0.1:8080/api/stats && return 0
+        sleep 0.2
+    done
+    echo "Server did not come up, see $WORK/server.log" >&2
+    exit 1
+}
+
+bench_stop_server() {
+    echo quit >&9
+    exec 9>&-
+    wait "$SERVER_PID" 2>/dev/null
+    SERVER_PID=""
+}
+
+# A 1080p30 clip at ~10 Mbit/s with a keyframe per second, encoded once
+bench_clip() {
+    local seconds=$1
+    local clip="$BENCH_CACHE/clip_${seconds}s.mkv"
+    if [ ! -f "$clip" ]; then
+        mkdir -p "$BENCH_CACHE"
+        echo "Encoding a ${seconds} s test clip (once)..." >&2
+        gst-launch-1.0 -q -e videotestsrc pattern=ball num-buffers=$((seconds * 30)) ! \
+            video/x-raw,width=1920,height=1080,framerate=30/1 ! \
+            x264enc bitrate=10000 key-int-max=30 speed-preset=ultrafast tune=zerolatency ! \
+            video/x-h264,profile=high ! h264parse ! matroskamux ! filesink location="$clip.part" &&
+            mv "$clip.part" "$clip" || exit 1
+    fi
+    echo "$clip"
+}
+
+# Replays the clip in real time as cameras cam0..cam<n-1> and registers them
+bench_start_cameras() {
+    local count=$1 seconds=$2
+    local clip
+    clip=$(bench_clip "$seconds")
+    for ((i = 0; i < count; i++)); do
+        local port=$((FIRST_PORT + 2 * i))
+        gst-launch-1.0 -q filesrc location="$clip" ! matroskademux ! h264parse ! \
+            rtph264pay config-interval=1 pt=96 mtu=1400 ! \
+            udpsink host=239.0.0.1 port=$port auto-multicast=true sync=true > /dev/null 2>&1 &
+        BENCH_PIDS+=($!)
+        printf 'REGISTER cam%d %d' "$i" "$port" > /dev/udp/127.0.0.1/5001
+    done
+    sleep 3 # Ingests up and past their first keyframe
+}
+
+# One RTSP client per camera, as a TV on the mount would be
+bench_start_viewers() {
+    local count=$1
+    for ((i = 0; i < count; i++)); do
+        gst-launch-1.0 -q rtspsrc location=rtsp://127.0.0.1:8554/live/cam$i latency=200 ! \
+            fakesink sync=false > /dev/null 2>&1 &
+        BENCH_PIDS+=($!)
+    done
+}
+
+# Records every camera (mode: muxed, raw or uring), doctor bench<i>
+bench_start_recordings() {
+    local count=$1 mode=$2
+    local query=""
+    [ "$mode" != "muxed" ] && query="&mode=$mode"
+    for ((i = 0; i < count; i++)); do
+        curl -s -o /dev/null "http://127.0.0.1:8080/api/start?doc=bench$i&id=cam$i$query"
+    done
+}
+
+bench_stop_recordings() {
+    local count=$1
+    for ((i = 0; i < count; i++)); do echo "stop bench$i" >&9; done
+}
+
+# CPU seconds the server has used so far (user + system)
+bench_cpu_seconds() {
+    awk -v tck="$CLK_TCK" '{ printf "%.2f\n", ($14 + $15) / tck }' "/proc/$SERVER_PID/stat"
+}
+
+# Server CPU in percent of one core over the next <seconds>
+bench_cpu_percent() {
+    local seconds=$1
+    local before after
+    before=$(bench_cpu_seconds)
+    sleep "$seconds"
+    after=$(bench_cpu_seconds)
+    awk -v a="$before" -v b="$after" -v s="$seconds" 'BEGIN { printf "%.1f\n", (b - a) * 100 / s }'
+}
@@ -0,0 +1,22 @@
+#!/bin/bash
+# Server CPU per camera with every camera watched over RTSP and recorded at
+# the same time, the case the shared ingest is for. Run it once with a build
+# from before the shared ingest (5d5da5e~1) and once with the current one:
+#   git worktree add /tmp/before 5d5da5e~1   (then build it as usual)
+#   SERVER_BIN=/tmp/before/server/video_server ./cpu_per_camera.sh 8
+#   ./cpu_per_camera.sh 8
+#
+# Usage: ./cpu_per_camera.sh [cameras] [seconds measured]
+CAMERAS=${1:-8}
+SECONDS_MEASURED=${2:-60}
+source "$(dirname "$0")/common.sh"
+
+bench_start_server
+bench_start_cameras "$CAMERAS" $((SECONDS_MEASURED + 30))
+bench_start_viewers "$CAMERAS"
+bench_start_recordings "$CAMERAS" muxed
+sleep 5 # Clients playing, recorders past their first fragment
+
+CPU=$(bench_cpu_percent "$SECONDS_MEASURED")
+echo "$(basename "$SERVER_BIN") $CAMERAS cameras (RTSP + recording each): $CPU% of a core," \
+     "$(awk -v c="$CPU" -v n="$CAMERAS" 'BEGIN { printf "%.2f", c / n }')% per camera"
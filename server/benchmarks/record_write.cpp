@@ -0,0 +1,176 @@
+// Write benchmark of the recording sinks: N concurrent recordings of a
+// matroskamux-like byte stream, pushed as fast as the sink takes them.
+// Each recording gets a header, then one cluster per GOP (a 200 KB keyframe
+// and 59 frames of 35 KB, ~9 Mbit/s at 30 fps) whose size is patched once
+// the cluster is complete, then cues and the header rewritten at the end.
+// Prints the throughput and the page cache the files held (mincore, sampled
+// every 100 ms while writing). With "+crc" the sink also gets a
+// ChecksumWriter, as StreamEngine attaches one, and the chunk data it held
+// for summing is printed too.
+//
+// Usage: record_write <filesink|recordsink|recordsink-uring>[+crc] [recordings] [MB each] [dir]
+// Build and comparison of all of them: see record_write.sh
+#include <gst/gst.h>
+#include <gst/check/gstharness.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../Checksum.hpp"
+#include "../RecordSink.hpp"
+
+namespace {
+
+constexpr size_t HEADER = 4096;
+constexpr size_t KEYFRAME = 200 * 1024;
+constexpr size_t FRAME = 35 * 1024;
+constexpr int GOP = 60;
+constexpr size_t CLUSTER_HEADER = 16;
+
+std::vector<guint8> payload(KEYFRAME);
+
+void push(GstHarness* h, size_t size) {
+    // Wraps the shared payload: the sinks only read it
+    GstBuffer* buffer = gst_buffer_new_wrapped_full(GST_MEMORY_FLAG_READONLY, payload.data(), payload.size(), 0, size,
+                                                    nullptr, nullptr);
+    gst_harness_push(h, buffer);
+}
+
+void seek(GstHarness* h, guint64 offset) {
+    GstSegment segment;
+    gst_segment_init(&segment, GST_FORMAT_BYTES);
+    segment.start = offset;
+    segment.time = offset;
+    gst_harness_push_event(h, gst_event_new_segment(&segment));
+}
+
+void record(const std::string& sink, bool checksum, const std::string& location, guint64 bytes) {
+    GstElement* element = gst_element_factory_make(sink == "filesink" ? "filesink" : RECORD_SINK_FACTORY, nullptr);
+    g_object_set(element, "location", location.c_str(), nullptr);
+    if (sink != "filesink") {
+        // As StreamEngine configures it (main.cpp)
+        g_object_set(element, "preallocate", (guint64)64 * 1024 * 1024, "batch-size", 1024 * 1024,
+                     "sync-interval", 5, "io-uring", sink == "recordsink-uring", nullptr);
+    }
+    if (checksum) ChecksumWriter::attach(element);
+    GstHarness* h = gst_harness_new_with_element(element, "sink", nullptr);
+    gst_harness_set_src_caps_str(h, "video/x-matroska");
+    seek(h, 0);
+
+    guint64 end = 0;
+    push(h, HEADER);
+    end += HEADER;
+    while (end < bytes) {
+        guint64 cluster = end;
+        push(h, CLUSTER_HEADER);
+        end += CLUSTER_HEADER;
+        for (int frame = 0; frame < GOP; ++frame) {
+            size_t size = frame == 0 ? KEYFRAME : FRAME;
+            push(h, size);
+            end += size;
+        }
+        // Cluster complete: its size is patched, then back to the end
+        seek(h, cluster + 4);
+        push(h, 8);
+        seek(h, end);
+    }
+    push(h, 64 * 1024); // Cues
+    end += 64 * 1024;
+    seek(h, 0);
+    push(h, HEADER);
+    seek(h, end);
+    gst_harness_push_event(h, gst_event_new_eos());
+    gst_harness_teardown(h);
+    gst_object_unref(element);
+}
+
+// Bytes of the files resident in the page cache
+guint64 cached(const std::vector<std::string>& files) {
+    static const long page = sysconf(_SC_PAGESIZE);
+    guint64 total = 0;
+    for (const auto& file : files) {
+        int fd = open(file.c_str(), O_RDONLY);
+        if (fd < 0) continue;
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            void* map = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+            if (map != MAP_FAILED) {
+                std::vector<unsigned char> pages((st.st_size + page - 1) / page);
+                if (mincore(map, st.st_size, pages.data()) == 0) {
+                    for (unsigned char p : pages) total += (p & 1) ? page : 0;
+                }
+                munmap(map, st.st_size);
+            }
+        }
+        close(fd);
+    }
+    return total;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    gst_init(&argc, &argv);
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <filesink|recordsink|recordsink-uring>[+crc] [recordings] [MB each] [dir]\n",
+                argv[0]);
+        return 2;
+    }
+    std::string name = argv[1];
+    bool checksum = name.size() > 4 && name.compare(name.size() - 4, 4, "+crc") == 0;
+    std::string sink = checksum ? name.substr(0, name.size() - 4) : name;
+    int recordings = argc > 2 ? atoi(argv[2]) : 8;
+    guint64 bytes = (argc > 3 ? strtoull(argv[3], nullptr, 10) : 1024) * 1024 * 1024;
+    std::string dir = argc > 4 ? argv[4] : ".";
+    if (sink != "filesink" && !record_sink_register()) {
+        fprintf(stderr, "recordsink is not available here\n");
+        return 1;
+    }
+    for (size_t i = 0; i < payload.size(); ++i) payload[i] = static_cast<guint8>(i * 2654435761u >> 24);
+
+    std::vector<std::string> files;
+    for (int i = 0; i < recordings; ++i) files.push_back(dir + "/bench_" + std::to_string(i) + ".mkv");
+    std::atomic<bool> done{false};
+    guint64 peak = 0, sum = 0, samples = 0;
+    std::thread monitor([&]() {
+        while (!done) {
+            guint64 now = cached(files);
+            peak = std::max(peak, now);
+            sum += now;
+            samples++;
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+    });
+
+    auto started = std::chrono::steady_clock::now();
+    std::vector<std::thread> writers;
+    for (int i = 0; i < recordings; ++i) writers.emplace_back(record, sink, checksum, files[i], bytes);
+    for (auto& writer : writers) writer.join();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    done = true;
+    monitor.join();
+
+    guint64 written = 0;
+    for (const auto& file : files) {
+        struct stat st;
+        if (stat(file.c_str(), &st) == 0) written += st.st_size;
+    }
+    printf("%-20s %d x %llu MB: %.0f MB/s, page cache peak %.0f MB, mean %.0f MB, after close %.0f MB",
+           name.c_str(), recordings, (unsigned long long)(bytes >> 20), written / 1048576.0 / seconds,
+           peak / 1048576.0, samples ? sum / samples / 1048576.0 : 0.0, cached(files) / 1048576.0);
+    if (checksum) printf(", checksum chunks held peak %.0f MB", ChecksumWriter::peak_pending_bytes() / 1048576.0);
+    printf("\n");
+    for (const auto& file : files) {
+        unlink(file.c_str());
+        unlink(ChecksumWriter::path_for(file).c_str());
+    }
+    return 0;
+}
@@ -0,0 +1,25 @@
+#!/bin/bash
+# Write throughput and page cache footprint of filesink against recordsink
+# (plain writes and io_uring, each without and with the checksum sidecar)
+# with concurrent recordings: builds record_write.cpp against
+# ../RecordSink.cpp and ../Checksum.cpp and runs it once per sink.
+# Put DIR on the recordings disk; the files are removed afterwards.
+#
+# Usage: ./record_write.sh [recordings] [MB each] [dir]
+RECORDINGS=${1:-8}
+MB=${2:-1024}
+DIR=${3:-.}
+cd "$(dirname "$0")" || exit 1
+
+URING_FLAGS=""
+if pkg-config --exists liburing; then
+    URING_FLAGS="-DHAVE_LIBURING $(pkg-config --cflags --libs liburing)"
+fi
+g++ -o record_write record_write.cpp ../RecordSink.cpp ../Checksum.cpp \
+    $(pkg-config --cflags --libs gstreamer-check-1.0 gstreamer-base-1.0) \
+    $URING_FLAGS -lpthread -O2 || exit 1
+
+for SINK in filesink recordsink recordsink+crc recordsink-uring recordsink-uring+crc; do
+    sync
+    ./record_write "$SINK" "$RECORDINGS" "$MB" "$DIR"
+done
@@ -0,0 +1,55 @@
+#!/bin/bash
+# RTSP client setup latency with 16 cameras under load: every camera is
+# watched and recorded, BURNERS busy loops compete for the cores, and then
+# all cameras get a new client at once, for several rounds. Each client is
+# timed from connect to the DESCRIBE reply, which is when the server has
+# built or shared the media. To compare with the single main loop, run it
+# once more with a build of 607fa83~1 (SERVER_BIN, see common.sh).
+#
+# Usage: ./setup_latency.sh [cameras] [rounds] [burners]
+CAMERAS=${1:-16}
+ROUNDS=${2:-10}
+BURNERS=${3:-$(nproc)}
+source "$(dirname "$0")/common.sh"
+
+bench_start_server
+bench_start_cameras "$CAMERAS" $((ROUNDS * 3 + 60))
+bench_start_viewers "$CAMERAS"
+bench_start_recordings "$CAMERAS" muxed
+for ((i = 0; i < BURNERS; i++)); do
+    sh -c 'while :; do :; done' &
+    BENCH_PIDS+=($!)
+done
+sleep 5
+
+# Prints the seconds each client took to get the DESCRIBE status line
+describe_all() {
+    local clients=()
+    for ((i = 0; i < CAMERAS; i++)); do
+        (
+            started=$(date +%s%N)
+            exec 3<> /dev/tcp/127.0.0.1/8554 || exit
+            printf 'DESCRIBE rtsp://127.0.0.1:8554/live/cam%d RTSP/1.0\r\nCSeq: 1\r\nAccept: application/sdp\r\n\r\n' "$i" >&3
+            read -r -t 20 _ <&3 && awk -v ns=$(($(date +%s%N) - started)) 'BEGIN { print ns / 1e9 }'
+        ) &
+        clients+=($!)
+    done
+    wait "${clients[@]}"
+}
+
+for ((round = 1; round <= ROUNDS; round++)); do
+    describe_all
+    sleep 2
+done > "$WORK/latency.txt"
+
+# Median, 95th percentile and max in ms
+report() {
+    sort -n | awk '{ v[NR] = $1 * 1000 }
+        END {
+            if (!NR) exit
+            p95 = int(NR * 0.95); if (p95 < 1) p95 = 1
+            printf "%d clients: median %.1f ms, p95 %.1f ms, max %.1f ms\n", NR, v[int((NR + 1) / 2)], v[p95], v[NR]
+        }'
+}
+echo -n "$(basename "$SERVER_BIN") $CAMERAS cameras (RTSP + recording each), $BURNERS busy loops, "
+report < "$WORK/latency.txt"
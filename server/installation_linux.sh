@@ -4,19 +4,25 @@ echo "--- Nandadeep Server Installation (Linux) ---"
 
 echo "[1/3] Installing Dependencies..."
 sudo apt-get update
-sudo apt-get install -y build-essential pkg-config \
+sudo apt-get install -y build-essential pkg-config liburing-dev \
     libgstreamer1.0-dev libgstreamer-plugins-base1.0-dev \
     libgstrtspserver-1.0-dev gstreamer1.0-tools \
-    gstreamer1.0-plugins-good gstreamer1.0-plugins-bad gstreamer1.0-plugins-ugly
+    gstreamer1.0-plugins-good gstreamer1.0-plugins-bad gstreamer1.0-plugins-ugly \
+    gstreamer1.0-libav
 
 echo "[2/3] Creating Directories..."
 mkdir -p recordings
 
 echo "[3/3] Compiling Server..."
+# io_uring writes for recordings are optional
+URING_FLAGS=""
+if pkg-config --exists liburing; then
+    URING_FLAGS="-DHAVE_LIBURING $(pkg-config --cflags --libs liburing)"
+fi
 # Compiles all cpp files in the directory and links GStreamer
-g++ -o video_server main.cpp StreamEngine.cpp VideoStorage.cpp SessionManager.cpp Logger.cpp \
-    $(pkg-config --cflags --libs gstreamer-1.0 gstreamer-rtsp-server-1.0) \
-    -lpthread -O2
+g++ -o video_server main.cpp Checksum.cpp ContextThread.cpp CrashRecovery.cpp HlsPackager.cpp IngestPipeline.cpp RecordingCatalog.cpp RecordSink.cpp RetentionEngine.cpp RtpCapture.cpp SeekIndex.cpp StreamEngine.cpp Transcoder.cpp VideoStorage.cpp SessionManager.cpp Logger.cpp \
+    $(pkg-config --cflags --libs gstreamer-1.0 gstreamer-rtsp-server-1.0 gstreamer-app-1.0 gstreamer-base-1.0) \
+    $URING_FLAGS -lpthread -O2
 
 echo "-------------------------------------------"
 echo "Installation Complete."
@@ -15,14 +15,15 @@ echo "[1/3] Installing Dependencies via Pacman..."
 pacman -S --noconfirm mingw-w64-x86_64-gcc mingw-w64-x86_64-pkg-config \
     mingw-w64-x86_64-gstreamer mingw-w64-x86_64-gst-rtsp-server \
     mingw-w64-x86_64-gst-plugins-base mingw-w64-x86_64-gst-plugins-good \
-    mingw-w64-x86_64-gst-plugins-bad mingw-w64-x86_64-gst-plugins-ugly
+    mingw-w64-x86_64-gst-plugins-bad mingw-w64-x86_64-gst-plugins-ugly \
+    mingw-w64-x86_64-gst-libav
 
 echo "[2/3] Creating Directories..."
 mkdir -p recordings
 
 echo "[3/3] Compiling Server..."
-g++ -o video_server.exe main.cpp StreamEngine.cpp VideoStorage.cpp SessionManager.cpp Logger.cpp \
-    $(pkg-config --cflags --libs gstreamer-1.0 gstreamer-rtsp-server-1.0) \
+g++ -o video_server.exe main.cpp Checksum.cpp ContextThread.cpp CrashRecovery.cpp HlsPackager.cpp IngestPipeline.cpp RecordingCatalog.cpp RecordSink.cpp RetentionEngine.cpp RtpCapture.cpp SeekIndex.cpp StreamEngine.cpp Transcoder.cpp VideoStorage.cpp SessionManager.cpp Logger.cpp \
+    $(pkg-config --cflags --libs gstreamer-1.0 gstreamer-rtsp-server-1.0 gstreamer-app-1.0 gstreamer-base-1.0) \
     -lws2_32 -static-libgcc -static-libstdc++ -O2
 
 echo "-------------------------------------------"
@@ -6,6 +6,7 @@
 #include "SessionManager.hpp"
 #include "VideoStorage.hpp"
 #include "StreamEngine.hpp"
+#include "Checksum.hpp"
 #include <cstring>
 #include <algorithm>
 #include "Logger.hpp"
@@ -14,22 +15,41 @@
 #include <functional>
 #include <condition_variable>
 #include <csignal>
+#include <iomanip>
+#include <cstdio>
+#include <cstdlib>
+#include <cctype>
+#include <ctime>
+#include <atomic>
+#include <chrono>
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/stat.h>
 
 #ifdef _WIN32
     #include <winsock2.h>
     #include <ws2tcpip.h>
+    #include <io.h>
     #define close closesocket
 #else
     #include <sys/socket.h>
+    #include <sys/time.h>
     #include <netinet/in.h>
     #include <arpa/inet.h>
     #include <unistd.h>
 #endif
+#ifdef __linux__
+    #include <sys/sendfile.h>
+#endif
+#ifndef O_BINARY
+    #define O_BINARY 0
+#endif
 
 // Global objects for simplified thread access
 SessionManager sessionMgr;
 VideoStorage storage("./recordings");
 StreamEngine engine(storage);
+ChecksumScan checksum_scan;
 
 // Map to store which port each camera is using (ID -> Port)
 std::map<std::string, int> node_ports;
@@ -39,15 +59,19 @@ void command_listener() {
     // Simple Console Interface to simulate API calls (Mobile/Fingerprint)
     std::string cmd;
     while (true) {
-        std::cout << "\nCommands: [start <DocName> <Port>] [stop <DocName>] [list] [nodes] > ";
+        std::cout << "\nCommands: [start <DocName> <Port> [raw|uring]] [stop <DocName>] [list] [nodes] [ingest] > ";
         std::cin >> cmd;
 
         if (cmd == "start") {
-            std::string doc;
+            std::string doc, rest;
             int port;
             std::cin >> doc >> port;
+            std::getline(std::cin, rest);
+            StreamEngine::RecordMode mode = StreamEngine::MUXED;
+            if (rest.find("raw") != std::string::npos) mode = StreamEngine::RAW_RTP;
+            else if (rest.find("uring") != std::string::npos) mode = StreamEngine::MUXED_URING;
             sessionMgr.start_session(doc);
-            engine.start_recording(doc, port);
+            engine.start_recording(doc, port, mode);
         } 
         else if (cmd == "stop") {
             std::string doc;
@@ -56,9 +80,26 @@ void command_listener() {
             engine.stop_recording(doc);
         } 
         else if (cmd == "list") {
-            auto files = storage.list_videos();
-            std::cout << "--- Saved Videos ---" << std::endl;
-            for (const auto& f : files) std::cout << f << std::endl;
+            RecordingQuery query;
+            query.limit = SIZE_MAX;
+            RecordingPage page = storage.get_catalog().query(query);
+            std::cout << "--- Saved Videos (" << page.total << ") ---" << std::endl;
+            for (const auto& r : page.items) {
+                std::cout << r.path << "  " << r.size / (1024 * 1024) << " MB  " << static_cast<long>(r.duration) << " s"
+                          << (r.live ? "  [recording]" : "") << std::endl;
+            }
+        }
+        else if (cmd == "ingest") {
+            std::cout << "--- Camera Ingests ---" << std::endl;
+            for (const auto& info : engine.get_ingest_info()) {
+                std::cout << "Port " << info.port << ": " << info.consumers << " consumer(s), pre-roll "
+                          << info.preroll_bytes / 1024 << " KB";
+                if (info.health.reliable) {
+                    std::cout << ", rtx " << info.health.rtx_recovered << "/" << info.health.rtx_requests
+                              << " recovered, " << info.health.lost << " lost";
+                }
+                std::cout << std::endl;
+            }
         }
         else if (cmd == "nodes") {
             // Simulate adding a node (in real app, this comes from network discovery)
@@ -97,23 +138,437 @@ void discovery_listener() {
         if (n > 0) {
             buffer[n] = '\0';
             std::string msg(buffer);
-            // Expected format: "REGISTER <NAME> <PORT>"
+            // Expected format: "REGISTER <NAME> <PORT> [rtx]"
             if (msg.rfind("REGISTER ", 0) == 0) {
                 std::stringstream ss(msg.substr(9));
-                std::string id;
+                std::string id, mode;
                 int port = 5000; // Default if not specified
                 ss >> id;
                 if (!(ss >> port)) port = 5000;
+                else ss >> mode;
+
+                // "rtx": the sender runs connection.sh --reliable and retransmits on NACK
+                IngestOptions options;
+                options.reliable = mode == "rtx";
+                options.sender_ip = inet_ntoa(cliaddr.sin_addr);
 
                 id.erase(std::remove(id.begin(), id.end(), '\n'), id.end());
-                
-                std::lock_guard<std::mutex> lock(node_ports_mutex);
-                node_ports[id] = port;
+                // The ID names the camera's storage folder, mount and HLS path:
+                // only what VideoStorage would keep unchanged
+                if (VideoStorage::path_component(id) != id) {
+                    Logger::error("[Discovery] Rejected camera ID from " + options.sender_ip + ": \"" + id + "\"");
+                    continue;
+                }
+
+                {
+                    std::lock_guard<std::mutex> lock(node_ports_mutex);
+                    node_ports[id] = port;
+                }
                 
                 sessionMgr.register_node(id, inet_ntoa(cliaddr.sin_addr));
+                engine.add_camera(id, port, options);
             }
+            // Expected format: "UNREGISTER <NAME>"
+            else if (msg.rfind("UNREGISTER ", 0) == 0) {
+                std::stringstream ss(msg.substr(11));
+                std::string id;
+                ss >> id;
+
+                {
+                    std::lock_guard<std::mutex> lock(node_ports_mutex);
+                    node_ports.erase(id);
+                }
+
+                sessionMgr.unregister_node(id);
+                engine.remove_camera(id);
+            }
+        }
+    }
+}
+
+// Simple ThreadPool to prevent creating too many threads
+class ThreadPool {
+    std::vector<std::thread> workers;
+    std::queue<std::function<void()>> tasks;
+    std::mutex queue_mutex;
+    std::condition_variable condition;
+    bool stop = false;
+public:
+    ThreadPool(size_t threads) {
+        for(size_t i = 0; i < threads; ++i)
+            workers.emplace_back([this] {
+                while(true) {
+                    std::function<void()> task;
+                    {
+                        std::unique_lock<std::mutex> lock(this->queue_mutex);
+                        this->condition.wait(lock, [this]{ return this->stop || !this->tasks.empty(); });
+                        if(this->stop && this->tasks.empty()) return;
+                        task = std::move(this->tasks.front());
+                        this->tasks.pop();
+                    }
+                    task();
+                }
+            });
+    }
+    ~ThreadPool() {
+        { std::unique_lock<std::mutex> lock(queue_mutex); stop = true; }
+        condition.notify_all();
+        for(std::thread &worker: workers) worker.join();
+    }
+    void enqueue(std::function<void()> task) {
+        { std::unique_lock<std::mutex> lock(queue_mutex); tasks.push(task); }
+        condition.notify_one();
+    }
+};
+
+// Sends the whole buffer (send() may return early on large bodies)
+void send_all(int socket, const std::string& data) {
+    size_t sent = 0;
+    while (sent < data.length()) {
+        int n = send(socket, data.c_str() + sent, data.length() - sent, 0);
+        if (n <= 0) return;
+        sent += n;
+    }
+}
+
+// Media requests can stream for a long time, so they run on their own pool
+// and never hold up the control API threads (LL-HLS blocking requests have
+// one of their own, see blocking_hls_pool())
+ThreadPool& media_pool() {
+    static ThreadPool pool(32);
+    return pool;
+}
+
+long query_param(const std::string& query, const std::string& key) {
+    size_t pos = query.find(key + "=");
+    if (pos == std::string::npos) return -1;
+    return std::strtol(query.c_str() + pos + key.length() + 1, nullptr, 10);
+}
+
+std::string url_decode(const std::string& raw) {
+    std::string value;
+    for (size_t i = 0; i < raw.size(); ++i) {
+        if (raw[i] == '%' && i + 2 < raw.size() && std::isxdigit((unsigned char)raw[i + 1]) &&
+            std::isxdigit((unsigned char)raw[i + 2])) {
+            value += static_cast<char>(std::stoi(raw.substr(i + 1, 2), nullptr, 16));
+            i += 2;
+        } else {
+            value += raw[i] == '+' ? ' ' : raw[i];
+        }
+    }
+    return value;
+}
+
+// Percent-decoded string parameter ("" if missing)
+std::string query_string(const std::string& query, const std::string& key) {
+    size_t pos = 0;
+    while ((pos = query.find(key + "=", pos)) != std::string::npos) {
+        if (pos == 0 || query[pos - 1] == '&' || query[pos - 1] == '?') break;
+        pos += key.length();
+    }
+    if (pos == std::string::npos) return "";
+    size_t start = pos + key.length() + 1;
+    size_t end = query.find_first_of("& ", start);
+    return url_decode(query.substr(start, end == std::string::npos ? std::string::npos : end - start));
+}
+
+// For names that come from the network or the disk (doctor names, file names)
+std::string json_escape(const std::string& value) {
+    std::string out;
+    for (char c : value) {
+        if (c == '"' || c == '\\') out += '\\';
+        if (static_cast<unsigned char>(c) < 0x20) {
+            char code[8];
+            snprintf(code, sizeof(code), "\\u%04x", c);
+            out += code;
+        } else {
+            out += c;
+        }
+    }
+    return out;
+}
+
+std::string checksum_result_json(const ChecksumResult& r) {
+    std::stringstream json;
+    json << "{\"file\":\"" << json_escape(storage.relative_path(r.path)) << "\", \"status\":\""
+         << ChecksumResult::status_name(r.status) << "\", \"size\":" << r.size << ", \"chunks\":" << r.chunks
+         << ", \"bad_chunks\":" << r.bad_chunks << ", \"unchecked_chunks\":" << r.unchecked_chunks;
+    if (r.bad_chunks) json << ", \"first_bad_offset\":" << r.first_bad_offset;
+    json << "}";
+    return json.str();
+}
+
+// Value of a request header (case-insensitive name), "" if absent
+std::string header_value(const std::string& request, const std::string& name) {
+    std::string lower = request;
+    std::transform(lower.begin(), lower.end(), lower.begin(), [](unsigned char c) { return std::tolower(c); });
+    std::string key = "\r\n" + name + ":";
+    std::transform(key.begin(), key.end(), key.begin(), [](unsigned char c) { return std::tolower(c); });
+    size_t pos = lower.find(key);
+    if (pos == std::string::npos) return "";
+    size_t start = request.find_first_not_of(" \t", pos + key.length());
+    size_t end = request.find("\r\n", pos + key.length());
+    if (start == std::string::npos || start >= end) return "";
+    return request.substr(start, end - start);
+}
+
+// --- Live LL-HLS: /hls/<camera_id>/{index.m3u8,init.mp4,seg_N.m4s,part_N_P.m4s} ---
+void handle_hls_request(int socket, const std::string& request) {
+    size_t path_end = request.find(' ', 4);
+    std::string path = request.substr(4, path_end == std::string::npos ? std::string::npos : path_end - 4);
+    std::string query;
+    size_t query_pos = path.find('?');
+    if (query_pos != std::string::npos) {
+        query = path.substr(query_pos + 1);
+        path = path.substr(0, query_pos);
+    }
+
+    std::string rest = path.substr(5); // strip "/hls/"
+    size_t slash = rest.find('/');
+    std::string cam_id = url_decode(rest.substr(0, slash));
+    std::string file = slash == std::string::npos ? "" : rest.substr(slash + 1);
+
+    std::string body;
+    std::string content_type = "video/mp4";
+    std::string cache = "max-age=60";
+    bool found = false;
+
+    auto packager = engine.get_hls_packager(cam_id);
+    if (packager) {
+        unsigned long long msn = 0, part = 0;
+        if (file == "index.m3u8") {
+            found = packager->get_playlist(body, query_param(query, "_HLS_msn"), query_param(query, "_HLS_part"));
+            content_type = "application/vnd.apple.mpegurl";
+            cache = "no-cache";
+        } else if (file == "init.mp4") {
+            found = packager->get_init(body);
+        } else if (sscanf(file.c_str(), "seg_%llu.m4s", &msn) == 1) {
+            found = packager->get_segment(msn, body);
+        } else if (sscanf(file.c_str(), "part_%llu_%llu.m4s", &msn, &part) == 2) {
+            found = packager->get_part(msn, part, body);
+        }
+    }
+
+    std::string response;
+    if (found) {
+        response = "HTTP/1.1 200 OK\r\nContent-Type: " + content_type + "\r\nCache-Control: " + cache +
+                   "\r\nAccess-Control-Allow-Origin: *\r\nContent-Length: " + std::to_string(body.length()) +
+                   "\r\n\r\n" + body;
+    } else {
+        std::string msg = "404 Not Found";
+        response = "HTTP/1.1 404 Not Found\r\nContent-Length: " + std::to_string(msg.length()) + "\r\n\r\n" + msg;
+    }
+    send_all(socket, response);
+    close(socket);
+}
+
+// LL-HLS blocking requests (a playlist reload with _HLS_msn, a part that may
+// not be out yet) hold their thread for up to 3 target durations. They get a
+// pool of their own with no queue: once every thread is waiting the client
+// gets a 503 and retries, rather than a segment fetch waiting behind them.
+static constexpr size_t BLOCKING_HLS_THREADS = 64;
+std::atomic<int> pending_blocking_hls{0};
+
+ThreadPool& blocking_hls_pool() {
+    static ThreadPool pool(BLOCKING_HLS_THREADS);
+    return pool;
+}
+
+bool is_blocking_hls_request(const std::string& request) {
+    std::string target = request.substr(4, request.find(' ', 4) - 4);
+    size_t query = target.find('?');
+    std::string path = target.substr(0, query);
+    if (path.find("/part_") != std::string::npos) return true;
+    return query != std::string::npos && path.size() >= 11 && path.compare(path.size() - 11, 11, "/index.m3u8") == 0 &&
+           target.find("_HLS_msn=", query) != std::string::npos;
+}
+
+// --- Recordings: /recordings/<camera>/<file>, resumable (Range / If-Range) ---
+// The body goes from the page cache straight to the socket (sendfile), never
+// through user space. Downloads have their own pool, so any number of
+// multi-GB transfers leaves the control API and live HLS alone. There is no
+// queue behind it: once every thread is sending, a new download gets a 503
+// with Retry-After right away instead of waiting unseen for a free thread.
+static constexpr size_t DOWNLOAD_THREADS = 8;
+static constexpr int MAX_PENDING_DOWNLOADS = DOWNLOAD_THREADS;
+static constexpr int DOWNLOAD_SEND_TIMEOUT_SEC = 30; // A stalled client gives its thread back
+std::atomic<int> pending_downloads{0};
+
+ThreadPool& download_pool() {
+    static ThreadPool pool(DOWNLOAD_THREADS);
+    return pool;
+}
+
+// One-recording checks of /api/verify?file=, by job id. Reading a multi-GB
+// recording takes a while, so they run on a pool of their own (queued past
+// VERIFY_THREADS, never taking a download's thread); results are kept until
+// MAX_VERIFY_JOBS newer jobs have been started.
+static constexpr size_t VERIFY_THREADS = 2;
+static constexpr size_t MAX_VERIFY_JOBS = 64;
+struct VerifyJob {
+    bool done;
+    ChecksumResult result;
+};
+std::map<uint64_t, VerifyJob> verify_jobs;
+uint64_t next_verify_job = 1;
+std::mutex verify_mutex;
+
+ThreadPool& verify_pool() {
+    static ThreadPool pool(VERIFY_THREADS);
+    return pool;
+}
+
+uint64_t start_verify(const std::string& path) {
+    uint64_t id;
+    {
+        std::lock_guard<std::mutex> lock(verify_mutex);
+        id = next_verify_job++;
+        verify_jobs[id] = {false, {path, ChecksumResult::UNREADABLE, 0, 0, 0, 0, 0}};
+        while (verify_jobs.size() > MAX_VERIFY_JOBS && verify_jobs.begin()->second.done) {
+            verify_jobs.erase(verify_jobs.begin());
+        }
+    }
+    verify_pool().enqueue([id, path] {
+        ChecksumResult result = verify_checksum(path);
+        std::lock_guard<std::mutex> lock(verify_mutex);
+        auto it = verify_jobs.find(id);
+        if (it != verify_jobs.end()) it->second = {true, result};
+    });
+    return id;
+}
+
+void close_file(int fd) {
+#ifdef _WIN32
+    _close(fd);
+#else
+    ::close(fd);
+#endif
+}
+
+// "bytes=first-last" of a file of the given size: 1 = satisfiable range,
+// 0 = serve the whole file (no header, another unit, or several ranges),
+// -1 = unsatisfiable or not a byte range (e.g. "bytes=abc-")
+int parse_range(const std::string& value, uint64_t size, uint64_t& first, uint64_t& last) {
+    if (value.rfind("bytes=", 0) != 0 || value.find(',') != std::string::npos) return 0;
+    std::string spec = value.substr(6);
+    size_t dash = spec.find('-');
+    if (dash == std::string::npos) return -1;
+    std::string from = spec.substr(0, dash), to = spec.substr(dash + 1);
+    auto digits = [](const std::string& text) {
+        return text.size() <= 19 && std::all_of(text.begin(), text.end(), [](char c) { return c >= '0' && c <= '9'; });
+    };
+    if (!digits(from) || !digits(to) || (from.empty() && to.empty())) return -1;
+    if (from.empty()) { // Suffix: the last N bytes
+        uint64_t n = std::strtoull(to.c_str(), nullptr, 10);
+        if (n == 0 || size == 0) return -1;
+        first = n >= size ? 0 : size - n;
+        last = size - 1;
+        return 1;
+    }
+    first = std::strtoull(from.c_str(), nullptr, 10);
+    last = to.empty() ? size - 1 : std::min<uint64_t>(std::strtoull(to.c_str(), nullptr, 10), size - 1);
+    if (first >= size || last < first) return -1;
+    return 1;
+}
+
+std::string http_date(time_t t) {
+    struct tm tm_utc;
+#ifdef _WIN32
+    gmtime_s(&tm_utc, &t);
+#else
+    gmtime_r(&t, &tm_utc);
+#endif
+    char buf[64];
+    strftime(buf, sizeof(buf), "%a, %d %b %Y %H:%M:%S GMT", &tm_utc);
+    return buf;
+}
+
+void handle_recording_request(int socket, const std::string& request) {
+    bool head = request.rfind("HEAD ", 0) == 0;
+    size_t start = head ? 5 : 4;
+    size_t path_end = request.find(' ', start);
+    std::string target = request.substr(start, path_end == std::string::npos ? std::string::npos : path_end - start);
+    target = target.substr(0, target.find('?'));
+    std::string path = storage.resolve(url_decode(target.substr(std::strlen("/recordings/"))));
+
+    int fd = path.empty() ? -1 : open(path.c_str(), O_RDONLY | O_BINARY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        if (fd >= 0) close_file(fd);
+        send_all(socket, "HTTP/1.1 404 Not Found\r\nContent-Length: 13\r\n\r\n404 Not Found");
+        close(socket);
+        return;
+    }
+
+    // A recording still being written grows: this response covers what exists now
+    uint64_t size = st.st_size;
+    std::stringstream etag;
+    etag << "\"" << std::hex << size << "-" << st.st_mtime << "\"";
+    std::string last_modified = http_date(st.st_mtime);
+
+    // If-Range: only resume if the file is still the one the client started on
+    uint64_t first = 0, last = size > 0 ? size - 1 : 0;
+    std::string if_range = header_value(request, "If-Range");
+    int range = 0;
+    if (if_range.empty() || if_range == etag.str() || if_range == last_modified) {
+        range = parse_range(header_value(request, "Range"), size, first, last);
+    }
+
+    std::string content_type = path.size() > 4 && path.compare(path.size() - 4, 4, ".mkv") == 0
+        ? "video/x-matroska" : "application/octet-stream";
+    std::stringstream headers;
+    if (range < 0) {
+        headers << "HTTP/1.1 416 Range Not Satisfiable\r\nContent-Range: bytes */" << size
+                << "\r\nContent-Length: 0\r\n\r\n";
+        send_all(socket, headers.str());
+        close_file(fd);
+        close(socket);
+        return;
+    }
+    uint64_t length = size == 0 ? 0 : last - first + 1;
+    headers << (range > 0 ? "HTTP/1.1 206 Partial Content\r\n" : "HTTP/1.1 200 OK\r\n")
+            << "Content-Type: " << content_type << "\r\nAccept-Ranges: bytes\r\nETag: " << etag.str()
+            << "\r\nLast-Modified: " << last_modified << "\r\nContent-Length: " << length << "\r\n";
+    if (range > 0) headers << "Content-Range: bytes " << first << "-" << last << "/" << size << "\r\n";
+    headers << "\r\n";
+    send_all(socket, headers.str());
+
+#ifdef _WIN32
+    DWORD timeout = DOWNLOAD_SEND_TIMEOUT_SEC * 1000;
+    setsockopt(socket, SOL_SOCKET, SO_SNDTIMEO, (const char*)&timeout, sizeof(timeout));
+#else
+    struct timeval timeout = {DOWNLOAD_SEND_TIMEOUT_SEC, 0};
+    setsockopt(socket, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+#endif
+
+    uint64_t remaining = head ? 0 : length;
+#ifdef __linux__
+    off_t offset = first;
+    while (remaining > 0) {
+        ssize_t n = sendfile(socket, fd, &offset, std::min<uint64_t>(remaining, 1 << 30));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break; // Client gone or timed out
+        remaining -= n;
+    }
+#else
+    // No sendfile: bounded chunks, the file is never held in memory
+    lseek(fd, first, SEEK_SET);
+    std::vector<char> chunk(256 * 1024);
+    while (remaining > 0) {
+        int n = read(fd, chunk.data(), (unsigned)std::min<uint64_t>(remaining, chunk.size()));
+        if (n <= 0) break;
+        int sent = 0;
+        while (sent < n) {
+            int m = send(socket, chunk.data() + sent, n - sent, 0);
+            if (m <= 0) break;
+            sent += m;
         }
+        if (sent < n) break;
+        remaining -= n;
     }
+#endif
+    close_file(fd);
+    close(socket);
 }
 
 void handle_http_client(int new_socket) {
@@ -122,8 +577,36 @@ void handle_http_client(int new_socket) {
     std::string request(buffer);
     std::string response;
 
+    // --- Live HLS (handed over to the media pool, blocking reloads to their own) ---
+    if (request.rfind("GET /hls/", 0) == 0) {
+        if (!is_blocking_hls_request(request)) {
+            media_pool().enqueue([new_socket, request] { handle_hls_request(new_socket, request); });
+            return;
+        }
+        if (++pending_blocking_hls <= static_cast<int>(BLOCKING_HLS_THREADS)) {
+            blocking_hls_pool().enqueue([new_socket, request] {
+                handle_hls_request(new_socket, request);
+                --pending_blocking_hls;
+            });
+            return;
+        }
+        --pending_blocking_hls;
+        response = "HTTP/1.1 503 Service Unavailable\r\nRetry-After: 1\r\nContent-Length: 0\r\n\r\n";
+    }
+    // --- Recording downloads (handed over to the download pool) ---
+    else if (request.rfind("GET /recordings/", 0) == 0 || request.rfind("HEAD /recordings/", 0) == 0) {
+        if (++pending_downloads <= MAX_PENDING_DOWNLOADS) {
+            download_pool().enqueue([new_socket, request] {
+                handle_recording_request(new_socket, request);
+                --pending_downloads;
+            });
+            return;
+        }
+        --pending_downloads;
+        response = "HTTP/1.1 503 Service Unavailable\r\nRetry-After: 10\r\nContent-Length: 0\r\n\r\n";
+    }
     // --- API: Get List of Nodes ---
-    if (request.find("GET /api/nodes") != std::string::npos) {
+    else if (request.find("GET /api/nodes") != std::string::npos) {
         auto nodes = sessionMgr.get_active_observers();
         std::stringstream json;
         json << "[";
@@ -135,9 +618,208 @@ void handle_http_client(int new_socket) {
         std::string body = json.str();
         response = "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nContent-Length: " + std::to_string(body.length()) + "\r\n\r\n" + body;
     }
+    // --- API: Per-camera stream health ---
+    else if (request.find("GET /api/stats") != std::string::npos) {
+        auto ingests = engine.get_ingest_info();
+        std::stringstream json;
+        json << std::fixed << std::setprecision(2) << "[";
+        for (size_t i = 0; i < ingests.size(); ++i) {
+            const auto& in = ingests[i];
+            const auto& h = in.health;
+            double loss_pct = h.packets + h.lost > 0 ? 100.0 * h.lost / (h.packets + h.lost) : 0;
+            json << "{\"id\":\"" << json_escape(in.camera_id) << "\", \"port\":" << in.port
+                 << ", \"consumers\":" << in.consumers << ", \"preroll_bytes\":" << in.preroll_bytes
+                 << ", \"bitrate_kbps\":" << h.bitrate_kbps << ", \"fps\":" << h.fps
+                 << ", \"packets\":" << h.packets << ", \"lost\":" << h.lost << ", \"loss_pct\":" << loss_pct
+                 << ", \"reordered\":" << h.reordered << ", \"jitter_ms\":" << h.jitter_ms
+                 << ", \"frames\":" << h.frames << ", \"keyframes\":" << h.keyframes
+                 << ", \"keyframe_interval_ms\":" << h.keyframe_interval_ms
+                 << ", \"probe_cpu_pct\":" << std::setprecision(4) << h.probe_cpu_percent << std::setprecision(2)
+                 << ", \"reliable\":" << (h.reliable ? "true" : "false");
+            if (h.reliable) {
+                json << ", \"rtx_requests\":" << h.rtx_requests << ", \"rtx_recovered\":" << h.rtx_recovered
+                     << ", \"late\":" << h.late;
+            }
+            json << "}";
+            if (i < ingests.size() - 1) json << ",";
+        }
+        json << "]";
+        std::string body = json.str();
+        response = "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nContent-Length: " + std::to_string(body.length()) + "\r\n\r\n" + body;
+    }
+    // --- API: Integrity of the recordings against their checksums ---
+    else if (request.find("GET /api/verify") != std::string::npos) {
+        // /api/verify?file=<relative path>  starts checking one recording: 202 with its job
+        // /api/verify?job=<id>              result of that check (202 while it runs)
+        // /api/verify?all=1                 starts checking every recording in the background
+        // /api/verify                       progress and failures of the last full check
+        std::string line = request.substr(0, request.find("\r\n"));
+        std::string file = query_string(line, "file");
+        std::string job = query_string(line, "job");
+        std::string body;
+        std::string status = "200 OK";
+        if (!file.empty()) {
+            std::string path = storage.resolve(file);
+            if (!path.empty()) {
+                std::string id = std::to_string(start_verify(path));
+                body = "{\"job\":" + id + ", \"status\":\"/api/verify?job=" + id + "\"}";
+                status = "202 Accepted";
+            }
+        } else if (!job.empty()) {
+            uint64_t id = std::strtoull(job.c_str(), nullptr, 10);
+            std::lock_guard<std::mutex> lock(verify_mutex);
+            auto it = verify_jobs.find(id);
+            if (it != verify_jobs.end() && it->second.done) {
+                body = checksum_result_json(it->second.result);
+            } else if (it != verify_jobs.end()) {
+                body = "{\"job\":" + job + ", \"running\":true}";
+                status = "202 Accepted";
+            }
+        } else {
+            if (query_string(line, "all") == "1") {
+                RecordingQuery query;
+                query.limit = SIZE_MAX;
+                RecordingPage page = storage.get_catalog().query(query);
+                std::vector<std::string> files;
+                for (const auto& r : page.items) files.push_back(r.location);
+                checksum_scan.start(files);
+            }
+            ChecksumScan::Status st = checksum_scan.status();
+            std::stringstream json;
+            json << std::fixed << std::setprecision(1) << "{\"running\":" << (st.running ? "true" : "false")
+                 << ", \"files\":" << st.files << ", \"checked\":" << st.checked << ", \"ok\":" << st.ok
+                 << ", \"without_checksum\":" << st.unsummed << ", \"bytes\":" << st.bytes
+                 << ", \"seconds\":" << st.seconds << ", \"mb_per_sec\":"
+                 << (st.seconds > 0 ? st.bytes / (1024.0 * 1024.0) / st.seconds : 0.0) << ", \"crc32c\":\""
+                 << crc32c_implementation() << "\", \"failures\":[";
+            for (size_t i = 0; i < st.failures.size(); ++i) {
+                json << checksum_result_json(st.failures[i]) << (i < st.failures.size() - 1 ? "," : "");
+            }
+            json << "]}";
+            body = json.str();
+        }
+        if (body.empty()) response = "HTTP/1.1 404 Not Found\r\nContent-Length: 13\r\n\r\n404 Not Found";
+        else response = "HTTP/1.1 " + status + "\r\nContent-Type: application/json\r\nContent-Length: " + std::to_string(body.length()) + "\r\n\r\n" + body;
+    }
+    // --- API: Disk usage and retention ---
+    else if (request.find("GET /api/storage") != std::string::npos) {
+        RetentionEngine::Stats st = engine.get_storage_stats();
+        std::stringstream json;
+        json << "{\"free_bytes\":" << st.free_bytes << ", \"used_bytes\":" << st.used_bytes
+             << ", \"evicted_files\":" << st.evicted_files << ", \"evicted_bytes\":" << st.evicted_bytes
+             << ", \"stopped_recordings\":" << st.stopped_recordings << ", \"bulk_free_bytes\":" << st.bulk_free_bytes
+             << ", \"migrated_files\":" << st.migrated_files << ", \"migrated_bytes\":" << st.migrated_bytes << "}";
+        std::string body = json.str();
+        response = "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nContent-Length: " + std::to_string(body.length()) + "\r\n\r\n" + body;
+    }
+    // --- API: Background re-encoding of aged recordings ---
+    else if (request.find("GET /api/transcoder") != std::string::npos) {
+        Transcoder::Stats st = engine.get_transcode_stats();
+        std::stringstream json;
+        json << std::fixed << std::setprecision(2) << "{\"transcoded_files\":" << st.transcoded_files
+             << ", \"failed_files\":" << st.failed_files << ", \"input_bytes\":" << st.input_bytes
+             << ", \"output_bytes\":" << st.output_bytes << ", \"compression_ratio\":"
+             << (st.output_bytes ? double(st.input_bytes) / st.output_bytes : 0.0)
+             << ", \"saved_bytes\":" << st.input_bytes - st.output_bytes << ", \"encode_seconds\":" << st.encode_seconds
+             << ", \"paused_seconds\":" << st.paused_seconds << ", \"paused\":" << (st.paused ? "true" : "false")
+             << ", \"current\":\"" << json_escape(st.current) << "\"}";
+        std::string body = json.str();
+        response = "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nContent-Length: " + std::to_string(body.length()) + "\r\n\r\n" + body;
+    }
+    // --- API: Startup repair of unfinalized recordings ---
+    else if (request.find("GET /api/recovery") != std::string::npos) {
+        CrashRecovery::Stats st = engine.get_recovery_stats();
+        std::stringstream json;
+        json << std::fixed << std::setprecision(2) << "{\"running\":" << (st.running ? "true" : "false")
+             << ", \"scanned\":" << st.scanned << ", \"unfinalized\":" << st.unfinalized
+             << ", \"repaired\":" << st.repaired << ", \"failed\":" << st.failed << ", \"workers\":" << st.workers
+             << ", \"seconds\":" << st.seconds << ", \"seconds_per_repair\":"
+             << (st.repaired ? st.repair_seconds / st.repaired : 0.0) << "}";
+        std::string body = json.str();
+        response = "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nContent-Length: " + std::to_string(body.length()) + "\r\n\r\n" + body;
+    }
+    // --- API: Writer health of the active recordings ---
+    else if (request.find("GET /api/recorders") != std::string::npos) {
+        auto recorders = engine.get_recorder_info();
+        std::stringstream json;
+        json << std::fixed << std::setprecision(2) << "[";
+        for (size_t i = 0; i < recorders.size(); ++i) {
+            const auto& r = recorders[i];
+            json << "{\"name\":\"" << json_escape(r.name) << "\", \"camera\":\"" << json_escape(r.camera)
+                 << "\", \"file\":\"" << json_escape(r.filename)
+                 << "\", \"io_uring\":" << (r.io_uring ? "true" : "false") << ", \"queue_depth\":" << r.queue_depth
+                 << ", \"max_queue_depth\":" << r.max_queue_depth << ", \"stall_ms\":" << r.stall_ms
+                 << ", \"stalls\":" << r.stalls << ", \"queued_bytes\":" << r.queued_bytes
+                 << ", \"max_queued_bytes\":" << r.max_queued_bytes << ", \"max_queue_stall_ms\":" << r.max_queue_stall_ms
+                 << ", \"dropped_buffers\":" << r.dropped_buffers << ", \"dropped_bytes\":" << r.dropped_bytes
+                 << ", \"high_water_alarms\":" << r.high_water_alarms
+                 << ", \"above_high_water\":" << (r.above_high_water ? "true" : "false")
+                 << ", \"write_error\":\"" << json_escape(r.write_error) << "\"}";
+            if (i < recorders.size() - 1) json << ",";
+        }
+        json << "]";
+        std::string body = json.str();
+        response = "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nContent-Length: " + std::to_string(body.length()) + "\r\n\r\n" + body;
+    }
+    // --- API: Search the recordings ---
+    else if (request.find("GET /api/recordings") != std::string::npos) {
+        // Parse: /api/recordings?camera=&doctor=&from=&to=&sort=start|size|duration&order=asc|desc&offset=&limit=
+        // (from/to: unix seconds of the recording start)
+        std::string line = request.substr(0, request.find("\r\n"));
+        RecordingQuery query;
+        query.camera = query_string(line, "camera");
+        query.doctor = query_string(line, "doctor");
+        // File names carry the doctor reduced to a safe path component
+        if (!query.doctor.empty()) query.doctor = VideoStorage::path_component(query.doctor);
+        query.from = std::max(0LL, std::atoll(query_string(line, "from").c_str()));
+        query.to = std::max(0LL, std::atoll(query_string(line, "to").c_str()));
+        std::string sort = query_string(line, "sort");
+        if (sort == "size") query.sort = RecordingQuery::BY_SIZE;
+        else if (sort == "duration") query.sort = RecordingQuery::BY_DURATION;
+        query.descending = query_string(line, "order") != "asc";
+        query.offset = std::max(0LL, std::atoll(query_string(line, "offset").c_str()));
+        std::string limit = query_string(line, "limit");
+        if (!limit.empty()) query.limit = std::min(1000LL, std::max(0LL, std::atoll(limit.c_str())));
+
+        RecordingPage page = storage.get_catalog().query(query);
+        std::stringstream json;
+        json << std::fixed << std::setprecision(1) << "{\"total\":" << page.total << ", \"offset\":" << query.offset
+             << ", \"items\":[";
+        for (size_t i = 0; i < page.items.size(); ++i) {
+            const auto& r = page.items[i];
+            json << "{\"path\":\"" << json_escape(r.path) << "\", \"camera\":\"" << json_escape(r.camera)
+                 << "\", \"doctor\":\"" << json_escape(r.doctor) << "\", \"start\":" << r.start
+                 << ", \"duration\":" << r.duration << ", \"size\":" << r.size
+                 << ", \"live\":" << (r.live ? "true" : "false") << ", \"tier\":\"" << (r.tier == 0 ? "fast" : "bulk")
+                 << "\"}";
+            if (i < page.items.size() - 1) json << ",";
+        }
+        json << "]}";
+        std::string body = json.str();
+        response = "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nContent-Length: " + std::to_string(body.length()) + "\r\n\r\n" + body;
+    }
+    // --- API: Byte offset of the keyframe at or before t (seconds) in a recording ---
+    else if (request.find("GET /api/seek") != std::string::npos) {
+        // Parse: /api/seek?file=CameraID/recording.mkv&t=Seconds
+        std::string line = request.substr(0, request.find("\r\n"));
+        std::string path = storage.resolve(query_string(line, "file"));
+        std::string t = query_string(line, "t");
+        std::unique_ptr<SeekIndex> index = path.empty() ? nullptr : storage.open_index(path);
+        SeekIndexEntry entry;
+        if (index && index->find(static_cast<uint64_t>(std::max(0.0, std::atof(t.c_str())) * GST_SECOND), entry)) {
+            std::stringstream json;
+            json << std::fixed << std::setprecision(3) << "{\"time\":" << entry.pts / 1e9
+                 << ", \"offset\":" << entry.offset << ", \"keyframes\":" << index->size()
+                 << ", \"doctor\":\"" << json_escape(index->info().doctor) << "\", \"camera\":\"" << json_escape(index->info().camera) << "\"}";
+            std::string body = json.str();
+            response = "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nContent-Length: " + std::to_string(body.length()) + "\r\n\r\n" + body;
+        } else {
+            response = "HTTP/1.1 404 Not Found\r\n\r\nError: No index for this recording.";
+        }
+    }
     // --- API: Start Recording ---
     else if (request.find("GET /api/start") != std::string::npos) {
-        // Parse: /api/start?doc=Name&id=CameraID
+        // Parse: /api/start?doc=Name&id=CameraID[&mode=raw|uring]
         std::string doc = "Unknown";
         std::string cam_id = "";
         int port = -1; // Default to invalid to ensure we find a registered camera
@@ -150,16 +832,25 @@ void handle_http_client(int new_socket) {
         }
         size_t idPos = request.find("id=");
         if (idPos != std::string::npos) {
-            size_t end = request.find(" ", idPos);
+            size_t end = request.find_first_of("& ", idPos);
             cam_id = request.substr(idPos + 3, end - (idPos + 3));
             std::lock_guard<std::mutex> lock(node_ports_mutex);
             if (node_ports.count(cam_id)) port = node_ports[cam_id];
         }
 
-        if (port != -1) {
+        // mode=raw captures RTP packets now and remuxes to MKV when the CPU is idle,
+        // mode=uring records MKV with io_uring writes
+        StreamEngine::RecordMode mode = StreamEngine::MUXED;
+        if (request.find("mode=raw") != std::string::npos) mode = StreamEngine::RAW_RTP;
+        else if (request.find("mode=uring") != std::string::npos) mode = StreamEngine::MUXED_URING;
+        double latency_ms = 0;
+        if (port != -1 && engine.start_recording(doc, port, mode, &latency_ms)) {
             sessionMgr.start_session(doc);
-            engine.start_recording(doc, port);
-            response = "HTTP/1.1 200 OK\r\n\r\nStarted";
+            std::stringstream body;
+            body << "Started in " << std::fixed << std::setprecision(2) << latency_ms << " ms";
+            response = "HTTP/1.1 200 OK\r\n\r\n" + body.str();
+        } else if (port != -1) {
+            response = "HTTP/1.1 500 Internal Server Error\r\n\r\nError: Recording could not be started (see server log).";
         } else {
             Logger::error("Web API: Failed to start. Camera ID '" + cam_id + "' not found.");
             response = "HTTP/1.1 400 Bad Request\r\n\r\nError: Camera not found. Please refresh list.";
@@ -167,17 +858,28 @@ void handle_http_client(int new_socket) {
     }
     // --- API: Stop Recording ---
     else if (request.find("GET /api/stop") != std::string::npos) {
+        // Parse: /api/stop?doc=Name[&wait=1]
         std::string doc = "Unknown";
         size_t docPos = request.find("doc=");
         if (docPos != std::string::npos) {
-            size_t end = request.find(" ", docPos);
+            size_t end = request.find_first_of("& ", docPos);
             doc = request.substr(docPos + 4, end - (docPos + 4));
         }
+        // wait=1 holds the response until the file is finalized (off the engine lock)
+        bool wait = request.find("wait=1") != std::string::npos;
 
         if (sessionMgr.is_recording_active()) {
             sessionMgr.stop_session();
-            engine.stop_recording(doc);
-            response = "HTTP/1.1 200 OK\r\n\r\nStopped";
+            std::shared_future<bool> finalized = engine.stop_recording(doc);
+            if (!finalized.valid()) {
+                response = "HTTP/1.1 400 Bad Request\r\n\r\nError: No recording for " + doc + ".";
+            } else if (!wait) {
+                response = "HTTP/1.1 200 OK\r\n\r\nStopping";
+            } else if (finalized.get()) {
+                response = "HTTP/1.1 200 OK\r\n\r\nStopped";
+            } else {
+                response = "HTTP/1.1 500 Internal Server Error\r\n\r\nError: Recording could not be finalized.";
+            }
         } else {
             response = "HTTP/1.1 400 Bad Request\r\n\r\nError: No active recording to stop.";
         }
@@ -201,45 +903,10 @@ void handle_http_client(int new_socket) {
         }
     }
 
-    send(new_socket, response.c_str(), response.length(), 0);
+    send_all(new_socket, response);
     close(new_socket);
 }
 
-// Simple ThreadPool to prevent creating too many threads
-class ThreadPool {
-    std::vector<std::thread> workers;
-    std::queue<std::function<void()>> tasks;
-    std::mutex queue_mutex;
-    std::condition_variable condition;
-    bool stop = false;
-public:
-    ThreadPool(size_t threads) {
-        for(size_t i = 0; i < threads; ++i)
-            workers.emplace_back([this] {
-                while(true) {
-                    std::function<void()> task;
-                    {
-                        std::unique_lock<std::mutex> lock(this->queue_mutex);
-                        this->condition.wait(lock, [this]{ return this->stop || !this->tasks.empty(); });
-                        if(this->stop && this->tasks.empty()) return;
-                        task = std::move(this->tasks.front());
-                        this->tasks.pop();
-                    }
-                    task();
-                }
-            });
-    }
-    ~ThreadPool() {
-        { std::unique_lock<std::mutex> lock(queue_mutex); stop = true; }
-        condition.notify_all();
-        for(std::thread &worker: workers) worker.join();
-    }
-    void enqueue(std::function<void()> task) {
-        { std::unique_lock<std::mutex> lock(queue_mutex); tasks.push(task); }
-        condition.notify_one();
-    }
-};
-
 void web_server() {
     int server_fd, new_socket;
     struct sockaddr_in address;
@@ -282,7 +949,43 @@ void web_server() {
     }
 }
 
-int main() {
+int main(int argc, char** argv) {
+    // One-off move of an older flat or per camera folder into camera/day folders
+    if (argc > 1 && std::string(argv[1]) == "--migrate-storage") {
+        storage.migrate_layout();
+        return 0;
+    }
+    // Checks every recording (both tiers) against its checksums; exit code 1 if
+    // any is damaged or was never finalized
+    if (argc > 1 && std::string(argv[1]) == "--verify") {
+        if (const char* bulk_dir = std::getenv("VIDEO_BULK_DIR")) storage.set_bulk_dir(bulk_dir);
+        std::vector<std::string> files = storage.list_videos();
+        std::mutex print_mutex;
+        size_t failed = 0, unsummed = 0;
+        uint64_t bytes = 0;
+        auto started = std::chrono::steady_clock::now();
+        verify_checksums(files, 0, [&](const ChecksumResult& r) {
+            std::lock_guard<std::mutex> lock(print_mutex);
+            bytes += r.size;
+            if (r.status == ChecksumResult::OK) return;
+            if (r.status == ChecksumResult::NO_CHECKSUM) {
+                unsummed++;
+                return;
+            }
+            failed++;
+            std::cout << ChecksumResult::status_name(r.status) << "  " << r.path;
+            if (r.bad_chunks) std::cout << "  (" << r.bad_chunks << " bad chunk(s), first at byte " << r.first_bad_offset << ")";
+            std::cout << std::endl;
+        });
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+        std::cout << "Verified " << files.size() << " recordings, " << bytes / (1024 * 1024) << " MB in " << std::fixed
+                  << std::setprecision(1) << seconds << " s ("
+                  << (seconds > 0 ? bytes / (1024.0 * 1024.0) / seconds : 0.0) << " MB/s, crc32c: "
+                  << crc32c_implementation() << "): " << failed << " failed, " << unsummed << " without checksums"
+                  << std::endl;
+        return failed ? 1 : 0;
+    }
+
     Logger::info("--- Hospital Video Server Starting ---");
 
     #ifdef _WIN32
@@ -298,8 +1001,38 @@ int main() {
     std::signal(SIGPIPE, SIG_IGN);
     #endif
 
+    // Optional second tier on a bulk disk: finalized recordings move there after
+    // RetentionPolicy::migrate_after_sec and stay listed, playable and downloadable
+    if (const char* bulk_dir = std::getenv("VIDEO_BULK_DIR")) storage.set_bulk_dir(bulk_dir);
+
     // 1. Initialize Engine
     engine.init();
+    // Rotate recordings every 15 minutes or 2 GB, whichever comes first
+    engine.set_segment_limits(15 * 60, 2ULL * 1024 * 1024 * 1024);
+    // Grow files 64 MB at a time, write 1 MB batches, fdatasync every 5 s
+    engine.set_write_options(64 * 1024 * 1024, 1024 * 1024, 5);
+    // Absorb up to 64 MB (~2 min at 4 Mbit/s) of disk stalls per recording,
+    // warn at 75% and lose whole GOPs rather than block the camera's ingest
+    engine.set_writer_queue(64 * 1024 * 1024, StreamEngine::WRITER_DROP_TO_KEYFRAME, 0.75);
+    // Keep up to 4 s / 16 MB of the current GOP per camera for instant starts
+    engine.set_preroll(4, 16 * 1024 * 1024);
+    // Let observer TVs join one multicast group per camera instead of pulling
+    // a unicast copy each (kept off the 239.0.0.1 camera group, TTL 1 = LAN)
+    engine.set_multicast("239.255.42.1", "239.255.42.254", 7000, 7999, 1);
+    // Keep 2 GB free by evicting the oldest finalized recordings; a live
+    // recording is only stopped once the disk is below 500 MB anyway
+    RetentionPolicy retention;
+    retention.min_free_bytes = 2ULL * 1024 * 1024 * 1024;
+    retention.critical_free_bytes = 500ULL * 1024 * 1024;
+    engine.set_retention(retention);
+    // Re-encode recordings older than 30 days from the cameras' ~10 Mbit/s to
+    // 2.5 Mbit/s on one idle-priority core, paused when busy
+    TranscodePolicy transcode;
+    transcode.min_age_sec = 30 * 24 * 3600;
+    transcode.bitrate_kbps = 2500;
+    engine.set_transcode(transcode);
+    // Index the existing recordings (in parallel) and follow the folder from now on
+    storage.get_catalog().start();
 
     // 2. Start Command Listener (Simulating the API Thread)
     std::thread api_thread(command_listener);